@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Bounded_Queue class, a thread safe FIFO with limited capacity
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#pragma once
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <stddef.h>
+
+/**
+ * @brief The #Bounded_Queue class
+ *
+ * Links two threads as producer and consumer. If the queue is full
+ * the producer blocks until the consumer has taken an item off
+ * the queue (backpressure), if it is empty the consumer blocks
+ * until an item is available or the queue has been closed.
+ */
+template <typename T>
+class Bounded_Queue
+{
+public:
+    /**
+     * @brief Construct Bounded_Queue object.
+     * @param[in] max_size - Maximum number of items in queue.
+     */
+    explicit Bounded_Queue(size_t max_size)
+        : m_max_size(max_size ? max_size : 1)
+        , m_closed(false)
+        , m_aborted(false)
+    {
+    }
+
+    /**
+     * @brief Add an item to the queue, wait until there is room for it.
+     * @param[in] item - Item to add.
+     * @return Returns true on success; false if the queue was closed or aborted. The item has not been added in that case.
+     */
+    bool push(const T & item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_not_full.wait(lock, [this]{ return (m_queue.size() < m_max_size || m_closed || m_aborted); });
+
+        if (m_closed || m_aborted)
+        {
+            return false;
+        }
+
+        m_queue.push(item);
+
+        m_not_empty.notify_one();
+
+        return true;
+    }
+
+    /**
+     * @brief Take the next item off the queue, wait until one is available.
+     * @param[out] item - Next item.
+     * @return Returns true if an item was returned; false if the queue was aborted, or closed and is empty.
+     */
+    bool pop(T * item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_not_empty.wait(lock, [this]{ return (!m_queue.empty() || m_closed || m_aborted); });
+
+        if (m_aborted || m_queue.empty())
+        {
+            return false;
+        }
+
+        *item = m_queue.front();
+        m_queue.pop();
+
+        m_not_full.notify_one();
+
+        return true;
+    }
+
+    /**
+     * @brief Take the next item off the queue, but do not wait.
+     *
+     * Can be used to drain the queue after it has been aborted.
+     *
+     * @param[out] item - Next item.
+     * @return Returns true if an item was returned; false if the queue is empty.
+     */
+    bool try_pop(T * item)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_queue.empty())
+        {
+            return false;
+        }
+
+        *item = m_queue.front();
+        m_queue.pop();
+
+        m_not_full.notify_one();
+
+        return true;
+    }
+
+    /**
+     * @brief Close the queue. No more items can be added, the consumer may take off the remaining items.
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_closed = true;
+
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+    /**
+     * @brief Abort the queue. Producer and consumer are released immediately.
+     */
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_aborted = true;
+
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+    /**
+     * @brief Make the queue usable again after it has been closed or aborted.
+     *
+     * The queue should be empty when this is called.
+     */
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_closed    = false;
+        m_aborted   = false;
+    }
+
+    /**
+     * @brief Check if the queue has been aborted.
+     * @return Returns true if aborted; false if not.
+     */
+    bool aborted()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_aborted;
+    }
+
+    /**
+     * @brief Get the current number of items in queue.
+     * @return Returns the current number of items in queue.
+     */
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_queue.size();
+    }
+
+private:
+    std::mutex              m_mutex;                        /**< @brief Access mutex */
+    std::condition_variable m_not_empty;                    /**< @brief Signalled when an item was added */
+    std::condition_variable m_not_full;                     /**< @brief Signalled when an item was removed */
+    std::queue<T>           m_queue;                        /**< @brief Items */
+    size_t                  m_max_size;                     /**< @brief Maximum number of items */
+    bool                    m_closed;                       /**< @brief If true, no more items will be added */
+    bool                    m_aborted;                      /**< @brief If true, all waiting threads have been released */
+};
+
+#endif // BOUNDED_QUEUE_H
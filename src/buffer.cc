@@ -35,8 +35,14 @@
 #include "logging.h"
 
 #include <unistd.h>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <thread>
 #include <sys/mman.h>
 #include <libgen.h>
+#include <fcntl.h>
 
 // Initially Buffer is empty. It will be allocated as needed.
 Buffer::Buffer()
@@ -45,7 +51,15 @@ Buffer::Buffer()
     , m_buffer_pos(0)
     , m_buffer_watermark(0)
     , m_buffer_size(0)
+    , m_mapped_size(0)
+    , m_dirty_size(0)
+    , m_epoch(0)
+    , m_wakeup_generation(0)
+    , m_window(0)
+    , m_window_start(0)
 {
+    m_readers[0] = 0;
+    m_readers[1] = 0;
 }
 
 // If buffer_data was never allocated, this is a no-op.
@@ -90,6 +104,14 @@ bool Buffer::init(bool erase_cache)
 
     make_cachefile_name(m_cachefile, filename(), params.current_format(virtualfile())->fileext());
 
+    if (params.m_disable_cache && params.m_stream_window)
+    {
+        return init_stream();
+    }
+
+    m_window            = 0;
+    m_window_start      = 0;
+
     try
     {
         // Create the path to the cache file
@@ -117,6 +139,9 @@ bool Buffer::init(bool erase_cache)
         m_buffer_pos        = 0;
         m_buffer_watermark  = 0;
         m_buffer_size       = 0;
+        m_mapped_size       = 0;
+        m_dirty.clear();
+        m_dirty_size        = 0;
 
         if (erase_cache)
         {
@@ -133,12 +158,21 @@ bool Buffer::init(bool erase_cache)
             throw false;
         }
 
-        if (!isdefaultsize)
         {
-            m_buffer_pos = m_buffer_watermark = filesize;
+            std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+            m_ranges.clear();
+
+            if (!isdefaultsize)
+            {
+                m_buffer_pos = m_buffer_watermark = filesize;
+
+                add_range(0, filesize);
+            }
         }
 
         m_buffer_size       = filesize;
+        m_mapped_size       = filesize;
         m_buffer            = static_cast<uint8_t*>(p);
     }
     catch (bool _success)
@@ -152,12 +186,48 @@ bool Buffer::init(bool erase_cache)
             m_buffer_pos        = 0;
             m_buffer_watermark  = 0;
             m_buffer_size       = 0;
+            m_mapped_size       = 0;
         }
     }
 
     return success;
 }
 
+bool Buffer::init_stream()
+{
+    size_t pagesize     = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t window       = (params.m_stream_window + pagesize - 1) / pagesize * pagesize;
+
+    uint8_t *p = static_cast<uint8_t *>(mmap(nullptr, window, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (p == MAP_FAILED)
+    {
+        Logging::error(m_cachefile, "Error allocating %1 bytes for the stream window: (%2) %3", window, errno, strerror(errno));
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+        m_ranges.clear();
+        m_stream_readers.clear();
+    }
+
+    m_fd                = -1;
+    m_buffer_pos        = 0;
+    m_buffer_watermark  = 0;
+    m_buffer_size       = 0;
+    m_mapped_size       = window;
+    m_dirty.clear();
+    m_dirty_size        = 0;
+    m_window            = window;
+    m_window_start      = 0;
+    m_buffer            = p;
+
+    Logging::debug(m_cachefile, "Streaming without cache file, keeping %1 in memory.", format_size(window).c_str());
+
+    return true;
+}
+
 bool Buffer::map_file(const std::string & filename, int *fd, uint8_t **p, size_t *filesize, bool *isdefaultsize, off_t defaultsize) const
 {
     bool success = true;
@@ -233,7 +303,7 @@ bool Buffer::map_file(const std::string & filename, int *fd, uint8_t **p, size_t
     return success;
 }
 
-bool Buffer::unmap_file(const std::string &filename, int * fd, uint8_t **p, size_t * filesize, size_t *buffer_pos) const
+bool Buffer::unmap_file(const std::string &filename, int * fd, uint8_t **p, size_t mapsize, size_t * filesize, size_t *buffer_pos) const
 {
     bool success = true;
 
@@ -254,10 +324,10 @@ bool Buffer::unmap_file(const std::string &filename, int * fd, uint8_t **p, size
 
     if (__p != nullptr)
     {
-        if (munmap(__p, __filesize ? __filesize : static_cast<size_t>(sysconf(_SC_PAGESIZE))) == -1) // Make sure we do not unmap a zero size file (spitzs EINVBAL error)
+        if (munmap(__p, mapsize ? mapsize : static_cast<size_t>(sysconf(_SC_PAGESIZE))) == -1) // Make sure we do not unmap a zero size file (spitzs EINVBAL error)
         {
-            Logging::error(filename, "Unmapping cache file failed: (%1) %2 %3", errno, strerror(errno), __filesize);
-            fprintf(stderr, "P = %p size = %zi\n", __p, __filesize);
+            Logging::error(filename, "Unmapping cache file failed: (%1) %2 %3", errno, strerror(errno), mapsize);
+            fprintf(stderr, "P = %p size = %zi\n", __p, mapsize);
             success = false;
         }
     }
@@ -305,14 +375,60 @@ bool Buffer::release(int flags /*= CACHE_CLOSE_NOOPT*/)
         return true;
     }
 
-    // Write it now to disk
+    if (m_window)
+    {
+        // Streaming: Nothing to write, simply free the memory
+        uint8_t *buffer     = m_buffer;
+
+        m_buffer            = nullptr;
+        m_buffer_size       = 0;
+        wait_for_readers();
+
+        if (munmap(buffer, m_mapped_size) == -1)
+        {
+            Logging::error(m_cachefile, "Unmapping stream window failed: (%1) %2", errno, strerror(errno));
+            success = false;
+        }
+
+        m_buffer_watermark  = 0;
+        m_buffer_pos        = 0;
+        m_mapped_size       = 0;
+
+        std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+        m_ranges.clear();
+        m_stream_readers.clear();
+
+        return success;
+    }
+
+    // Start writing remaining data to disk. Unmapping does not lose data, so there is no need to wait.
     flush();
 
-    if (!unmap_file(m_cachefile, &m_fd, &m_buffer, &m_buffer_watermark, &m_buffer_pos))
+    uint8_t *buffer     = m_buffer;
+    size_t mapsize      = m_mapped_size;
+    size_t watermark    = m_buffer_watermark;
+    size_t pos          = m_buffer_pos;
+
+    // Make sure no reader is still copying from the memory
+    m_buffer            = nullptr;
+    m_buffer_size       = 0;
+    wait_for_readers();
+
+    // Unmap all of the mapping, the file is cut back to the watermark
+    if (!unmap_file(m_cachefile, &m_fd, &buffer, mapsize, &watermark, &pos))
     {
         success = false;
     }
 
+    m_buffer_watermark  = watermark;
+    m_buffer_pos        = pos;
+    m_mapped_size       = 0;
+
+    {
+        std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+        m_ranges.clear();
+    }
+
     if (CACHE_CHECK_BIT(CACHE_CLOSE_DELETE, flags))
     {
         remove_cachefile();
@@ -327,27 +443,86 @@ bool Buffer::remove_cachefile()
     return remove_file(m_cachefile);
 }
 
-bool Buffer::flush()
+bool Buffer::flush(bool durable /*= false*/)
 {
     std::lock_guard<std::recursive_mutex> lck (m_mutex);
 
-    if (m_buffer != nullptr)
+    if (m_buffer == nullptr)
     {
-        if (msync(m_buffer, m_buffer_size, MS_SYNC) == -1)
-        {
-            Logging::error(m_cachefile, "Could not sync to disk: (%1) %2", errno, strerror(errno));
-            return false;
-        }
+        errno = EPERM;
+        return false;
     }
-    else
+
+    if (m_window)
+    {
+        // No file to write to in streaming mode
+        return true;
+    }
+
+    if (!writeback())
     {
-        errno = EPERM;
+        return false;
+    }
+
+    if (durable && fdatasync(m_fd) == -1)
+    {
+        Logging::error(m_cachefile, "Could not sync to disk: (%1) %2", errno, strerror(errno));
         return false;
     }
 
     return true;
 }
 
+bool Buffer::writeback()
+{
+    bool success = true;
+    size_t size = m_buffer_size;
+
+    for (const auto & range : m_dirty)
+    {
+        size_t start    = range.first;
+        size_t end      = std::min(range.second, size);
+
+        if (start >= end)
+        {
+            continue;   // File has been shrunk meanwhile
+        }
+
+#ifdef __linux__
+        // Only start write back, do not wait for it
+        if (sync_file_range(m_fd, static_cast<off_t>(start), static_cast<off_t>(end - start), SYNC_FILE_RANGE_WRITE) == -1)
+#else
+        // msync() requires a page aligned address
+        size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        start -= start % pagesize;
+
+        if (msync(m_buffer + start, end - start, MS_ASYNC) == -1)
+#endif
+        {
+            Logging::error(m_cachefile, "Could not write back to disk: (%1) %2", errno, strerror(errno));
+            success = false;
+            break;
+        }
+    }
+
+    m_dirty.clear();
+    m_dirty_size = 0;
+
+    return success;
+}
+
+void Buffer::add_dirty(size_t start, size_t end)
+{
+    merge_range(m_dirty, start, end);
+
+    m_dirty_size += end - start;
+
+    if (m_dirty_size >= CACHE_FLUSH_SIZE)
+    {
+        writeback();
+    }
+}
+
 bool Buffer::clear()
 {
     std::lock_guard<std::recursive_mutex> lck (m_mutex);
@@ -363,6 +538,17 @@ bool Buffer::clear()
     m_buffer_pos        = 0;
     m_buffer_watermark  = 0;
     m_buffer_size       = 0;
+    m_dirty.clear();
+    m_dirty_size        = 0;
+    m_window_start      = 0;
+
+    {
+        std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+        m_ranges.clear();
+    }
+
+    // The file will be truncated, keep readers away from the mapping. The mapping itself is kept and reused.
+    wait_for_readers();
 
     // If empty set file size to 1 page
     long filesize = sysconf (_SC_PAGESIZE);
@@ -376,6 +562,36 @@ bool Buffer::clear()
     return success;
 }
 
+bool Buffer::resume(size_t offset)
+{
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    if (m_buffer == nullptr || m_window)
+    {
+        errno = EBADF;
+        return false;
+    }
+
+    if (offset > m_buffer_size)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    m_buffer_pos        = offset;
+    m_buffer_watermark  = offset;
+
+    {
+        std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+        m_ranges.clear();
+
+        add_range(0, offset);
+    }
+
+    return true;
+}
+
 bool Buffer::reserve(size_t size)
 {
     std::lock_guard<std::recursive_mutex> lck (m_mutex);
@@ -386,26 +602,155 @@ bool Buffer::reserve(size_t size)
         return false;
     }
 
-    bool success = true;
-
     if (!size)
     {
         size = m_buffer_size;
     }
 
-    m_buffer = static_cast<uint8_t*>(mremap(m_buffer, m_buffer_size, size, MREMAP_MAYMOVE));
-    if (m_buffer != nullptr)
+    if (m_window)
     {
+        // The stream window never changes, only keep track of the file size
         m_buffer_size = size;
+        return true;
     }
 
-    if (ftruncate(m_fd, static_cast<off_t>(m_buffer_size)) == -1)
+    return remap(size);
+}
+
+bool Buffer::remap(size_t newsize)
+{
+    uint8_t *buffer = m_buffer;
+    size_t mapsize = newsize ? newsize : static_cast<size_t>(sysconf(_SC_PAGESIZE));   // Never map zero bytes
+
+    if (newsize < m_buffer_size)
+    {
+        // Shrink: Publish new size and wait until nobody uses the old one any longer
+        m_buffer_size = newsize;
+        wait_for_readers();
+
+        if (mapsize < m_mapped_size)
+        {
+            // Shrinking always works in place
+            if (mremap(buffer, m_mapped_size, mapsize, 0) == MAP_FAILED)
+            {
+                Logging::error(m_cachefile, "Error shrinking memory map: (%1) %2 (fd = %3)", errno, strerror(errno), m_fd);
+            }
+            else
+            {
+                m_mapped_size = mapsize;
+            }
+        }
+    }
+
+    if (newsize > m_buffer_size)
+    {
+        if (!allocate(m_buffer_size, newsize))
+        {
+            return false;
+        }
+    }
+    else if (ftruncate(m_fd, static_cast<off_t>(newsize)) == -1)
     {
         Logging::error(m_cachefile, "Error calling ftruncate() to resize the file: (%1) %2 (fd = %3)", errno, strerror(errno), m_fd);
-        success = false;
+        return false;
+    }
+
+    if (newsize > m_buffer_size)
+    {
+        if (mapsize > m_mapped_size)
+        {
+            // Readers may be copying from the buffer, so it must not move. Try to grow in place first.
+            if (mremap(buffer, m_mapped_size, mapsize, 0) == MAP_FAILED)
+            {
+                // Map the file again and release the old mapping when all readers have left
+                uint8_t *p = static_cast<uint8_t *>(mmap(nullptr, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+                if (p == MAP_FAILED)
+                {
+                    Logging::error(m_cachefile, "File mapping failed: (%1) %2 (fd = %3)", errno, strerror(errno), m_fd);
+                    return false;
+                }
+
+                // Publish new buffer before size, so readers never see the new size with the old buffer
+                m_buffer        = p;
+                m_buffer_size   = newsize;
+                wait_for_readers();
+
+                if (munmap(buffer, m_mapped_size) == -1)
+                {
+                    Logging::error(m_cachefile, "Unmapping cache file failed: (%1) %2", errno, strerror(errno));
+                }
+            }
+
+            m_mapped_size = mapsize;
+        }
+
+        m_buffer_size = newsize;
+    }
+
+    return true;
+}
+
+bool Buffer::allocate(size_t oldsize, size_t newsize)
+{
+#ifdef __linux__
+    // Reserve disk space now. With a sparse file, running out of space would only be noticed
+    // when the memory is written to (SIGBUS). Also keeps the cache file in one piece.
+    if (!fallocate(m_fd, 0, static_cast<off_t>(oldsize), static_cast<off_t>(newsize - oldsize)))
+    {
+        return true;
+    }
+
+    if (errno != EOPNOTSUPP && errno != ENOSYS)
+    {
+        Logging::error(m_cachefile, "Error allocating %1 bytes for the cache file: (%2) %3 (fd = %4)", newsize, errno, strerror(errno), m_fd);
+        return false;
+    }
+    // File system does not support this, fall back to ftruncate()
+#else
+    (void)oldsize;
+#endif
+
+    if (ftruncate(m_fd, static_cast<off_t>(newsize)) == -1)
+    {
+        Logging::error(m_cachefile, "Error calling ftruncate() to resize the file: (%1) %2 (fd = %3)", errno, strerror(errno), m_fd);
+        return false;
     }
 
-    return ((m_buffer != nullptr) && success);
+    return true;
+}
+
+unsigned int Buffer::reader_enter()
+{
+    for (;;)
+    {
+        unsigned int epoch = m_epoch;
+
+        m_readers[epoch & 1]++;
+
+        if (m_epoch == epoch)
+        {
+            return (epoch & 1);
+        }
+
+        // A writer has started a new epoch meanwhile, register for that one
+        m_readers[epoch & 1]--;
+    }
+}
+
+void Buffer::reader_leave(unsigned int slot)
+{
+    m_readers[slot]--;
+}
+
+void Buffer::wait_for_readers()
+{
+    unsigned int epoch = m_epoch++;
+
+    // Readers only copy memory, so this will not take long
+    while (m_readers[epoch & 1])
+    {
+        std::this_thread::yield();
+    }
 }
 
 size_t Buffer::write(const uint8_t* data, size_t length)
@@ -418,28 +763,310 @@ size_t Buffer::write(const uint8_t* data, size_t length)
         return 0;
     }
 
-    uint8_t* write_ptr = write_prepare(length);
-    if (!write_ptr)
+    uint8_t* write_ptr = nullptr;
+
+    if (m_window)
+    {
+        write_stream(data, length, m_buffer_pos);
+    }
+    else
+    {
+        write_ptr = write_prepare(length);
+    }
+
+    if (!m_window && !write_ptr)
     {
         length = 0;
     }
     else
     {
-        memcpy(write_ptr, data, length);
+        if (write_ptr != nullptr)
+        {
+            memcpy(write_ptr, data, length);
+            add_dirty(m_buffer_pos, m_buffer_pos + length);
+        }
+
         increment_pos(length);
+
+        // Publish watermark after the data has been written, readers may copy up to here without lock
+        if (m_buffer_watermark < m_buffer_pos)
+        {
+            m_buffer_watermark = m_buffer_pos.load();
+        }
+
+        // Wake up readers only if the lowest requested offset has been reached
+        std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+        add_range(m_buffer_pos - length, m_buffer_pos);
+
+        if (!m_waiters.empty() && *m_waiters.begin() <= m_buffer_pos)
+        {
+            m_wait_cond.notify_all();
+        }
     }
 
     return length;
 }
 
-uint8_t* Buffer::write_prepare(size_t length)
+size_t Buffer::write(const uint8_t* data, size_t length, size_t offset)
 {
-    if (reallocate(m_buffer_pos + length))
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    if (m_buffer == nullptr)
     {
-        if (m_buffer_watermark < m_buffer_pos + length)
+        errno = EBADF;
+        return 0;
+    }
+
+    if (m_window)
+    {
+        write_stream(data, length, offset);
+    }
+    else
+    {
+        if (!reallocate(offset + length))
         {
-            m_buffer_watermark = m_buffer_pos + length;
+            errno = ESPIPE;
+            return 0;
         }
+
+        memcpy(m_buffer + offset, data, length);
+
+        add_dirty(offset, offset + length);
+    }
+
+    std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+    add_range(offset, offset + length);
+
+    if (!m_waiters.empty())
+    {
+        // Waiters may wait for any range, so let them check
+        m_wait_cond.notify_all();
+    }
+
+    return length;
+}
+
+void Buffer::write_stream(const uint8_t* data, size_t length, size_t offset)
+{
+    size_t end = offset + length;
+
+    // Only keeps track of the file size, never fails in streaming mode
+    reallocate(end);
+
+    if (end > m_window_start + m_window)
+    {
+        // Drop the oldest data. Publish the new start before overwriting it, so readers
+        // still copying from there will notice.
+        m_window_start = end - m_window;
+
+        std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+        auto it = m_ranges.begin();
+        while (it != m_ranges.end() && it->first < m_window_start)
+        {
+            size_t range_end = it->second;
+
+            it = m_ranges.erase(it);
+
+            if (range_end > m_window_start)
+            {
+                m_ranges[m_window_start] = range_end;
+                break;
+            }
+        }
+    }
+
+    if (offset < m_window_start)
+    {
+        if (end <= m_window_start)
+        {
+            // E.g. header updated at the end of transcoding, the data has already been streamed
+            Logging::trace(m_cachefile, "Dropping %1 bytes at offset %2 before the stream window.", length, offset);
+            return;
+        }
+
+        size_t skip = m_window_start - offset;
+
+        data    += skip;
+        offset  += skip;
+        length  -= skip;
+    }
+
+    size_t pos      = offset % m_window;
+    size_t first    = std::min(length, m_window - pos);
+
+    memcpy(m_buffer + pos, data, first);
+    if (first < length)
+    {
+        memcpy(m_buffer, data + first, length - first);
+    }
+}
+
+void Buffer::add_range(size_t start, size_t end)
+{
+    // Data before the stream window is gone
+    merge_range(m_ranges, std::max(start, m_window_start.load()), end);
+}
+
+void Buffer::merge_range(std::map<size_t, size_t> & ranges, size_t start, size_t end)
+{
+    if (start >= end)
+    {
+        return;
+    }
+
+    // Find first range that may overlap or touch the new one
+    auto it = ranges.upper_bound(start);
+    if (it != ranges.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->second >= start)
+        {
+            it = prev;
+        }
+    }
+
+    // Merge all overlapping or adjacent ranges
+    while (it != ranges.end() && it->first <= end)
+    {
+        start   = std::min(start, it->first);
+        end     = std::max(end, it->second);
+        it      = ranges.erase(it);
+    }
+
+    ranges[start] = end;
+}
+
+size_t Buffer::range_end(size_t offset) const
+{
+    auto it = m_ranges.upper_bound(offset);
+    if (it == m_ranges.begin())
+    {
+        return offset;
+    }
+
+    --it;
+
+    return (it->second > offset ? it->second : offset);
+}
+
+bool Buffer::have_data(size_t offset, size_t length)
+{
+    std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+    return (range_end(offset) >= offset + length);
+}
+
+size_t Buffer::readable(size_t offset, size_t length)
+{
+    std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+    size_t end = range_end(offset);
+
+    return std::min(length, end - offset);
+}
+
+bool Buffer::wait_for_data(size_t offset, size_t length, unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lck_wait(m_wait_mutex);
+    size_t end = offset + length;
+
+    if (range_end(offset) >= end)
+    {
+        return true;
+    }
+
+    unsigned int generation = m_wakeup_generation;
+    auto it = m_waiters.insert(end);
+
+    m_wait_cond.wait_for(lck_wait, std::chrono::milliseconds(timeout_ms), [&]{ return (range_end(offset) >= end || m_wakeup_generation != generation); });
+
+    m_waiters.erase(it);
+
+    return (range_end(offset) >= end);
+}
+
+void Buffer::wakeup_waiters()
+{
+    std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+    m_wakeup_generation++;
+    m_wait_cond.notify_all();
+}
+
+size_t Buffer::stream_window() const
+{
+    return m_window;
+}
+
+size_t Buffer::window_start() const
+{
+    return m_window_start;
+}
+
+void Buffer::set_reader_pos(const void *reader, size_t pos)
+{
+    if (!m_window || reader == nullptr)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+    m_stream_readers[reader] = pos;
+    m_room_cond.notify_all();
+}
+
+void Buffer::remove_reader(const void *reader)
+{
+    std::lock_guard<std::mutex> lck_wait(m_wait_mutex);
+
+    if (m_stream_readers.erase(reader))
+    {
+        m_room_cond.notify_all();
+    }
+}
+
+bool Buffer::wait_for_room(unsigned int timeout_ms)
+{
+    if (!m_window)
+    {
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lck_wait(m_wait_mutex);
+
+    return m_room_cond.wait_for(lck_wait, std::chrono::milliseconds(timeout_ms), [&]{ return have_room(); });
+}
+
+bool Buffer::have_room() const
+{
+    size_t slowest = SIZE_MAX;
+
+    for (const auto & reader : m_stream_readers)
+    {
+        // Readers that have already fallen out of the window cannot be helped
+        if (reader.second >= m_window_start && reader.second < slowest)
+        {
+            slowest = reader.second;
+        }
+    }
+
+    if (slowest == SIZE_MAX)
+    {
+        // Nobody reading, keep what we have
+        slowest = m_window_start;
+    }
+
+    return (m_buffer_watermark < slowest + m_window / 2);
+}
+
+uint8_t* Buffer::write_prepare(size_t length)
+{
+    if (reallocate(m_buffer_pos + length))
+    {
         return m_buffer + m_buffer_pos;
     }
     else
@@ -531,24 +1158,50 @@ bool Buffer::copy(std::vector<uint8_t> * out_data, size_t offset)
 
 bool Buffer::copy(uint8_t* out_data, size_t offset, size_t bufsize)
 {
-    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+    // No lock required, memory will not go away while we are registered as reader
+    unsigned int slot = reader_enter();
 
-    if (m_buffer == nullptr)
+    // Size must be read before the buffer, see remap()
+    size_t size         = m_buffer_size;
+    uint8_t *buffer     = m_buffer;
+    bool success        = true;
+
+    if (buffer == nullptr)
     {
         errno = EBADF;
-        return false;
+        success = false;
     }
+    else if (m_window)
+    {
+        bufsize = std::min(bufsize, m_window);
 
-    bool success = true;
+        if (offset >= m_window_start)
+        {
+            size_t pos      = offset % m_window;
+            size_t first    = std::min(bufsize, m_window - pos);
+
+            memcpy(out_data, buffer + pos, first);
+            if (first < bufsize)
+            {
+                memcpy(out_data + first, buffer, bufsize - first);
+            }
+        }
 
-    if (size() >= offset)
+        // Check again, the window may have moved on while copying
+        if (offset < m_window_start)
+        {
+            errno = ESPIPE;
+            success = false;
+        }
+    }
+    else if (size >= offset)
     {
-        if (size() < offset + bufsize)
+        if (size < offset + bufsize)
         {
-            bufsize = size() - offset - 1;
+            bufsize = size - offset - 1;
         }
 
-        memcpy(out_data, m_buffer + offset, bufsize);
+        memcpy(out_data, buffer + offset, bufsize);
     }
     else
     {
@@ -556,6 +1209,8 @@ bool Buffer::copy(uint8_t* out_data, size_t offset, size_t bufsize)
         success = false;
     }
 
+    reader_leave(slot);
+
     return success;
 }
 
@@ -565,6 +1220,9 @@ bool Buffer::reallocate(size_t newsize)
     {
         size_t oldsize = size();
 
+        // The predicted size was too small. Grow in larger steps to avoid remapping on every write.
+        newsize = (newsize + CACHE_CHUNK_SIZE - 1) / CACHE_CHUNK_SIZE * CACHE_CHUNK_SIZE;
+
         if (!reserve(newsize))
         {
             return false;
@@ -630,5 +1288,15 @@ void Buffer::close()
 
 bool Buffer::is_open() const
 {
+    if (m_window)
+    {
+        return (m_buffer != nullptr);
+    }
+
     return (m_fd != -1 && (fcntl(m_fd, F_GETFL) != -1 || errno != EBADF));
 }
+
+int Buffer::fd() const
+{
+    return m_fd;
+}
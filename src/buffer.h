@@ -37,6 +37,10 @@
 #include "fileio.h"
 
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <set>
+#include <map>
 #include <vector>
 #include <stddef.h>
 
@@ -46,8 +50,22 @@
 #define CACHE_CLOSE_FREE    0x01                                /**< @brief Free memory for cache entry */
 #define CACHE_CLOSE_DELETE  (0x02 | CACHE_CLOSE_FREE)           /**< @brief Delete cache entry, will unlink cached file! Implies CACHE_CLOSE_FREE. */
 
+#define CACHE_CHUNK_SIZE    (8 * 1024 * 1024)                   /**< @brief Grow cache files by this size if the predicted size was too small */
+#define CACHE_FLUSH_SIZE    (4 * 1024 * 1024)                   /**< @brief Start writing back dirty data to disk each time this much has been written */
+
 /**
  * @brief The #Buffer class
+ *
+ * There is one writer (the transcoder, which may be joined by a secondary transcoder),
+ * writers are serialised by #m_mutex. Readers do not take this lock: The watermark is
+ * published after the data has been written, and memory is never unmapped or moved
+ * while readers are copying from it. If the buffer must be moved or shrunk, the new
+ * mapping is published first and the old one is released after all readers that may
+ * still use it have left (see #wait_for_readers()).
+ *
+ * In streaming mode (--disable_cache with --stream_window) there is no cache file. Only
+ * the last window bytes are kept in memory, offsets wrap around. Data before #window_start()
+ * has been dropped and cannot be read any longer.
  */
 class Buffer : public FileIO
 {
@@ -117,6 +135,15 @@ public:
      * @return Returns the value of the internal read position pointer.
      */
     virtual size_t          tell() const;
+    /**
+     * @brief Get the file descriptor of the cache file.
+     *
+     * Data written through the memory map can be read with the descriptor,
+     * e.g. to let FUSE splice it without copying it in user space.
+     *
+     * @return Returns the file descriptor, -1 if the cache file is not open.
+     */
+    int                     fd() const;
     /** @brief Seek to position in file
      *
      * Repositions the offset of the open file to the argument offset according to the directive whence.
@@ -149,14 +176,27 @@ public:
     size_t                  write(const uint8_t* data, size_t length);
     /**
      * @brief Flush buffer to disk
+     *
+     * Only ranges written since the last flush are written back. Write back is started
+     * but not waited for, unless a durable copy is requested.
+     * @param[in] durable - If true, wait until all data has been written to disk, e.g. before
+     * the cache entry is marked as finished.
      * @return Returns true on success; false on error. Check errno for details.
      */
-    bool                    flush();
+    bool                    flush(bool durable = false);
     /**
      * @brief Clear (delete) buffer.
      * @return Returns true on success; false on error. Check errno for details.
      */
     bool                    clear();
+    /**
+     * @brief Keep the beginning of an existing cache file to resume an interrupted transcode.
+     *
+     * Only the first offset bytes are considered valid, anything after that will be written again.
+     * @param[in] offset - Size of valid data.
+     * @return Returns true on success; false if the cache file is shorter than offset.
+     */
+    bool                    resume(size_t offset);
     /**
      * @brief Reserve memory without changing size to reduce re-allocations.
      * @param[in] size - Size of buffer to reserve.
@@ -186,6 +226,85 @@ public:
      * @return Returns true on success; false on error.
      */
     bool                    copy(uint8_t* out_data, size_t offset, size_t bufsize);
+    /**
+     * @brief Write data to a certain position into the buffer. The position pointer and watermark will not be changed.
+     *
+     * Used to fill in a range of the buffer out of order, e.g. by a secondary transcoder that was
+     * started at a seek position.
+     * @param[in] data - Buffer with data to write.
+     * @param[in] length - Length of buffer to write.
+     * @param[in] offset - Byte offset to write data to.
+     * @return Returns the bytes written to the buffer. If less than length this indicates an error, consult errno for details.
+     */
+    size_t                  write(const uint8_t* data, size_t length, size_t offset);
+    /**
+     * @brief Check if a range of the buffer has been filled completely.
+     * @param[in] offset - Start of range.
+     * @param[in] length - Length of range.
+     * @return Returns true if all data is available; false if not.
+     */
+    bool                    have_data(size_t offset, size_t length);
+    /**
+     * @brief Get number of bytes that can be read at an offset.
+     * @param[in] offset - Start of range.
+     * @param[in] length - Maximum number of bytes requested.
+     * @return Returns the number of contiguous bytes available at offset, at most length.
+     */
+    size_t                  readable(size_t offset, size_t length);
+    /**
+     * @brief Wait until a range of the buffer has been filled.
+     *
+     * The caller is registered as a waiter for the end of the range. #write() will
+     * only wake waiters whose range has been reached, so readers do not need to poll.
+     * The wait also ends early if #wakeup_waiters() is called (e.g. on error, timeout
+     * or when transcoding is finished), or after timeout_ms milliseconds so the caller
+     * can check for interrupts.
+     * @param[in] offset - Start of range.
+     * @param[in] length - Length of range.
+     * @param[in] timeout_ms - Maximum time to wait in milliseconds.
+     * @return Returns true if the range is available; false if woken up otherwise or timed out.
+     */
+    bool                    wait_for_data(size_t offset, size_t length, unsigned int timeout_ms);
+    /**
+     * @brief Wake up all waiters, regardless of the offset they are waiting for.
+     *
+     * Must be called whenever the state of the transcoder changes in a way
+     * waiters need to know about, e.g. on error, timeout or finish.
+     */
+    void                    wakeup_waiters();
+    /**
+     * @brief Get size of the stream window.
+     * @return Returns the number of bytes kept in memory in streaming mode, 0 if the buffer is backed by a cache file.
+     */
+    size_t                  stream_window() const;
+    /**
+     * @brief Get the lowest offset that can still be read.
+     * @return Returns the offset of the oldest data kept in streaming mode, 0 if the buffer is backed by a cache file.
+     */
+    size_t                  window_start() const;
+    /**
+     * @brief Report the position of a reader in streaming mode.
+     *
+     * The writer is held back so it will not drop data the slowest reader still needs.
+     * @param[in] reader - Opaque reader identification, e.g. the open file handle.
+     * @param[in] pos - Next offset the reader will read from.
+     */
+    void                    set_reader_pos(const void *reader, size_t pos);
+    /**
+     * @brief Remove a reader, it will no longer hold back the writer.
+     * @param[in] reader - Opaque reader identification passed to #set_reader_pos().
+     */
+    void                    remove_reader(const void *reader);
+    /**
+     * @brief Wait until the writer may continue in streaming mode.
+     *
+     * The writer may stay half the window ahead of the slowest reader, so the data
+     * written by one more step of the transcoder does not overwrite anything still needed.
+     * If nobody reads, the writer stops when half of the window has been filled.
+     * @param[in] timeout_ms - Maximum time to wait in milliseconds.
+     * @return Returns true if the writer may continue; false if timed out.
+     */
+    bool                    wait_for_room(unsigned int timeout_ms);
     /**
      * @brief Get cache filename.
      * @return Returns cache filename.
@@ -268,19 +387,134 @@ private:
      * @param[in] filename - Name of cache file to unmap.
      * @param[in] fd - The file descriptor of the open cache file.
      * @param[in] p - Memory pointer to cache file.
+     * @param[in] mapsize - Size of the mapping, may be larger than the file.
      * @param[in] filesize - Actual size of the cache file.
      * @return Returns true on success; false on error.
      */
-    bool                    unmap_file(const std::string & filename, int *fd, uint8_t **p, size_t *filesize, size_t *buffer_pos) const;
+    bool                    unmap_file(const std::string & filename, int *fd, uint8_t **p, size_t mapsize, size_t *filesize, size_t *buffer_pos) const;
+    /**
+     * @brief Resize the cache file and the memory mapping.
+     *
+     * Grows the mapping in place if possible. Otherwise the file is mapped again
+     * and the old mapping is released once no reader can use it any longer.
+     * m_mutex must be held by the caller.
+     * @param[in] newsize - New buffer size.
+     * @return Returns true on success; false on error.
+     */
+    bool                    remap(size_t newsize);
+    /**
+     * @brief Allocate disk space for the cache file and set its size.
+     *
+     * Uses fallocate() if supported by the file system, so that a full disk is reported
+     * right away (ENOSPC) and not when the mapped memory is written to. Falls back to
+     * ftruncate() otherwise.
+     * @param[in] oldsize - Current size of the file.
+     * @param[in] newsize - New size of the file, must be larger than oldsize.
+     * @return Returns true on success; false on error. Check errno for details.
+     */
+    bool                    allocate(size_t oldsize, size_t newsize);
+    /**
+     * @brief Initialise the in-memory stream window instead of a cache file.
+     * m_mutex must be held by the caller.
+     * @return Returns true on success; false on error.
+     */
+    bool                    init_stream();
+    /**
+     * @brief Copy data into the stream window.
+     *
+     * Moves the window if necessary, dropping the oldest data. Parts of the data
+     * before the window are discarded. m_mutex must be held by the caller.
+     * @param[in] data - Buffer with data to write.
+     * @param[in] length - Length of buffer to write.
+     * @param[in] offset - Byte offset to write data to.
+     */
+    void                    write_stream(const uint8_t* data, size_t length, size_t offset);
+    /**
+     * @brief Check if the writer may continue in streaming mode.
+     * m_wait_mutex must be held by the caller.
+     * @return Returns true if the writer is less than half the window ahead of the slowest reader.
+     */
+    bool                    have_room() const;
+    /**
+     * @brief Register a reader before accessing the buffer memory without lock.
+     * @return Returns the reader slot that must be passed to #reader_leave().
+     */
+    unsigned int            reader_enter();
+    /**
+     * @brief Unregister a reader.
+     * @param[in] slot - Reader slot returned by #reader_enter().
+     */
+    void                    reader_leave(unsigned int slot);
+    /**
+     * @brief Start a new epoch and wait until all readers of the previous epoch have left.
+     *
+     * Afterwards no reader can use memory or a size published before this call.
+     * m_mutex must be held by the caller.
+     */
+    void                    wait_for_readers();
+    /**
+     * @brief Mark a range as filled, merge with adjacent or overlapping ranges.
+     * m_wait_mutex must be held by the caller.
+     * @param[in] start - Start of range.
+     * @param[in] end - End of range (first byte behind range).
+     */
+    void                    add_range(size_t start, size_t end);
+    /**
+     * @brief Add a range to a range list, merge with adjacent or overlapping ranges.
+     * @param[inout] ranges - Range list, start offset to end offset.
+     * @param[in] start - Start of range.
+     * @param[in] end - End of range (first byte behind range).
+     */
+    static void             merge_range(std::map<size_t, size_t> & ranges, size_t start, size_t end);
+    /**
+     * @brief Remember a range as written but not yet flushed to disk.
+     *
+     * Starts write back once #CACHE_FLUSH_SIZE bytes have been collected.
+     * m_mutex must be held by the caller.
+     * @param[in] start - Start of range.
+     * @param[in] end - End of range (first byte behind range).
+     */
+    void                    add_dirty(size_t start, size_t end);
+    /**
+     * @brief Start writing back all dirty ranges to disk without waiting for completion.
+     * m_mutex must be held by the caller.
+     * @return Returns true on success; false on error. Check errno for details.
+     */
+    bool                    writeback();
+    /**
+     * @brief Get end of the filled range containing an offset.
+     * m_wait_mutex must be held by the caller.
+     * @param[in] offset - Offset to check.
+     * @return Returns the end of the range, or offset if offset has not been filled yet.
+     */
+    size_t                  range_end(size_t offset) const;
 
 private:
-    std::recursive_mutex    m_mutex;                        /**< @brief Access mutex */
+    std::recursive_mutex    m_mutex;                        /**< @brief Writer mutex, not required for reading */
     std::string             m_cachefile;                    /**< @brief Cache file name */
     int                     m_fd;                           /**< @brief File handle for buffer */
-    uint8_t *               m_buffer;                       /**< @brief Pointer to buffer memory */
-    size_t                  m_buffer_pos;                   /**< @brief Read/write position */
-    size_t                  m_buffer_watermark;             /**< @brief Number of bytes in buffer */
-    size_t                  m_buffer_size;                  /**< @brief Current buffer size */
+    std::atomic<uint8_t *>  m_buffer;                       /**< @brief Pointer to buffer memory */
+    std::atomic<size_t>     m_buffer_pos;                   /**< @brief Read/write position */
+    std::atomic<size_t>     m_buffer_watermark;             /**< @brief Number of bytes in buffer */
+    std::atomic<size_t>     m_buffer_size;                  /**< @brief Current buffer size */
+    size_t                  m_mapped_size;                  /**< @brief Size of memory mapping, may be larger than m_buffer_size */
+
+    std::map<size_t, size_t> m_dirty;                       /**< @brief Ranges written since the last flush, start offset to end offset. Protected by m_mutex. */
+    size_t                  m_dirty_size;                   /**< @brief Bytes written since the last write back was started */
+
+    std::atomic_uint        m_epoch;                        /**< @brief Incremented each time memory may be released */
+    std::atomic_uint        m_readers[2];                   /**< @brief Readers in flight, by epoch parity */
+
+    std::mutex              m_wait_mutex;                   /**< @brief Mutex for filled ranges, waiter list and condition */
+    std::map<size_t, size_t> m_ranges;                      /**< @brief Ranges of the buffer that have been filled, start offset to end offset */
+    std::condition_variable m_wait_cond;                    /**< @brief Signalled when a waiter's range has been filled */
+    std::multiset<size_t>   m_waiters;                      /**< @brief Range ends requested by waiting readers */
+    unsigned int            m_wakeup_generation;            /**< @brief Incremented by wakeup_waiters() to release all waiters */
+
+    size_t                  m_window;                       /**< @brief Size of the stream window, 0 if not streaming */
+    std::atomic<size_t>     m_window_start;                 /**< @brief Offset of the oldest data in the stream window */
+    std::map<const void *, size_t> m_stream_readers;        /**< @brief Next offset of each reader in streaming mode. Protected by m_wait_mutex. */
+    std::condition_variable m_room_cond;                    /**< @brief Signalled when a reader has moved on in streaming mode */
 };
 
 #endif
@@ -37,6 +37,7 @@
 
 #include <vector>
 #include <assert.h>
+#include <string.h>
 
 #ifndef HAVE_SQLITE_ERRSTR
 #define sqlite3_errstr(rc)  ""              /**< @brief If our version of SQLite hasn't go this function */
@@ -47,6 +48,17 @@ Cache::Cache()
     , m_cacheidx_select_stmt(nullptr)
     , m_cacheidx_insert_stmt(nullptr)
     , m_cacheidx_delete_stmt(nullptr)
+    , m_probe_select_stmt(nullptr)
+    , m_probe_insert_stmt(nullptr)
+    , m_resume_select_stmt(nullptr)
+    , m_resume_insert_stmt(nullptr)
+    , m_resume_delete_stmt(nullptr)
+    , m_seek_index_select_stmt(nullptr)
+    , m_seek_index_insert_stmt(nullptr)
+    , m_seek_index_delete_stmt(nullptr)
+    , m_hls_select_stmt(nullptr)
+    , m_hls_insert_stmt(nullptr)
+    , m_hls_delete_stmt(nullptr)
 {
 }
 
@@ -153,6 +165,109 @@ bool Cache::load_index()    /**< @todo Implement versioning + auto-update of DB
             throw false;
         }
 
+        // Create probe_entry table not already existing
+        sql =
+                "CREATE TABLE IF NOT EXISTS `probe_entry` (\n"
+                //
+                // Primary key: filename
+                //
+                "    `filename`             TEXT NOT NULL,\n"
+                //
+                // Source file, entry is invalid if changed
+                //
+                "    `file_time`            DATETIME NOT NULL,\n"
+                "    `file_size`            UNSIGNED BIG INT NOT NULL,\n"
+                //
+                // Probe results
+                //
+                "    `duration`             BIG INT NOT NULL,\n"
+                "    `audiobitrate`         UNSIGNED BIG INT NOT NULL,\n"
+                "    `audiochannels`        UNSIGNED INT NOT NULL,\n"
+                "    `audiosamplerate`      UNSIGNED INT NOT NULL,\n"
+                "    `videobitrate`         UNSIGNED BIG INT NOT NULL,\n"
+                "    `videowidth`           UNSIGNED INT NOT NULL,\n"
+                "    `videoheight`          UNSIGNED INT NOT NULL,\n"
+                "    `interlaced`           BOOLEAN NOT NULL,\n"
+                "    `framerate_num`        INT NOT NULL,\n"
+                "    `framerate_den`        INT NOT NULL,\n"
+                "    PRIMARY KEY(`filename`)\n"
+                ");\n";
+
+        if (SQLITE_OK != (ret = sqlite3_exec(m_cacheidx_db, sql, nullptr, nullptr, &errmsg)))
+        {
+            Logging::error(m_cacheidx_file, "SQLite3 exec error: (%1) %2\n%3", ret, errmsg, sql);
+            sqlite3_free(errmsg);
+            throw false;
+        }
+
+        // Create resume_entry table not already existing
+        sql =
+                "CREATE TABLE IF NOT EXISTS `resume_entry` (\n"
+                //
+                // Primary key: filename + desttype, same as cache_entry
+                //
+                "    `filename`             TEXT NOT NULL,\n"
+                "    `desttype`             CHAR ( 10 ) NOT NULL,\n"
+                //
+                // Last checkpoint of an interrupted transcode
+                //
+                "    `resume_offset`        UNSIGNED BIG INT NOT NULL,\n"
+                "    `resume_pos`           BIG INT NOT NULL,\n"
+                "    PRIMARY KEY(`filename`,`desttype`)\n"
+                ");\n";
+
+        if (SQLITE_OK != (ret = sqlite3_exec(m_cacheidx_db, sql, nullptr, nullptr, &errmsg)))
+        {
+            Logging::error(m_cacheidx_file, "SQLite3 exec error: (%1) %2\n%3", ret, errmsg, sql);
+            sqlite3_free(errmsg);
+            throw false;
+        }
+
+        // Create seek_index table not already existing
+        sql =
+                "CREATE TABLE IF NOT EXISTS `seek_index` (\n"
+                //
+                // Primary key: filename + desttype, same as cache_entry
+                //
+                "    `filename`             TEXT NOT NULL,\n"
+                "    `desttype`             CHAR ( 10 ) NOT NULL,\n"
+                //
+                // Array of SEEK_INDEX_ENTRY structures
+                //
+                "    `entries`              BLOB NOT NULL,\n"
+                "    PRIMARY KEY(`filename`,`desttype`)\n"
+                ");\n";
+
+        if (SQLITE_OK != (ret = sqlite3_exec(m_cacheidx_db, sql, nullptr, nullptr, &errmsg)))
+        {
+            Logging::error(m_cacheidx_file, "SQLite3 exec error: (%1) %2\n%3", ret, errmsg, sql);
+            sqlite3_free(errmsg);
+            throw false;
+        }
+
+        // Create hls_entry table not already existing
+        sql =
+                "CREATE TABLE IF NOT EXISTS `hls_entry` (\n"
+                //
+                // Primary key: filename + desttype, same as cache_entry
+                //
+                "    `filename`             TEXT NOT NULL,\n"
+                "    `desttype`             CHAR ( 10 ) NOT NULL,\n"
+                //
+                // Part of the source file the segment has been cut from
+                //
+                "    `segment_start`        BIG INT NOT NULL,\n"
+                "    `segment_end`          BIG INT NOT NULL,\n"
+                "    PRIMARY KEY(`filename`,`desttype`)\n"
+                ");\n";
+
+        if (SQLITE_OK != (ret = sqlite3_exec(m_cacheidx_db, sql, nullptr, nullptr, &errmsg)))
+        {
+            Logging::error(m_cacheidx_file, "SQLite3 exec error: (%1) %2\n%3", ret, errmsg, sql);
+            sqlite3_free(errmsg);
+            throw false;
+        }
+
 #ifdef HAVE_SQLITE_CACHEFLUSH
         if (!flush_index())
         {
@@ -187,6 +302,102 @@ bool Cache::load_index()    /**< @todo Implement versioning + auto-update of DB
             Logging::error(m_cacheidx_file, "Failed to prepare delete: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
             throw false;
         }
+
+        sql =   "INSERT OR REPLACE INTO probe_entry\n"
+                "(filename, file_time, file_size, duration, audiobitrate, audiochannels, audiosamplerate, videobitrate, videowidth, videoheight, interlaced, framerate_num, framerate_den) VALUES\n"
+                "(?, datetime(?, 'unixepoch'), ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_probe_insert_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare probe insert: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "SELECT duration, audiobitrate, audiochannels, audiosamplerate, videobitrate, videowidth, videoheight, interlaced, framerate_num, framerate_den FROM probe_entry WHERE filename = ? AND file_time = datetime(?, 'unixepoch') AND file_size = ?;\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_probe_select_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare probe select: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "INSERT OR REPLACE INTO resume_entry\n"
+                "(filename, desttype, resume_offset, resume_pos) VALUES\n"
+                "(?, ?, ?, ?);\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_resume_insert_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare resume insert: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "SELECT resume_offset, resume_pos FROM resume_entry WHERE filename = ? AND desttype = ?;\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_resume_select_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare resume select: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "DELETE FROM resume_entry WHERE filename = ? AND desttype = ?;\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_resume_delete_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare resume delete: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "INSERT OR REPLACE INTO seek_index\n"
+                "(filename, desttype, entries) VALUES\n"
+                "(?, ?, ?);\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_seek_index_insert_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare seek index insert: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "SELECT entries FROM seek_index WHERE filename = ? AND desttype = ?;\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_seek_index_select_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare seek index select: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "INSERT OR REPLACE INTO hls_entry\n"
+                "(filename, desttype, segment_start, segment_end) VALUES\n"
+                "(?, ?, ?, ?);\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_hls_insert_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare HLS insert: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "SELECT segment_start, segment_end FROM hls_entry WHERE filename = ? AND desttype = ?;\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_hls_select_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare HLS select: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "DELETE FROM hls_entry WHERE filename = ? AND desttype = ?;\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_hls_delete_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare HLS delete: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
+
+        sql =   "DELETE FROM seek_index WHERE filename = ? AND desttype = ?;\n";
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(m_cacheidx_db, sql, -1, &m_seek_index_delete_stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_file, "Failed to prepare seek index delete: (%1) %2\n%3", ret, sqlite3_errmsg(m_cacheidx_db), sql);
+            throw false;
+        }
     }
     catch (bool _success)
     {
@@ -214,6 +425,20 @@ bool Cache::flush_index()
 }
 #endif // HAVE_SQLITE_CACHEFLUSH
 
+#define SQLBINDTXT(stmt, idx, var) \
+    if (SQLITE_OK != (ret = sqlite3_bind_text(stmt, idx, var, -1, nullptr))) \
+{ \
+    Logging::error(m_cacheidx_file, "SQLite3 select column #%1 error: %2\n%3", idx, ret, sqlite3_errstr(ret)); \
+    throw false; \
+    }       /**< @brief Bind text column to SQLite statement */
+
+#define SQLBINDNUM(stmt, func, idx, var) \
+    if (SQLITE_OK != (ret = func(stmt, idx, var))) \
+{ \
+    Logging::error(m_cacheidx_file, "SQLite3 select column #%1 error: %2\n%3", idx, ret, sqlite3_errstr(ret)); \
+    throw false; \
+    }       /**< @brief Bind numeric column to SQLite statement */
+
 bool Cache::read_info(LPCACHE_INFO cache_info)
 {
     int ret;
@@ -236,6 +461,10 @@ bool Cache::read_info(LPCACHE_INFO cache_info)
     cache_info->m_access_time        = 0;
     cache_info->m_file_time          = 0;
     cache_info->m_file_size          = 0;
+    cache_info->m_resume_offset      = 0;
+    cache_info->m_resume_pos         = 0;
+    cache_info->m_segment_start      = 0;
+    cache_info->m_segment_end        = 0;
 
     if (m_cacheidx_select_stmt == nullptr)
     {
@@ -295,6 +524,50 @@ bool Cache::read_info(LPCACHE_INFO cache_info)
             Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) select statement: (%1) %2", ret, sqlite3_errstr(ret));
             throw false;
         }
+
+        if (!cache_info->m_finished && m_resume_select_stmt != nullptr)
+        {
+            // Check for a checkpoint to resume an interrupted transcode from
+            assert(sqlite3_bind_parameter_count(m_resume_select_stmt) == 2);
+
+            SQLBINDTXT(m_resume_select_stmt, 1, cache_info->m_origfile.c_str());
+            SQLBINDTXT(m_resume_select_stmt, 2, cache_info->m_desttype);
+
+            ret = sqlite3_step(m_resume_select_stmt);
+
+            if (ret == SQLITE_ROW)
+            {
+                cache_info->m_resume_offset  = static_cast<size_t>(sqlite3_column_int64(m_resume_select_stmt, 0));
+                cache_info->m_resume_pos     = sqlite3_column_int64(m_resume_select_stmt, 1);
+            }
+            else if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) resume select statement: (%1) %2", ret, sqlite3_errstr(ret));
+                throw false;
+            }
+        }
+
+        if (m_hls_select_stmt != nullptr)
+        {
+            // Part of the source an HLS segment has been cut from
+            assert(sqlite3_bind_parameter_count(m_hls_select_stmt) == 2);
+
+            SQLBINDTXT(m_hls_select_stmt, 1, cache_info->m_origfile.c_str());
+            SQLBINDTXT(m_hls_select_stmt, 2, cache_info->m_desttype);
+
+            ret = sqlite3_step(m_hls_select_stmt);
+
+            if (ret == SQLITE_ROW)
+            {
+                cache_info->m_segment_start  = sqlite3_column_int64(m_hls_select_stmt, 0);
+                cache_info->m_segment_end    = sqlite3_column_int64(m_hls_select_stmt, 1);
+            }
+            else if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) HLS select statement: (%1) %2", ret, sqlite3_errstr(ret));
+                throw false;
+            }
+        }
     }
     catch (bool _success)
     {
@@ -302,6 +575,14 @@ bool Cache::read_info(LPCACHE_INFO cache_info)
     }
 
     sqlite3_reset(m_cacheidx_select_stmt);
+    if (m_resume_select_stmt != nullptr)
+    {
+        sqlite3_reset(m_resume_select_stmt);
+    }
+    if (m_hls_select_stmt != nullptr)
+    {
+        sqlite3_reset(m_hls_select_stmt);
+    }
 
     if (success)
     {
@@ -311,20 +592,6 @@ bool Cache::read_info(LPCACHE_INFO cache_info)
     return success;
 }
 
-#define SQLBINDTXT(idx, var) \
-    if (SQLITE_OK != (ret = sqlite3_bind_text(m_cacheidx_insert_stmt, idx, var, -1, nullptr))) \
-{ \
-    Logging::error(m_cacheidx_file, "SQLite3 select column #%1 error: %2\n%3", idx, ret, sqlite3_errstr(ret)); \
-    throw false; \
-    }       /**< @brief Bind text column to SQLite statement */
-
-#define SQLBINDNUM(func, idx, var) \
-    if (SQLITE_OK != (ret = func(m_cacheidx_insert_stmt, idx, var))) \
-{ \
-    Logging::error(m_cacheidx_file, "SQLite3 select column #%1 error: %2\n%3", idx, ret, sqlite3_errstr(ret)); \
-    throw false; \
-    }       /**< @brief Bind numeric column to SQLite statement */
-
 bool Cache::write_info(LPCCACHE_INFO cache_info)
 {
     int ret;
@@ -344,26 +611,26 @@ bool Cache::write_info(LPCCACHE_INFO cache_info)
 
         assert(sqlite3_bind_parameter_count(m_cacheidx_insert_stmt) == 19);
 
-        SQLBINDTXT(1, cache_info->m_origfile.c_str());
-        SQLBINDTXT(2, cache_info->m_desttype);
-        //SQLBINDNUM(sqlite3_bind_int,  3,  cache_info->m_enable_ismv);
-        SQLBINDNUM(sqlite3_bind_int,    3,  enable_ismv_dummy);
-        SQLBINDNUM(sqlite3_bind_int64,  4,  cache_info->m_audiobitrate);
-        SQLBINDNUM(sqlite3_bind_int,    5,  cache_info->m_audiosamplerate);
-        SQLBINDNUM(sqlite3_bind_int64,  6,  cache_info->m_videobitrate);
-        SQLBINDNUM(sqlite3_bind_int,    7,  static_cast<int>(cache_info->m_videowidth));
-        SQLBINDNUM(sqlite3_bind_int,    8,  static_cast<int>(cache_info->m_videoheight));
-        SQLBINDNUM(sqlite3_bind_int,    9,  cache_info->m_deinterlace);
-        SQLBINDNUM(sqlite3_bind_int64,  10, static_cast<sqlite3_int64>(cache_info->m_predicted_filesize));
-        SQLBINDNUM(sqlite3_bind_int64,  11, static_cast<sqlite3_int64>(cache_info->m_encoded_filesize));
-        SQLBINDNUM(sqlite3_bind_int,    12, cache_info->m_finished);
-        SQLBINDNUM(sqlite3_bind_int,    13, cache_info->m_error);
-        SQLBINDNUM(sqlite3_bind_int,    14, cache_info->m_errno);
-        SQLBINDNUM(sqlite3_bind_int,    15, cache_info->m_averror);
-        SQLBINDNUM(sqlite3_bind_int64,  16, cache_info->m_creation_time);
-        SQLBINDNUM(sqlite3_bind_int64,  17, cache_info->m_access_time);
-        SQLBINDNUM(sqlite3_bind_int64,  18, cache_info->m_file_time);
-        SQLBINDNUM(sqlite3_bind_int64,  19, static_cast<sqlite3_int64>(cache_info->m_file_size));
+        SQLBINDTXT(m_cacheidx_insert_stmt, 1, cache_info->m_origfile.c_str());
+        SQLBINDTXT(m_cacheidx_insert_stmt, 2, cache_info->m_desttype);
+        //SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,  3,  cache_info->m_enable_ismv);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    3,  enable_ismv_dummy);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  4,  cache_info->m_audiobitrate);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    5,  cache_info->m_audiosamplerate);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  6,  cache_info->m_videobitrate);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    7,  static_cast<int>(cache_info->m_videowidth));
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    8,  static_cast<int>(cache_info->m_videoheight));
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    9,  cache_info->m_deinterlace);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  10, static_cast<sqlite3_int64>(cache_info->m_predicted_filesize));
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  11, static_cast<sqlite3_int64>(cache_info->m_encoded_filesize));
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    12, cache_info->m_finished);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    13, cache_info->m_error);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    14, cache_info->m_errno);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int,    15, cache_info->m_averror);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  16, cache_info->m_creation_time);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  17, cache_info->m_access_time);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  18, cache_info->m_file_time);
+        SQLBINDNUM(m_cacheidx_insert_stmt, sqlite3_bind_int64,  19, static_cast<sqlite3_int64>(cache_info->m_file_size));
 
         ret = sqlite3_step(m_cacheidx_insert_stmt);
 
@@ -372,6 +639,53 @@ bool Cache::write_info(LPCCACHE_INFO cache_info)
             Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) insert statement: (%1) %2", ret, sqlite3_errstr(ret));
             throw false;
         }
+
+        // Keep the checkpoint only as long as the file is incomplete
+        sqlite3_stmt * resume_stmt = (cache_info->m_resume_offset && !cache_info->m_finished) ? m_resume_insert_stmt : m_resume_delete_stmt;
+
+        if (resume_stmt != nullptr)
+        {
+            SQLBINDTXT(resume_stmt, 1, cache_info->m_origfile.c_str());
+            SQLBINDTXT(resume_stmt, 2, cache_info->m_desttype);
+
+            if (resume_stmt == m_resume_insert_stmt)
+            {
+                assert(sqlite3_bind_parameter_count(m_resume_insert_stmt) == 4);
+
+                SQLBINDNUM(m_resume_insert_stmt, sqlite3_bind_int64,  3,  static_cast<sqlite3_int64>(cache_info->m_resume_offset));
+                SQLBINDNUM(m_resume_insert_stmt, sqlite3_bind_int64,  4,  cache_info->m_resume_pos);
+            }
+
+            ret = sqlite3_step(resume_stmt);
+
+            sqlite3_reset(resume_stmt);
+
+            if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) resume statement: (%1) %2", ret, sqlite3_errstr(ret));
+                throw false;
+            }
+        }
+
+        if (cache_info->m_segment_end && m_hls_insert_stmt != nullptr)
+        {
+            assert(sqlite3_bind_parameter_count(m_hls_insert_stmt) == 4);
+
+            SQLBINDTXT(m_hls_insert_stmt, 1, cache_info->m_origfile.c_str());
+            SQLBINDTXT(m_hls_insert_stmt, 2, cache_info->m_desttype);
+            SQLBINDNUM(m_hls_insert_stmt, sqlite3_bind_int64,  3,  cache_info->m_segment_start);
+            SQLBINDNUM(m_hls_insert_stmt, sqlite3_bind_int64,  4,  cache_info->m_segment_end);
+
+            ret = sqlite3_step(m_hls_insert_stmt);
+
+            sqlite3_reset(m_hls_insert_stmt);
+
+            if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) HLS insert statement: (%1) %2", ret, sqlite3_errstr(ret));
+                throw false;
+            }
+        }
     }
     catch (bool _success)
     {
@@ -424,6 +738,48 @@ bool Cache::delete_info(const std::string & filename, const std::string & destty
             Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) delete statement: (%1) %2", ret, sqlite3_errstr(ret));
             throw false;
         }
+
+        if (m_resume_delete_stmt != nullptr)
+        {
+            SQLBINDTXT(m_resume_delete_stmt, 1, filename.c_str());
+            SQLBINDTXT(m_resume_delete_stmt, 2, desttype.c_str());
+
+            ret = sqlite3_step(m_resume_delete_stmt);
+
+            if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) resume delete statement: (%1) %2", ret, sqlite3_errstr(ret));
+                throw false;
+            }
+        }
+
+        if (m_seek_index_delete_stmt != nullptr)
+        {
+            SQLBINDTXT(m_seek_index_delete_stmt, 1, filename.c_str());
+            SQLBINDTXT(m_seek_index_delete_stmt, 2, desttype.c_str());
+
+            ret = sqlite3_step(m_seek_index_delete_stmt);
+
+            if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) seek index delete statement: (%1) %2", ret, sqlite3_errstr(ret));
+                throw false;
+            }
+        }
+
+        if (m_hls_delete_stmt != nullptr)
+        {
+            SQLBINDTXT(m_hls_delete_stmt, 1, filename.c_str());
+            SQLBINDTXT(m_hls_delete_stmt, 2, desttype.c_str());
+
+            ret = sqlite3_step(m_hls_delete_stmt);
+
+            if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) HLS delete statement: (%1) %2", ret, sqlite3_errstr(ret));
+                throw false;
+            }
+        }
     }
     catch (bool _success)
     {
@@ -431,6 +787,244 @@ bool Cache::delete_info(const std::string & filename, const std::string & destty
     }
 
     sqlite3_reset(m_cacheidx_delete_stmt);
+    if (m_resume_delete_stmt != nullptr)
+    {
+        sqlite3_reset(m_resume_delete_stmt);
+    }
+    if (m_seek_index_delete_stmt != nullptr)
+    {
+        sqlite3_reset(m_seek_index_delete_stmt);
+    }
+    if (m_hls_delete_stmt != nullptr)
+    {
+        sqlite3_reset(m_hls_delete_stmt);
+    }
+
+    if (success)
+    {
+        errno = 0; // sqlite3 sometimes sets errno without any reason, better reset any error
+    }
+
+    return success;
+}
+
+bool Cache::read_probe(LPPROBE_INFO probe_info)
+{
+    int ret;
+    bool found = false;
+
+    probe_info->m_duration          = 0;
+    probe_info->m_audiobitrate      = 0;
+    probe_info->m_audiochannels     = 0;
+    probe_info->m_audiosamplerate   = 0;
+    probe_info->m_videobitrate      = 0;
+    probe_info->m_videowidth        = 0;
+    probe_info->m_videoheight       = 0;
+    probe_info->m_interlaced        = false;
+    probe_info->m_framerate_num     = 0;
+    probe_info->m_framerate_den     = 1;
+
+    if (m_probe_select_stmt == nullptr)
+    {
+        Logging::error(m_cacheidx_file, "SQLite3 probe select statement not open.");
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    try
+    {
+        assert(sqlite3_bind_parameter_count(m_probe_select_stmt) == 3);
+
+        SQLBINDTXT(m_probe_select_stmt, 1, probe_info->m_origfile.c_str());
+        SQLBINDNUM(m_probe_select_stmt, sqlite3_bind_int64,  2,  probe_info->m_file_time);
+        SQLBINDNUM(m_probe_select_stmt, sqlite3_bind_int64,  3,  static_cast<sqlite3_int64>(probe_info->m_file_size));
+
+        ret = sqlite3_step(m_probe_select_stmt);
+
+        if (ret == SQLITE_ROW)
+        {
+            probe_info->m_duration          = sqlite3_column_int64(m_probe_select_stmt, 0);
+            probe_info->m_audiobitrate      = sqlite3_column_int64(m_probe_select_stmt, 1);
+            probe_info->m_audiochannels     = sqlite3_column_int(m_probe_select_stmt, 2);
+            probe_info->m_audiosamplerate   = sqlite3_column_int(m_probe_select_stmt, 3);
+            probe_info->m_videobitrate      = sqlite3_column_int64(m_probe_select_stmt, 4);
+            probe_info->m_videowidth        = sqlite3_column_int(m_probe_select_stmt, 5);
+            probe_info->m_videoheight       = sqlite3_column_int(m_probe_select_stmt, 6);
+            probe_info->m_interlaced        = sqlite3_column_int(m_probe_select_stmt, 7);
+            probe_info->m_framerate_num     = sqlite3_column_int(m_probe_select_stmt, 8);
+            probe_info->m_framerate_den     = sqlite3_column_int(m_probe_select_stmt, 9);
+
+            found = true;
+        }
+        else if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) probe select statement: (%1) %2", ret, sqlite3_errstr(ret));
+            throw false;
+        }
+    }
+    catch (bool)
+    {
+        found = false;
+    }
+
+    sqlite3_reset(m_probe_select_stmt);
+
+    errno = 0; // sqlite3 sometimes sets errno without any reason, better reset any error
+
+    return found;
+}
+
+bool Cache::write_probe(LPCPROBE_INFO probe_info)
+{
+    int ret;
+    bool success = true;
+
+    if (m_probe_insert_stmt == nullptr)
+    {
+        Logging::error(m_cacheidx_file, "SQLite3 probe insert statement not open.");
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    try
+    {
+        assert(sqlite3_bind_parameter_count(m_probe_insert_stmt) == 13);
+
+        SQLBINDTXT(m_probe_insert_stmt, 1, probe_info->m_origfile.c_str());
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int64,  2,  probe_info->m_file_time);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int64,  3,  static_cast<sqlite3_int64>(probe_info->m_file_size));
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int64,  4,  probe_info->m_duration);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int64,  5,  probe_info->m_audiobitrate);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int,    6,  probe_info->m_audiochannels);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int,    7,  probe_info->m_audiosamplerate);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int64,  8,  probe_info->m_videobitrate);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int,    9,  probe_info->m_videowidth);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int,    10, probe_info->m_videoheight);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int,    11, probe_info->m_interlaced);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int,    12, probe_info->m_framerate_num);
+        SQLBINDNUM(m_probe_insert_stmt, sqlite3_bind_int,    13, probe_info->m_framerate_den);
+
+        ret = sqlite3_step(m_probe_insert_stmt);
+
+        if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) probe insert statement: (%1) %2", ret, sqlite3_errstr(ret));
+            throw false;
+        }
+    }
+    catch (bool _success)
+    {
+        success = _success;
+    }
+
+    sqlite3_reset(m_probe_insert_stmt);
+
+    if (success)
+    {
+        errno = 0; // sqlite3 sometimes sets errno without any reason, better reset any error
+    }
+
+    return success;
+}
+
+bool Cache::read_seek_index(const std::string & filename, const std::string & desttype, SEEK_INDEX * seek_index)
+{
+    int ret;
+    bool found = false;
+
+    seek_index->clear();
+
+    if (m_seek_index_select_stmt == nullptr)
+    {
+        Logging::error(m_cacheidx_file, "SQLite3 seek index select statement not open.");
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    try
+    {
+        assert(sqlite3_bind_parameter_count(m_seek_index_select_stmt) == 2);
+
+        SQLBINDTXT(m_seek_index_select_stmt, 1, filename.c_str());
+        SQLBINDTXT(m_seek_index_select_stmt, 2, desttype.c_str());
+
+        ret = sqlite3_step(m_seek_index_select_stmt);
+
+        if (ret == SQLITE_ROW)
+        {
+            const void *entries = sqlite3_column_blob(m_seek_index_select_stmt, 0);
+            size_t size         = static_cast<size_t>(sqlite3_column_bytes(m_seek_index_select_stmt, 0));
+
+            if (entries != nullptr && size)
+            {
+                seek_index->resize(size / sizeof(SEEK_INDEX_ENTRY));
+                memcpy(seek_index->data(), entries, seek_index->size() * sizeof(SEEK_INDEX_ENTRY));
+            }
+
+            found = true;
+        }
+        else if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) seek index select statement: (%1) %2", ret, sqlite3_errstr(ret));
+            throw false;
+        }
+    }
+    catch (bool)
+    {
+        found = false;
+    }
+
+    sqlite3_reset(m_seek_index_select_stmt);
+
+    errno = 0; // sqlite3 sometimes sets errno without any reason, better reset any error
+
+    return found;
+}
+
+bool Cache::write_seek_index(const std::string & filename, const std::string & desttype, const SEEK_INDEX & seek_index)
+{
+    int ret;
+    bool success = true;
+
+    if (m_seek_index_insert_stmt == nullptr)
+    {
+        Logging::error(m_cacheidx_file, "SQLite3 seek index insert statement not open.");
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    try
+    {
+        assert(sqlite3_bind_parameter_count(m_seek_index_insert_stmt) == 3);
+
+        SQLBINDTXT(m_seek_index_insert_stmt, 1, filename.c_str());
+        SQLBINDTXT(m_seek_index_insert_stmt, 2, desttype.c_str());
+
+        // Stored as is, the cache is never shared between machines
+        if (SQLITE_OK != (ret = sqlite3_bind_blob(m_seek_index_insert_stmt, 3, seek_index.data(), static_cast<int>(seek_index.size() * sizeof(SEEK_INDEX_ENTRY)), SQLITE_STATIC)))
+        {
+            Logging::error(m_cacheidx_file, "SQLite3 select column #%1 error: %2\n%3", 3, ret, sqlite3_errstr(ret));
+            throw false;
+        }
+
+        ret = sqlite3_step(m_seek_index_insert_stmt);
+
+        if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_file, "Sqlite 3 could not step (execute) seek index insert statement: (%1) %2", ret, sqlite3_errstr(ret));
+            throw false;
+        }
+    }
+    catch (bool _success)
+    {
+        success = _success;
+    }
+
+    sqlite3_reset(m_seek_index_insert_stmt);
 
     if (success)
     {
@@ -451,6 +1045,17 @@ void Cache::close_index()
         sqlite3_finalize(m_cacheidx_select_stmt);
         sqlite3_finalize(m_cacheidx_insert_stmt);
         sqlite3_finalize(m_cacheidx_delete_stmt);
+        sqlite3_finalize(m_probe_select_stmt);
+        sqlite3_finalize(m_probe_insert_stmt);
+        sqlite3_finalize(m_resume_select_stmt);
+        sqlite3_finalize(m_resume_insert_stmt);
+        sqlite3_finalize(m_resume_delete_stmt);
+        sqlite3_finalize(m_seek_index_select_stmt);
+        sqlite3_finalize(m_seek_index_insert_stmt);
+        sqlite3_finalize(m_seek_index_delete_stmt);
+        sqlite3_finalize(m_hls_select_stmt);
+        sqlite3_finalize(m_hls_insert_stmt);
+        sqlite3_finalize(m_hls_delete_stmt);
 
         sqlite3_close(m_cacheidx_db);
     }
@@ -467,7 +1072,7 @@ Cache_Entry* Cache::create_entry(LPVIRTUALFILE virtualfile, const std::string &
         return nullptr;
     }
 
-    m_cache.insert(make_pair(make_pair(virtualfile->m_origfile, desttype), cache_entry));
+    m_cache.insert(make_pair(make_pair(virtualfile->m_origfile.str(), desttype), cache_entry));
 
     return cache_entry;
 }
@@ -498,12 +1103,14 @@ bool Cache::delete_entry(Cache_Entry ** cache_entry, int flags)
 
 Cache_Entry *Cache::open(LPVIRTUALFILE virtualfile)
 {
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
     Cache_Entry* cache_entry = nullptr;
-    cache_t::iterator p = m_cache.find(make_pair(virtualfile->m_origfile, params.current_format(virtualfile)->desttype()));
+    cache_t::iterator p = m_cache.find(make_pair(virtualfile->m_origfile.str(), params.current_format(virtualfile)->desttype()));
     if (p == m_cache.end())
     {
         // Logging::trace(sanitised_name, "Created new transcoder.");
-        Logging::trace(virtualfile->m_origfile, "Created new transcoder.");
+        Logging::trace(virtualfile->m_origfile.str(), "Created new transcoder.");
         cache_entry = create_entry(virtualfile, params.current_format(virtualfile)->desttype());
     }
     else
@@ -515,6 +1122,21 @@ Cache_Entry *Cache::open(LPVIRTUALFILE virtualfile)
     return cache_entry;
 }
 
+bool Cache::references(LPCVIRTUALFILE virtualfile)
+{
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    FFmpegfs_Format *current_format = params.current_format(virtualfile);
+    if (current_format == nullptr)
+    {
+        return false;
+    }
+
+    cache_t::iterator p = m_cache.find(make_pair(virtualfile->m_origfile.str(), current_format->desttype()));
+
+    return (p != m_cache.end() && p->second->virtualfile() == virtualfile);
+}
+
 bool Cache::close(Cache_Entry **cache_entry, int flags /*= CACHE_CLOSE_NOOPT*/)
 {
     if ((*cache_entry) == nullptr)
@@ -786,6 +1408,57 @@ bool Cache::maintenance(size_t predicted_filesize)
     return success;
 }
 
+bool Cache::room_for(size_t predicted_filesize)
+{
+    std::lock_guard<std::recursive_mutex> lck (m_mutex);
+
+    if (params.m_max_cache_size)
+    {
+        sqlite3_stmt * stmt;
+        const char * sql;
+        size_t total_size = 0;
+
+        sql = "SELECT SUM(encoded_filesize) FROM cache_entry;\n";
+
+        sqlite3_prepare(m_cacheidx_db, sql, -1, &stmt, nullptr);
+
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            total_size = static_cast<size_t>(sqlite3_column_int64(stmt, 0));
+        }
+
+        sqlite3_finalize(stmt);
+
+        if (total_size + predicted_filesize > params.m_max_cache_size)
+        {
+            Logging::trace(m_cacheidx_file, "No room for %1 in cache: %2 of %3 used.", format_size(predicted_filesize).c_str(), format_size(total_size).c_str(), format_size(params.m_max_cache_size).c_str());
+            errno = ENOSPC;
+            return false;
+        }
+    }
+
+    std::string cachepath;
+
+    transcoder_cache_path(cachepath);
+
+    size_t free_bytes = get_disk_free(cachepath);
+
+    if (!free_bytes && errno)
+    {
+        Logging::error(cachepath, "room_for() cannot determine free disk space: (%1) %2", errno, strerror(errno));
+        return false;
+    }
+
+    if (free_bytes < params.m_min_diskspace + predicted_filesize)
+    {
+        Logging::trace(cachepath, "No room for %1 on cache drive: %2 free, %3 must be kept free.", format_size(predicted_filesize).c_str(), format_size(free_bytes).c_str(), format_size(params.m_min_diskspace).c_str());
+        errno = ENOSPC;
+        return false;
+    }
+
+    return true;
+}
+
 bool Cache::clear()
 {
     bool success = true;
@@ -838,6 +1511,12 @@ bool Cache::clear()
 
     sqlite3_finalize(stmt);
 
+    // Source files will be probed again
+    if (SQLITE_OK != (ret = sqlite3_exec(m_cacheidx_db, "DELETE FROM probe_entry;", nullptr, nullptr, nullptr)))
+    {
+        Logging::error(m_cacheidx_file, "Failed to clear probe info: (%1) %2", ret, sqlite3_errmsg(m_cacheidx_db));
+    }
+
     return success;
 }
 
@@ -35,8 +35,10 @@
 #pragma once
 
 #include "buffer.h"
+#include "seek_index.h"
 
 #include <map>
+#include <vector>
 #include <sqlite3.h>
 /**
   * @brief Cache information block
@@ -63,10 +65,39 @@ typedef struct CACHE_INFO
     time_t          m_file_time;                /**< @brief Source file file time */
     size_t          m_file_size;                /**< @brief Source file file size */
     unsigned int    m_access_count;             /**< @brief Read access counter */
+    size_t          m_resume_offset;            /**< @brief Offset an interrupted transcode can be resumed at, 0 if not resumable */
+    int64_t         m_resume_pos;               /**< @brief Position in the source file matching m_resume_offset, in AV_TIME_BASE fractional seconds */
+    int64_t         m_segment_start;            /**< @brief HLS only: Segment start in the source file, in AV_TIME_BASE fractional seconds */
+    int64_t         m_segment_end;              /**< @brief HLS only: Segment end in the source file, AV_NOPTS_VALUE for the last segment, 0 if not an HLS segment */
 } CACHE_INFO;
 typedef CACHE_INFO const *LPCCACHE_INFO;        /**< @brief Pointer version of CACHE_INFO */
 typedef CACHE_INFO *LPCACHE_INFO;               /**< @brief Pointer to const version of CACHE_INFO */
 
+/**
+  * @brief Source file probe information block
+  *
+  * Results of probing the input file, independent of the destination type.
+  * Used to predict the size of the transcoded file without opening the source.
+  */
+typedef struct PROBE_INFO
+{
+    std::string     m_origfile;                 /**< @brief Source filename */
+    time_t          m_file_time;                /**< @brief Source file file time */
+    size_t          m_file_size;                /**< @brief Source file file size */
+    int64_t         m_duration;                 /**< @brief Duration in AV_TIME_BASE fractional seconds */
+    int64_t         m_audiobitrate;             /**< @brief Audio bitrate in bit/s, 0 if no audio stream */
+    int             m_audiochannels;            /**< @brief Number of audio channels */
+    int             m_audiosamplerate;          /**< @brief Audio sample rate in Hz */
+    int64_t         m_videobitrate;             /**< @brief Video bitrate in bit/s, 0 if no video stream */
+    int             m_videowidth;               /**< @brief Video width */
+    int             m_videoheight;              /**< @brief Video height */
+    bool            m_interlaced;               /**< @brief true if source video is interlaced */
+    int             m_framerate_num;            /**< @brief Video frame rate numerator */
+    int             m_framerate_den;            /**< @brief Video frame rate denominator */
+} PROBE_INFO;
+typedef PROBE_INFO const *LPCPROBE_INFO;        /**< @brief Pointer to const version of PROBE_INFO */
+typedef PROBE_INFO *LPPROBE_INFO;               /**< @brief Pointer version of PROBE_INFO */
+
 class Cache_Entry;
 
 /**
@@ -129,6 +160,16 @@ public:
      * @return Returns true on success; false on error.
      */
     bool                    maintenance(size_t predicted_filesize = 0);
+    /**
+     * @brief Check if a new file fits into the cache without pruning other entries.
+     *
+     * Used for background transcoding, which must never push files out of the cache
+     * that have actually been requested.
+     *
+     * @param[in] predicted_filesize - Size of new file
+     * @return Returns true if there is room for the file; false if max_cache_size or min_diskspace would be exceeded.
+     */
+    bool                    room_for(size_t predicted_filesize);
     /**
      * @brief Clear cache: deletes all entries.
      * @return Returns true on success; false on error.
@@ -156,6 +197,44 @@ public:
      * @return Returns true on success; false on error.
      */
     bool                    remove_cachefile(const std::string & filename, const std::string &fileext);
+    /**
+     * @brief Check if a cache entry refers to a virtual file object.
+     * @param[in] virtualfile - virtualfile struct of a file.
+     * @return Returns true if a cache entry uses this very object; false if not.
+     */
+    bool                    references(LPCVIRTUALFILE virtualfile);
+    /**
+     * @brief Read probe info of a source file.
+     *
+     * m_origfile, m_file_time and m_file_size must be set to the current values of the source file,
+     * the entry will only be found if the file has not been changed since it was probed.
+     *
+     * @param[in, out] probe_info - Structure with probe info data.
+     * @return Returns true if a matching entry was found; false if not or on error.
+     */
+    bool                    read_probe(LPPROBE_INFO probe_info);
+    /**
+     * @brief Write probe info of a source file.
+     * @param[in] probe_info - Structure with probe info data.
+     * @return Returns true on success; false on error.
+     */
+    bool                    write_probe(LPCPROBE_INFO probe_info);
+    /**
+     * @brief Read seek index of a transcoded file.
+     * @param[in] filename - Source file name.
+     * @param[in] desttype - Destination type (MP4, WEBM etc.).
+     * @param[out] seek_index - Seek index, empty if none was found.
+     * @return Returns true if a seek index was found; false if not or on error.
+     */
+    bool                    read_seek_index(const std::string & filename, const std::string & desttype, SEEK_INDEX * seek_index);
+    /**
+     * @brief Write seek index of a transcoded file.
+     * @param[in] filename - Source file name.
+     * @param[in] desttype - Destination type (MP4, WEBM etc.).
+     * @param[in] seek_index - Seek index to store.
+     * @return Returns true on success; false on error.
+     */
+    bool                    write_seek_index(const std::string & filename, const std::string & desttype, const SEEK_INDEX & seek_index);
 
 protected:
     /**
@@ -209,6 +288,17 @@ private:
     sqlite3_stmt *          m_cacheidx_select_stmt;         /**< @brief Prepared select statement */
     sqlite3_stmt *          m_cacheidx_insert_stmt;         /**< @brief Prepared insert statement */
     sqlite3_stmt *          m_cacheidx_delete_stmt;         /**< @brief Prepared delete statement */
+    sqlite3_stmt *          m_probe_select_stmt;            /**< @brief Prepared probe info select statement */
+    sqlite3_stmt *          m_probe_insert_stmt;            /**< @brief Prepared probe info insert statement */
+    sqlite3_stmt *          m_resume_select_stmt;           /**< @brief Prepared resume checkpoint select statement */
+    sqlite3_stmt *          m_resume_insert_stmt;           /**< @brief Prepared resume checkpoint insert statement */
+    sqlite3_stmt *          m_resume_delete_stmt;           /**< @brief Prepared resume checkpoint delete statement */
+    sqlite3_stmt *          m_seek_index_select_stmt;       /**< @brief Prepared seek index select statement */
+    sqlite3_stmt *          m_seek_index_insert_stmt;       /**< @brief Prepared seek index insert statement */
+    sqlite3_stmt *          m_seek_index_delete_stmt;       /**< @brief Prepared seek index delete statement */
+    sqlite3_stmt *          m_hls_select_stmt;              /**< @brief Prepared HLS segment select statement */
+    sqlite3_stmt *          m_hls_insert_stmt;              /**< @brief Prepared HLS segment insert statement */
+    sqlite3_stmt *          m_hls_delete_stmt;              /**< @brief Prepared HLS segment delete statement */
     cache_t                 m_cache;                        /**< @brief Cache file (memory mapped file) */
 };
 
@@ -35,13 +35,26 @@
 #include "logging.h"
 
 #include <string.h>
+#include <climits>
 
 Cache_Entry::Cache_Entry(Cache *owner, LPVIRTUALFILE virtualfile)
     : m_owner(owner)
     , m_ref_count(0)
     , m_virtualfile(virtualfile)
+    , m_wait_count(0)
+    , m_wait_time(0)
+    , m_data_offset(0)
+    , m_range_running(false)
+    , m_range_stop(false)
+    , m_range_start(0)
+    , m_range_pos(0)
+    , m_background(false)
+    , m_background_job(nullptr)
+    , m_prefetched(false)
+    , m_generation(0)
+    , m_kernel_generation(UINT_MAX)
 {
-    m_cache_info.m_origfile = virtualfile->m_origfile;
+    m_cache_info.m_origfile = virtualfile->m_origfile.str();
 
     get_destname(&m_cache_info.m_destfile, m_cache_info.m_origfile);
 
@@ -111,12 +124,25 @@ void Cache_Entry::clear(bool fetch_file_time /*= true*/)
     m_cache_info.m_averror              = 0;
     m_cache_info.m_access_time          = m_cache_info.m_creation_time = time(nullptr);
     m_cache_info.m_access_count         = 0;
+    m_cache_info.m_resume_offset        = 0;
+    m_cache_info.m_resume_pos           = 0;
+
+    if (m_virtualfile->m_type == VIRTUALTYPE_HLS)
+    {
+        m_cache_info.m_segment_start    = m_virtualfile->m_hls.m_start_pos;
+        m_cache_info.m_segment_end      = m_virtualfile->m_hls.m_end_pos;
+    }
+    else
+    {
+        m_cache_info.m_segment_start    = 0;
+        m_cache_info.m_segment_end      = 0;
+    }
 
     if (fetch_file_time)
     {
         struct stat sb;
 
-        if (stat(filename().c_str(), &sb) == -1)
+        if (stat(sourcefile().c_str(), &sb) == -1)
         {
             m_cache_info.m_file_time    = 0;
             m_cache_info.m_file_size    = 0;
@@ -183,11 +209,11 @@ bool Cache_Entry::open(bool create_cache /*= true*/)
         return true;
     }
 
-    if (!m_cache_info.m_finished)
+    if (!m_cache_info.m_finished && !m_cache_info.m_resume_offset)
     {
         // If no database entry found (database is not consistent),
-        // or file was not completely transcoded last time,
-        // simply create a new file.
+        // or file was not completely transcoded last time and cannot
+        // be resumed, simply create a new file.
         erase_cache = true;
     }
 
@@ -199,6 +225,20 @@ bool Cache_Entry::open(bool create_cache /*= true*/)
     // Open the cache
     if (m_buffer->init(erase_cache))
     {
+        if (!erase_cache && !m_cache_info.m_finished)
+        {
+            if (m_buffer->resume(m_cache_info.m_resume_offset))
+            {
+                Logging::debug(filename(), "Keeping %1 of interrupted transcode.", format_size_ex(m_cache_info.m_resume_offset).c_str());
+            }
+            else
+            {
+                Logging::warning(filename(), "Cache file is shorter than the last checkpoint, transcoding from the start.");
+                m_cache_info.m_resume_offset    = 0;
+                m_cache_info.m_resume_pos       = 0;
+                m_buffer->clear();
+            }
+        }
         return true;
     }
     else
@@ -248,7 +288,27 @@ bool Cache_Entry::close(int flags)
     return true;
 }
 
-bool Cache_Entry::flush()
+bool Cache_Entry::save_checkpoint(size_t offset, int64_t pos)
+{
+    if (m_buffer == nullptr)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Everything up to the checkpoint must be on disk before it is recorded
+    if (!m_buffer->flush(true))
+    {
+        return false;
+    }
+
+    m_cache_info.m_resume_offset    = offset;
+    m_cache_info.m_resume_pos       = pos;
+
+    return write_info();
+}
+
+bool Cache_Entry::flush(bool durable /*= false*/)
 {
     if (m_buffer == nullptr)
     {
@@ -256,7 +316,7 @@ bool Cache_Entry::flush()
         return false;
     }
 
-    m_buffer->flush();
+    m_buffer->flush(durable);
     //write_info();
 
     return true;
@@ -300,12 +360,12 @@ bool Cache_Entry::expired() const
 
 bool Cache_Entry::suspend_timeout() const
 {
-    return (((time(nullptr) - m_cache_info.m_access_time) > params.m_max_inactive_suspend) && m_ref_count <= 1);
+    return (!m_background && ((time(nullptr) - m_cache_info.m_access_time) > params.m_max_inactive_suspend) && m_ref_count <= 1);
 }
 
 bool Cache_Entry::decode_timeout() const
 {
-    return (((time(nullptr) - m_cache_info.m_access_time) > params.m_max_inactive_abort) && m_ref_count <= 1);
+    return (!m_background && ((time(nullptr) - m_cache_info.m_access_time) > params.m_max_inactive_abort) && m_ref_count <= 1);
 }
 
 const std::string & Cache_Entry::filename() const
@@ -313,6 +373,16 @@ const std::string & Cache_Entry::filename() const
     return m_cache_info.m_origfile;
 }
 
+std::string Cache_Entry::sourcefile() const
+{
+    if (m_virtualfile->m_type == VIRTUALTYPE_HLS && !m_virtualfile->m_hls.m_srcfile.empty())
+    {
+        return m_virtualfile->m_hls.m_srcfile.str();
+    }
+
+    return m_cache_info.m_origfile;
+}
+
 const std::string & Cache_Entry::destname() const
 {
     return m_cache_info.m_destfile;
@@ -369,7 +439,14 @@ bool Cache_Entry::outdated() const
     }
 #endif  // !USING_LIBAV
 
-    if (stat(filename().c_str(), &sb) != -1)
+    if (m_virtualfile->m_type == VIRTUALTYPE_HLS &&
+            (m_cache_info.m_segment_start != m_virtualfile->m_hls.m_start_pos || m_cache_info.m_segment_end != m_virtualfile->m_hls.m_end_pos))
+    {
+        Logging::debug(filename(), "Triggering re-transcode: HLS segment start or end has changed.");
+        return true;
+    }
+
+    if (stat(sourcefile().c_str(), &sb) != -1)
     {
         // If source file exists, check file date/size
         if (m_cache_info.m_file_time < sb.st_mtime)
@@ -403,3 +480,19 @@ unsigned int Cache_Entry::read_count() const
     return m_cache_info.m_access_count;
 }
 
+
+void Cache_Entry::update_wait_time(int64_t wait_time)
+{
+    __sync_fetch_and_add(&m_wait_count, 1);
+    __sync_fetch_and_add(&m_wait_time, wait_time);
+}
+
+unsigned int Cache_Entry::wait_count() const
+{
+    return m_wait_count;
+}
+
+int64_t Cache_Entry::wait_time() const
+{
+    return m_wait_time;
+}
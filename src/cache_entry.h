@@ -38,6 +38,8 @@
 
 #include "id3v1tag.h"
 
+#include <atomic>
+
 class Buffer;
 
 /**
@@ -79,9 +81,19 @@ public:
     bool                    open(bool create_cache = true);
     /**
      * @brief Flush current memory cache to disk.
+     * @param[in] durable - If true, wait until the data is on disk. Otherwise write back is only started.
+     * @return On success returns true; on error returns false and errno contains the error code.
+     */
+    bool                    flush(bool durable = false);
+    /**
+     * @brief Record a checkpoint an interrupted transcode can be resumed from.
+     *
+     * Writes the cache file to disk up to the checkpoint, then stores it in the cache index.
+     * @param[in] offset - Offset in the cache file to resume at. All data before it must have been written.
+     * @param[in] pos - Position in the source file matching offset, in AV_TIME_BASE fractional seconds.
      * @return On success returns true; on error returns false and errno contains the error code.
      */
-    bool                    flush();
+    bool                    save_checkpoint(size_t offset, int64_t pos);
     /**
      * @brief Clear the cache entry
      * @param[in] fetch_file_time - If true, the entry file time will be filled in from the source file.
@@ -115,11 +127,17 @@ public:
     bool                    expired() const;
     /**
      * @brief Check for decode suspend timeout.
+     *
+     * Background transcodes are never suspended.
+     *
      * @return Returns true if decoding was suspended.
      */
     bool                    suspend_timeout() const;
     /**
      * @brief Check for decode timeout.
+     *
+     * Background transcodes never time out.
+     *
      * @return Returns true if decoding timed out.
      */
     bool                    decode_timeout() const;
@@ -128,6 +146,13 @@ public:
      * @return Returns the name of the source file.
      */
     const std::string &     filename() const;
+    /**
+     * @brief Get the name of the file actually transcoded.
+     *
+     * Same as filename(), except for HLS segments: these are cut from their source file.
+     * @return Returns the name of the file actually transcoded.
+     */
+    std::string             sourcefile() const;
     /**
      * @brief Get the name of the transcoded file.
      * @return Returns the name of the transcoded file.
@@ -181,6 +206,21 @@ public:
      * @return Returns current read counter
      */
     unsigned int            read_count() const;
+    /**
+     * @brief Account time a reader has been blocked waiting for the transcoder.
+     * @param[in] wait_time - Time blocked, in AV_TIME_BASE fractional seconds.
+     */
+    void                    update_wait_time(int64_t wait_time);
+    /**
+     * @brief Get number of reads that had to wait for the transcoder.
+     * @return Returns the number of blocked reads.
+     */
+    unsigned int            wait_count() const;
+    /**
+     * @brief Get total time readers have been blocked waiting for the transcoder.
+     * @return Returns the total time blocked, in AV_TIME_BASE fractional seconds.
+     */
+    int64_t                 wait_time() const;
 
 protected:
     /**
@@ -212,6 +252,9 @@ protected:
 
     LPVIRTUALFILE           m_virtualfile;                  /**< @brief Underlying virtual file object */
 
+    unsigned int            m_wait_count;                   /**< @brief Number of reads blocked waiting for the transcoder */
+    int64_t                 m_wait_time;                    /**< @brief Total time reads were blocked, in AV_TIME_BASE fractional seconds */
+
 public:
     Buffer *                m_buffer;                       /**< @brief Buffer object */
     bool                    m_is_decoding;                  /**< @brief true while file is decoding */
@@ -220,6 +263,17 @@ public:
     CACHE_INFO              m_cache_info;                   /**< @brief Info about cached object */
 
     ID3v1                   m_id3v1;                        /**< @brief ID3v1 structure which is used to send to clients */
+
+    size_t                  m_data_offset;                  /**< @brief Offset of first audio sample for PCM formats (header size), 0 if unknown */
+    std::atomic_bool        m_range_running;                /**< @brief true while a secondary transcoder fills in a range after a seek */
+    std::atomic_bool        m_range_stop;                   /**< @brief Set to stop the secondary transcoder */
+    std::atomic<size_t>     m_range_start;                  /**< @brief Start of range being filled in */
+    std::atomic<size_t>     m_range_pos;                    /**< @brief Current position of secondary transcoder */
+    std::atomic_bool        m_background;                   /**< @brief true while transcoding in background, i.e., nobody has requested the file yet */
+    std::atomic<void *>     m_background_job;               /**< @brief Queued background transcoder job, nullptr once it has started */
+    std::atomic_bool        m_prefetched;                   /**< @brief true once the next files in the directory have been prefetched */
+    std::atomic_uint        m_generation;                   /**< @brief Incremented each time the file is (re-)transcoded */
+    std::atomic_uint        m_kernel_generation;            /**< @brief Generation the kernel page cache may hold data of */
 };
 
 #endif // CACHE_ENTRY_H
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief #Cache warmer implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "cache_warmer.h"
+#include "ffmpegfs.h"
+#include "ffmpeg_utils.h"
+#include "transcode.h"
+#include "thread_pool.h"
+#include "logging.h"
+
+#include <dirent.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define WARMER_RESCAN_INTERVAL  (60 * 60)       /**< @brief Rescan input directory every hour */
+#define WARMER_IDLE_WAIT_MS     1000            /**< @brief Time to wait before checking for foreground jobs again */
+
+/**
+  * @brief WARMER_STATS struct, statistics of one pass
+  */
+typedef struct WARMER_STATS
+{
+    unsigned int            m_checked;          /**< @brief Number of files checked */
+    unsigned int            m_cached;           /**< @brief Number of files already in cache */
+    unsigned int            m_queued;           /**< @brief Number of files queued for transcoding */
+    unsigned int            m_failed;           /**< @brief Number of files that could not be queued */
+} WARMER_STATS;
+
+static std::thread *            warmer_thread;  /**< @brief Cache warmer thread */
+static std::mutex               warmer_mutex;   /**< @brief Protects warmer_stop */
+static std::condition_variable  warmer_cond;    /**< @brief Signalled when warmer_stop is set */
+static bool                     warmer_stop;    /**< @brief If true, the cache warmer thread exits */
+
+static bool wait_stop(int ms);
+static bool wait_idle();
+static bool warm_file(const std::string & origfile, const struct stat *stbuf, WARMER_STATS *stats);
+static bool warm_directory(const std::string & path, WARMER_STATS *stats);
+static void warmer_main();
+
+/**
+ * @brief Wait for the given time or until the cache warmer is stopped.
+ * @param[in] ms - Time to wait in milliseconds.
+ * @return Returns true if the cache warmer has been stopped; false if the time has elapsed.
+ */
+static bool wait_stop(int ms)
+{
+    std::unique_lock<std::mutex> lock(warmer_mutex);
+
+    return warmer_cond.wait_for(lock, std::chrono::milliseconds(ms), []{ return warmer_stop; });
+}
+
+/**
+ * @brief Wait until no files are being accessed and the background job queue is empty.
+ *
+ * Not more files than can be run in background are queued, that way the crawler does not
+ * keep lots of cache files open and will react quickly on cache limits.
+ *
+ * @return Returns true if the cache warmer has been stopped; false if new jobs may be queued.
+ */
+static bool wait_idle()
+{
+    for (;;)
+    {
+        thread_pool::THREAD_STATS interactive;
+        thread_pool::THREAD_STATS background;
+
+        tp->stats(thread_pool::PRIORITY_INTERACTIVE, &interactive);
+        tp->stats(thread_pool::PRIORITY_BACKGROUND, &background);
+
+        if (!interactive.m_running && !interactive.m_queued && !background.m_queued)
+        {
+            std::lock_guard<std::mutex> lock(warmer_mutex);
+            return warmer_stop;
+        }
+
+        if (wait_stop(WARMER_IDLE_WAIT_MS))
+        {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Queue a file for background transcoding if not yet in cache.
+ * @param[in] origfile - Input file name.
+ * @param[in] stbuf - stat buffer of the input file.
+ * @param[in, out] stats - Statistics of the current pass.
+ * @return Returns true to continue; false to end this pass.
+ */
+static bool warm_file(const std::string & origfile, const struct stat *stbuf, WARMER_STATS *stats)
+{
+    LPVIRTUALFILE virtualfile = insert_original(origfile, stbuf);
+
+    if (virtualfile == nullptr)
+    {
+        // Not transcoded, no need to cache
+        return true;
+    }
+
+    stats->m_checked++;
+
+    if (transcoder_cached(virtualfile))
+    {
+        stats->m_cached++;
+        return true;
+    }
+
+    if (wait_idle())
+    {
+        return false;
+    }
+
+    if (!transcoder_cache_room(0))
+    {
+        Logging::info(nullptr, "Cache warming suspended, cache is full.");
+        return false;
+    }
+
+    Logging::debug(origfile, "Cache warming: Queueing file for background transcoding.");
+
+    Cache_Entry* cache_entry = transcoder_new(virtualfile, true, true);
+    if (cache_entry == nullptr)
+    {
+        Logging::warning(origfile, "Cache warming: Unable to transcode file: (%1) %2", errno, strerror(errno));
+        stats->m_failed++;
+        return true;
+    }
+
+    // The transcoder thread keeps its own reference
+    transcoder_delete(cache_entry);
+
+    stats->m_queued++;
+
+    return true;
+}
+
+/**
+ * @brief Recursively walk a directory and queue all files that are not yet in cache.
+ * @param[in] path - Directory to walk.
+ * @param[in, out] stats - Statistics of the current pass.
+ * @return Returns true to continue; false to end this pass.
+ */
+static bool warm_directory(const std::string & path, WARMER_STATS *stats)
+{
+    DIR *dp = opendir(path.c_str());
+    if (dp == nullptr)
+    {
+        Logging::warning(path, "Cache warming: Error opening directory: (%1) %2", errno, strerror(errno));
+        return true;
+    }
+
+    bool success = true;
+    struct dirent *de;
+
+    while (success && (de = readdir(dp)) != nullptr)
+    {
+        std::string filename(de->d_name);
+        std::string origfile(path);
+        struct stat stbuf;
+
+        if (filename == "." || filename == "..")
+        {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(warmer_mutex);
+            if (warmer_stop)
+            {
+                success = false;
+                break;
+            }
+        }
+
+        append_filename(&origfile, filename);
+
+        if (lstat(origfile.c_str(), &stbuf) == -1)
+        {
+            continue;
+        }
+
+        if (S_ISDIR(stbuf.st_mode))
+        {
+            append_sep(&origfile);
+            success = warm_directory(origfile, stats);
+        }
+        else if (S_ISREG(stbuf.st_mode))
+        {
+            success = warm_file(origfile, &stbuf, stats);
+        }
+    }
+
+    closedir(dp);
+
+    return success;
+}
+
+/**
+ * @brief Cache warmer thread: Walk the input directory, then wait for the next pass.
+ */
+static void warmer_main()
+{
+    do
+    {
+        WARMER_STATS stats;
+
+        memset(&stats, 0, sizeof(stats));
+
+        Logging::info(nullptr, "Cache warming: Scanning '%1'.", params.m_basepath.c_str());
+
+        warm_directory(params.m_basepath, &stats);
+
+        Logging::info(nullptr, "Cache warming: %1 files checked, %2 already in cache, %3 queued for transcoding, %4 failed.", stats.m_checked, stats.m_cached, stats.m_queued, stats.m_failed);
+    }
+    while (!wait_stop(WARMER_RESCAN_INTERVAL * 1000));
+}
+
+bool start_cache_warmer()
+{
+    if (params.m_disable_cache)
+    {
+        Logging::warning(nullptr, "Cache warming is not possible with the cache disabled.");
+        return true;
+    }
+
+    if (warmer_thread != nullptr)
+    {
+        return true;
+    }
+
+    warmer_stop = false;
+
+    warmer_thread = new(std::nothrow) std::thread(warmer_main);
+    if (warmer_thread == nullptr)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    return true;
+}
+
+bool stop_cache_warmer()
+{
+    if (warmer_thread == nullptr)
+    {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(warmer_mutex);
+        warmer_stop = true;
+    }
+
+    warmer_cond.notify_all();
+
+    warmer_thread->join();
+
+    delete warmer_thread;
+    warmer_thread = nullptr;
+
+    return true;
+}
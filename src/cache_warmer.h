@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief %Cache warming
+ *
+ * Starts a thread that walks the input directory and transcodes all
+ * files that are not yet in the cache or are outdated in background,
+ * so they can be served from the cache right away when they are
+ * accessed for the first time.
+ *
+ * Background jobs run at idle CPU and I/O priority, give way to files
+ * that are actually being accessed and never push other files out of
+ * the cache. The crawler stops when the cache limits would be exceeded
+ * and rescans the input directory periodically.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef CACHE_WARMER_H
+#define CACHE_WARMER_H
+
+#pragma once
+
+/**
+ * @brief Start cache warmer thread.
+ * @return On success, returns true. On error, returns false. Check errno for details.
+ */
+bool start_cache_warmer();
+/**
+ * @brief Stop cache warmer thread. Background jobs already queued will be aborted by transcoder_exit().
+ * @return On success, returns true. On error, returns false. Check errno for details.
+ */
+bool stop_cache_warmer();
+
+#endif // CACHE_WARMER_H
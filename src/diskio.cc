@@ -60,9 +60,12 @@ int DiskIO::open(LPVIRTUALFILE virtualfile)
 {
     set_virtualfile(virtualfile);
 
-    Logging::debug(virtualfile->m_origfile, "Opening input file.");
+    // HLS segments are cut from their source file
+    std::string filename = (virtualfile->m_type == VIRTUALTYPE_HLS) ? virtualfile->m_hls.m_srcfile.str() : virtualfile->m_origfile.str();
 
-    m_fpi = fopen(virtualfile->m_origfile.c_str(), "rb");
+    Logging::debug(filename, "Opening input file.");
+
+    m_fpi = fopen(filename.c_str(), "rb");
 
     if (m_fpi != nullptr)
     {
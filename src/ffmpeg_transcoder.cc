@@ -32,8 +32,13 @@
 #include "ffmpeg_transcoder.h"
 #include "transcode.h"
 #include "buffer.h"
+#include "cache.h"
 #include "wave.h"
 #include "logging.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <algorithm>
 
 // Disable annoying warnings outside our code
 #pragma GCC diagnostic push
@@ -70,6 +75,17 @@ extern "C" {
 #endif
 #pragma GCC diagnostic pop
 
+#define PIPELINE_FRAME_QUEUE_SIZE   8       /**< @brief Max. number of raw video frames queued between pipeline stages */
+#define PIPELINE_PACKET_QUEUE_SIZE  64      /**< @brief Max. number of encoded packets queued for the muxer */
+#define SEGMENT_MIN_DURATION        300     /**< @brief Min. duration of a parallel audio segment in seconds */
+#define SEEK_INDEX_INTERVAL         AV_TIME_BASE    /**< @brief Min. distance between seek index entries other than keyframes */
+#define SEGMENT_PREROLL_MS          1000    /**< @brief Audio to encode and discard in front of a segment in milliseconds */
+#define SEGMENT_WAIT_MS             100     /**< @brief Max. time to wait for segment packets before returning to the caller */
+#define SEGMENT_QUEUE_SIZE          (1024 * 1024)   /**< @brief Max. bytes of encoded audio a segment keeps in memory before waiting to be stitched */
+#define VIDEO_CHUNK_MIN_DURATION    60      /**< @brief Min. duration of a parallel video chunk in seconds */
+#define VIDEO_CHUNK_AUDIO_LEAD      (2 * AV_TIME_BASE)  /**< @brief Max. distance audio may get ahead of the stitched video chunks */
+#define VIDEO_CHUNK_QUEUE_SIZE      (16 * 1024 * 1024)  /**< @brief Max. bytes of encoded video a chunk keeps in memory before waiting to be stitched */
+
 const FFmpeg_Transcoder::PRORES_BITRATE FFmpeg_Transcoder::m_prores_bitrate[] =
 {
     // SD
@@ -171,6 +187,36 @@ FFmpeg_Transcoder::FFmpeg_Transcoder()
     , m_copy_audio(false)
     , m_copy_video(false)
     , m_current_format(nullptr)
+    , m_pipeline_running(false)
+    , m_pipeline_error(0)
+    , m_filter_queue(PIPELINE_FRAME_QUEUE_SIZE)
+    , m_encode_queue(PIPELINE_FRAME_QUEUE_SIZE)
+    , m_mux_queue(PIPELINE_PACKET_QUEUE_SIZE)
+    , m_range_output(false)
+    , m_range_buffer(nullptr)
+    , m_range_start(0)
+    , m_range_pos(0)
+    , m_range_block_align(0)
+    , m_range_skip_pts(AV_NOPTS_VALUE)
+    , m_range_skip_samples(0)
+    , m_resume_output(false)
+    , m_segment_idx(0)
+    , m_packet_no(0)
+    , m_first_packet(0)
+    , m_end_packet(INT64_MAX)
+    , m_segment_full(false)
+    , m_direct_segment(nullptr)
+    , m_video_chunk_idx(0)
+    , m_video_chunk_start(AV_NOPTS_VALUE)
+    , m_video_chunk_end(AV_NOPTS_VALUE)
+    , m_video_chunk_started(false)
+    , m_video_chunk_full(false)
+    , m_video_chunk_flushed(false)
+    , m_video_chunk_input_done(false)
+    , m_video_chunk_read_pos(0)
+    , m_video_chunk_mux_pos(0)
+    , m_hls_audio_done(false)
+    , m_hls_video_done(false)
 {
 #pragma GCC diagnostic pop
     Logging::trace(nullptr, "FFmpeg trancoder ready to initialise.");
@@ -249,7 +295,7 @@ int FFmpeg_Transcoder::open_input_file(LPVIRTUALFILE virtualfile, FileIO *fio)
 
     m_virtualfile = virtualfile;
 
-    m_in.m_filename     = m_virtualfile->m_origfile;
+    m_in.m_filename     = m_virtualfile->m_origfile.str();
     m_mtime             = m_virtualfile->m_st.st_mtime;
     m_current_format    = params.current_format(m_virtualfile);
 
@@ -426,7 +472,11 @@ int FFmpeg_Transcoder::open_input_file(LPVIRTUALFILE virtualfile, FileIO *fio)
         return ret;
     }
 
-    m_virtualfile->m_duration = m_in.m_format_ctx->duration;
+    if (m_virtualfile->m_type != VIRTUALTYPE_HLS)
+    {
+        // HLS segments keep their own duration
+        m_virtualfile->m_duration = m_in.m_format_ctx->duration;
+    }
 
     if (m_in.m_video.m_stream_idx >= 0)
     {
@@ -625,7 +675,7 @@ int FFmpeg_Transcoder::open_output_file(Buffer *buffer)
 
     // Pre-allocate the predicted file size to reduce memory reallocations
     size_t buffsize = predicted_filesize();
-    if (buffer->size() < buffsize && !buffer->reserve(buffsize))
+    if (buffer != nullptr && buffer->size() < buffsize && !buffer->reserve(buffsize))
     {
         int _errno = errno;
         Logging::error(filename(), "Error pre-allocating %1 bytes buffer: (%2) %3", buffsize, errno, strerror(errno));
@@ -636,6 +686,8 @@ int FFmpeg_Transcoder::open_output_file(Buffer *buffer)
     m_out.m_video_start_pts   = 0;
     m_out.m_last_mux_dts      = AV_NOPTS_VALUE;
 
+    m_seek_index.clear();
+
     // Open the output file for writing. If buffer == nullptr continue using existing buffer.
     ret = open_output_filestreams(buffer);
     if (ret)
@@ -666,34 +718,1105 @@ int FFmpeg_Transcoder::open_output_file(Buffer *buffer)
         }
     }
 
-    if (m_out.m_video.m_stream_idx > -1)
-    {
-        video_info(true, m_out.m_format_ctx, m_out.m_video.m_stream);
+    if (m_out.m_video.m_stream_idx > -1)
+    {
+        video_info(true, m_out.m_format_ctx, m_out.m_video.m_stream);
+    }
+
+    // Process metadata. The decoder will call the encoder to set appropriate
+    // tag values for the output file.
+    ret = process_metadata();
+    if (ret)
+    {
+        return ret;
+    }
+
+    // Write the header of the output file container.
+    ret = write_output_file_header();
+    if (ret)
+    {
+        return ret;
+    }
+
+    if (m_range_output || m_segment != nullptr)
+    {
+        // Filling in a range of an existing file or transcoding a segment, header and album arts are taken care of elsewhere.
+        return 0;
+    }
+
+    // Process album arts: copy all from source file to target.
+    ret = process_albumarts();
+    if (ret)
+    {
+        return ret;
+    }
+
+    if (m_virtualfile->m_type == VIRTUALTYPE_HLS)
+    {
+        // Start decoding at the beginning of the segment
+        ret = start_hls_segment();
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    if (params.m_video_chunks > 1)
+    {
+        // Encode long videos in parallel chunks
+        ret = start_video_chunks();
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    if (params.m_pipeline && m_out.m_video.m_codec_ctx != nullptr && !m_copy_video && m_video_chunks.empty())
+    {
+        // Run filtering, encoding and muxing in separate threads
+        ret = start_pipeline();
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    if (params.m_audio_segments > 1)
+    {
+        // Transcode long audio files in parallel segments
+        ret = start_segments();
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int FFmpeg_Transcoder::open_output_range(Buffer *buffer, size_t data_offset, size_t offset)
+{
+    int ret;
+
+    m_range_output  = true;
+    m_range_buffer  = buffer;
+
+    ret = open_output_file(buffer);
+    if (ret)
+    {
+        return ret;
+    }
+
+    if (m_out.m_audio.m_codec_ctx == nullptr || m_in.m_audio.m_stream == nullptr || offset < data_offset)
+    {
+        Logging::error(destname(), "Internal error: Unable to fill in range at offset %1.", offset);
+        return AVERROR(EINVAL);
+    }
+
+    // Size of one sample for all channels. This is exactly the size PCM data takes in the output file.
+    m_range_block_align = m_out.m_audio.m_codec_ctx->channels * av_get_bytes_per_sample(m_out.m_audio.m_codec_ctx->sample_fmt);
+    if (m_range_block_align <= 0)
+    {
+        Logging::error(destname(), "Internal error: Invalid block size %1.", m_range_block_align);
+        return AVERROR(EINVAL);
+    }
+
+    int64_t sample_pos  = static_cast<int64_t>(offset - data_offset) / m_range_block_align;
+
+    m_range_start       = data_offset + static_cast<size_t>(sample_pos * m_range_block_align);
+    m_range_pos         = m_range_start;
+
+    ret = seek_to_sample(sample_pos);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    Logging::debug(destname(), "Filling in range from offset %1 (sample %2).", m_range_start, sample_pos);
+
+    return 0;
+}
+
+int FFmpeg_Transcoder::open_output_resume(Buffer *buffer, size_t offset, size_t *data_offset)
+{
+    int ret;
+
+    m_resume_output = true;
+
+    // The buffer is positioned at the end of the data kept, but the header must go to the start
+    if (buffer->seek(0, SEEK_SET))
+    {
+        int _errno = errno;
+        Logging::error(destname(), "Could not seek output file to start: (%1) %2", errno, strerror(errno));
+        return AVERROR(_errno);
+    }
+
+    ret = open_output_file(buffer);
+    if (ret)
+    {
+        return ret;
+    }
+
+    // Header has been written again, audio data starts here
+    AVIOContext * output_io_context = static_cast<AVIOContext *>(m_out.m_format_ctx->pb);
+
+    avio_flush(output_io_context);
+
+    *data_offset = buffer->tell();
+
+    int64_t pos;
+    size_t start = resume_point(*data_offset, offset, &pos);
+
+    if (!start || m_out.m_audio.m_codec_ctx == nullptr || m_in.m_audio.m_stream == nullptr)
+    {
+        Logging::error(destname(), "Internal error: Unable to resume at offset %1.", offset);
+        return AVERROR(EINVAL);
+    }
+
+    int block_align     = CODECPAR(m_out.m_audio.m_stream)->channels * av_get_bits_per_sample(CODECPAR(m_out.m_audio.m_stream)->codec_id) / 8;
+    int64_t sample_pos  = static_cast<int64_t>(start - *data_offset) / block_align;
+
+    ret = seek_to_sample(sample_pos);
+    if (ret < 0)
+    {
+        Logging::warning(destname(), "Unable to resume at offset %1, transcoding from the start.", start);
+        return 0;
+    }
+
+    if (avio_seek(output_io_context, static_cast<int64_t>(start), SEEK_SET) < 0)
+    {
+        Logging::error(destname(), "Could not seek output file to offset %1.", start);
+        return AVERROR(EIO);
+    }
+
+    // Continue timestamps where the last transcode stopped
+    m_out.m_audio_pts = av_rescale_q(sample_pos, { 1, m_out.m_audio.m_codec_ctx->sample_rate }, m_out.m_audio.m_codec_ctx->time_base);
+
+    Logging::info(destname(), "Resuming at offset %1 (%2).", start, format_duration(pos).c_str());
+
+    return 0;
+}
+
+int FFmpeg_Transcoder::seek_to_sample(int64_t sample_pos)
+{
+    int ret;
+
+    // Position input file to the sample. Seeking will usually end up a bit before the
+    // requested position, so the decoder will drop the samples in front of it.
+    AVRational sample_time_base = { 1, m_out.m_audio.m_codec_ctx->sample_rate };
+    int64_t pts = av_rescale_q(sample_pos, sample_time_base, m_in.m_audio.m_stream->time_base);
+
+    if (m_in.m_audio.m_stream->start_time != AV_NOPTS_VALUE)
+    {
+        pts += m_in.m_audio.m_stream->start_time;
+    }
+
+    ret = av_seek_frame(m_in.m_format_ctx, m_in.m_audio.m_stream_idx, pts, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0)
+    {
+        Logging::error(filename(), "Could not seek to sample %1 (error '%2').", sample_pos, ffmpeg_geterror(ret).c_str());
+        return ret;
+    }
+
+    avcodec_flush_buffers(m_in.m_audio.m_codec_ctx);
+
+    m_range_skip_pts        = pts;
+    m_range_skip_samples    = 0;
+
+    Logging::trace(destname(), "Seeked to sample %1 (%2).", sample_pos, format_duration(av_rescale_q(sample_pos, sample_time_base, av_get_time_base_q())).c_str());
+
+    return 0;
+}
+
+int FFmpeg_Transcoder::start_hls_segment()
+{
+    const VIRTUALFILE::HLS_SEGMENT & segment = m_virtualfile->m_hls;
+    int ret;
+
+    m_hls_audio_done = false;
+    m_hls_video_done = false;
+
+    if (m_out.m_audio.m_codec_ctx != nullptr)
+    {
+        // Video timestamps are taken from the source anyway, audio is counted from here
+        m_out.m_audio_pts = av_rescale_q(segment.m_start_pos, av_get_time_base_q(), m_out.m_audio.m_codec_ctx->time_base);
+    }
+
+    if (!segment.m_start_pos)
+    {
+        // First segment, nothing to seek
+        return 0;
+    }
+
+    int64_t ts = segment.m_start_pos;
+
+    if (m_in.m_format_ctx->start_time != AV_NOPTS_VALUE)
+    {
+        ts += m_in.m_format_ctx->start_time;
+    }
+
+    // Seek to the key frame before the segment start, frames in front of it will be dropped.
+    ret = avformat_seek_file(m_in.m_format_ctx, -1, INT64_MIN, ts, ts, 0);
+    if (ret < 0)
+    {
+        Logging::error(filename(), "Could not seek to HLS segment %1 at %2 (error '%3').", segment.m_segment_no, format_duration(segment.m_start_pos).c_str(), ffmpeg_geterror(ret).c_str());
+        return ret;
+    }
+
+    if (m_in.m_audio.m_codec_ctx != nullptr)
+    {
+        avcodec_flush_buffers(m_in.m_audio.m_codec_ctx);
+    }
+
+    if (m_in.m_video.m_codec_ctx != nullptr)
+    {
+        avcodec_flush_buffers(m_in.m_video.m_codec_ctx);
+    }
+
+    if (m_in.m_audio.m_stream != nullptr && m_out.m_audio.m_codec_ctx != nullptr)
+    {
+        // Let the decoder get to the exact sample position
+        m_range_skip_pts        = av_rescale_q(ts, av_get_time_base_q(), m_in.m_audio.m_stream->time_base);
+        m_range_skip_samples    = 0;
+    }
+
+    Logging::debug(destname(), "Starting HLS segment %1 at %2.", segment.m_segment_no, format_duration(segment.m_start_pos).c_str());
+
+    return 0;
+}
+
+bool FFmpeg_Transcoder::outside_hls_segment(int64_t ts, const AVRational & time_base) const
+{
+    if (m_virtualfile->m_type != VIRTUALTYPE_HLS || ts == AV_NOPTS_VALUE)
+    {
+        return false;
+    }
+
+    int64_t pos = av_rescale_q(ts, time_base, av_get_time_base_q());
+
+    if (m_in.m_format_ctx->start_time != AV_NOPTS_VALUE)
+    {
+        pos -= m_in.m_format_ctx->start_time;
+    }
+
+    if (m_virtualfile->m_hls.m_start_pos && pos < m_virtualfile->m_hls.m_start_pos)
+    {
+        return true;
+    }
+
+    return (m_virtualfile->m_hls.m_end_pos != AV_NOPTS_VALUE && pos >= m_virtualfile->m_hls.m_end_pos);
+}
+
+bool FFmpeg_Transcoder::past_hls_segment(const AVPacket *pkt, int *finished)
+{
+    const AVStream *stream;
+    bool *done;
+
+    if (pkt->stream_index == m_in.m_audio.m_stream_idx && m_out.m_audio.m_stream_idx > -1)
+    {
+        stream  = m_in.m_audio.m_stream;
+        done    = &m_hls_audio_done;
+    }
+    else if (pkt->stream_index == m_in.m_video.m_stream_idx && m_out.m_video.m_stream_idx > -1)
+    {
+        stream  = m_in.m_video.m_stream;
+        done    = &m_hls_video_done;
+    }
+    else
+    {
+        // Not transcoded anyway
+        return false;
+    }
+
+    if (*done)
+    {
+        return true;
+    }
+
+    int64_t ts = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+
+    if (ts == AV_NOPTS_VALUE || m_virtualfile->m_hls.m_end_pos == AV_NOPTS_VALUE || !outside_hls_segment(ts, stream->time_base))
+    {
+        return false;
+    }
+
+    *done = true;
+
+    int64_t pos = av_rescale_q(ts, stream->time_base, av_get_time_base_q());
+
+    if (m_in.m_format_ctx->start_time != AV_NOPTS_VALUE)
+    {
+        pos -= m_in.m_format_ctx->start_time;
+    }
+
+    // Done if all streams have got here. Do not wait more than a second for a stream that ended early.
+    if (pos >= m_virtualfile->m_hls.m_end_pos + AV_TIME_BASE ||
+            ((m_hls_audio_done || m_out.m_audio.m_stream_idx == -1) && (m_hls_video_done || m_out.m_video.m_stream_idx == -1)))
+    {
+        *finished = 1;
+    }
+
+    return true;
+}
+
+int FFmpeg_Transcoder::open_output_segment(const std::shared_ptr<SEGMENT> & segment)
+{
+    int ret;
+
+    m_segment = segment;
+
+    // Output is not written anywhere, packets are stored in the segment
+    ret = open_output_file(nullptr);
+    if (ret)
+    {
+        return ret;
+    }
+
+    if (segment->m_video)
+    {
+        if (m_out.m_video.m_codec_ctx == nullptr || m_in.m_video.m_stream == nullptr)
+        {
+            Logging::error(destname(), "Internal error: Unable to encode video chunk %1.", segment->m_no);
+            return AVERROR(EINVAL);
+        }
+
+        m_video_chunk_start     = segment->m_start_pos;
+        m_video_chunk_end       = segment->m_end_pos;
+        m_video_chunk_started   = false;
+
+        int64_t ts = segment->m_start_pos;
+
+        if (m_in.m_format_ctx->start_time != AV_NOPTS_VALUE)
+        {
+            ts += m_in.m_format_ctx->start_time;
+        }
+
+        // Seek to the key frame before the chunk start, frames in front of the first key frame of the chunk will be dropped.
+        ret = avformat_seek_file(m_in.m_format_ctx, -1, INT64_MIN, ts, ts, 0);
+        if (ret < 0)
+        {
+            Logging::error(filename(), "Could not seek to video chunk %1 at %2 (error '%3').", segment->m_no, format_duration(segment->m_start_pos).c_str(), ffmpeg_geterror(ret).c_str());
+            return ret;
+        }
+
+        avcodec_flush_buffers(m_in.m_video.m_codec_ctx);
+
+        {
+            // For the stitcher to check against its own encoder
+            const AVCodecContext *codec_ctx = m_out.m_video.m_codec_ctx;
+            std::lock_guard<std::mutex> lock(segment->m_mutex);
+
+            if (codec_ctx->extradata != nullptr && codec_ctx->extradata_size > 0)
+            {
+                segment->m_extradata.assign(codec_ctx->extradata, codec_ctx->extradata + codec_ctx->extradata_size);
+            }
+        }
+
+        return 0;
+    }
+
+    if (m_out.m_audio.m_codec_ctx == nullptr || m_in.m_audio.m_stream == nullptr || m_out.m_audio.m_codec_ctx->frame_size <= 0)
+    {
+        Logging::error(destname(), "Internal error: Unable to transcode segment %1.", segment->m_no);
+        return AVERROR(EINVAL);
+    }
+
+    // Start a bit earlier so the encoder is in the same state at the first packet as when
+    // encoding the file in one go. The pre-roll packets will be discarded.
+    m_packet_no     = segment->m_first_packet - segment->m_preroll;
+    m_first_packet  = segment->m_first_packet;
+    m_end_packet    = segment->m_end_packet;
+
+    return seek_to_sample(m_packet_no * m_out.m_audio.m_codec_ctx->frame_size);
+}
+
+void FFmpeg_Transcoder::run_segment(const std::shared_ptr<SEGMENT> & segment)
+{
+    int expected = SEGMENT_QUEUED;
+
+    if (!segment->m_state.compare_exchange_strong(expected, SEGMENT_RUNNING))
+    {
+        // Already started by someone else
+        return;
+    }
+
+    int ret = 0;
+    FFmpeg_Transcoder *transcoder = begin_segment(segment, &ret);
+
+    while (transcoder != nullptr && !ret)
+    {
+        ret = step_segment(transcoder, segment);
+    }
+
+    end_segment(transcoder, segment, ret);
+}
+
+FFmpeg_Transcoder * FFmpeg_Transcoder::begin_segment(const std::shared_ptr<SEGMENT> & segment, int *ret)
+{
+    FFmpeg_Transcoder *transcoder = new(std::nothrow) FFmpeg_Transcoder;
+
+    if (transcoder == nullptr)
+    {
+        Logging::error(segment->m_virtualfile->m_origfile.str(), "Out of memory transcoding segment %1.", segment->m_no);
+        *ret = AVERROR(ENOMEM);
+        return nullptr;
+    }
+
+    *ret = transcoder->open_input_file(segment->m_virtualfile);
+    if (*ret >= 0)
+    {
+        *ret = transcoder->open_output_segment(segment);
+    }
+
+    if (*ret < 0)
+    {
+        transcoder->close();
+
+        delete transcoder;
+
+        return nullptr;
+    }
+
+    *ret = 0;
+
+    if (segment->m_video)
+    {
+        Logging::debug(transcoder->destname(), "Encoding video chunk %1 starting at %2.", segment->m_no, format_duration(segment->m_start_pos).c_str());
+    }
+    else
+    {
+        Logging::debug(transcoder->destname(), "Transcoding segment %1 starting at packet %2.", segment->m_no, segment->m_first_packet);
+    }
+
+    return transcoder;
+}
+
+int FFmpeg_Transcoder::step_segment(FFmpeg_Transcoder *transcoder, const std::shared_ptr<SEGMENT> & segment)
+{
+    int status = 0;
+    int ret;
+
+    if (segment->m_abort)
+    {
+        return AVERROR_EXIT;
+    }
+
+    ret = transcoder->process_single_fr(status);
+    if (status < 0)
+    {
+        return (ret < 0 ? ret : AVERROR(EIO));
+    }
+
+    return (status == 1) ? 1 : 0;
+}
+
+void FFmpeg_Transcoder::end_segment(FFmpeg_Transcoder *transcoder, const std::shared_ptr<SEGMENT> & segment, int ret)
+{
+    if (transcoder != nullptr)
+    {
+        transcoder->close();
+
+        delete transcoder;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(segment->m_mutex);
+
+        segment->m_error = (ret == 1) ? 0 : ret;
+        segment->m_state = SEGMENT_DONE;
+    }
+
+    segment->m_cond.notify_all();
+}
+
+void FFmpeg_Transcoder::run_segment_direct(const std::shared_ptr<SEGMENT> & segment)
+{
+    int ret = 0;
+
+    if (m_direct_segment == nullptr)
+    {
+        int expected = SEGMENT_QUEUED;
+
+        if (!segment->m_state.compare_exchange_strong(expected, SEGMENT_RUNNING))
+        {
+            // A pool thread has picked it up meanwhile
+            return;
+        }
+
+        if (segment->m_video)
+        {
+            Logging::debug(destname(), "Video chunk %1 not started yet, encoding it directly.", segment->m_no);
+        }
+        else
+        {
+            Logging::debug(destname(), "Segment %1 not started yet, transcoding it directly.", segment->m_no);
+        }
+
+        {
+            // We stitch the packets ourselves after each step, waiting for room would never end
+            std::lock_guard<std::mutex> lock(segment->m_mutex);
+
+            segment->m_max_bytes = 0;
+        }
+
+        m_direct_segment = begin_segment(segment, &ret);
+        if (m_direct_segment == nullptr)
+        {
+            end_segment(nullptr, segment, ret);
+            return;
+        }
+    }
+
+    do
+    {
+        ret = step_segment(m_direct_segment, segment);
+    }
+    while (!ret && segment->m_queued_bytes == 0);
+
+    if (ret)
+    {
+        end_segment(m_direct_segment, segment, ret);
+        m_direct_segment = nullptr;
+    }
+}
+
+void FFmpeg_Transcoder::segment_thread(void *opaque)
+{
+    std::shared_ptr<SEGMENT> *segment = static_cast<std::shared_ptr<SEGMENT> *>(opaque);
+
+    run_segment(*segment);
+
+    delete segment;
+}
+
+int FFmpeg_Transcoder::start_segments()
+{
+#if LAVC_NEW_PACKET_INTERFACE
+    if (m_segment != nullptr || m_range_output || m_copy_audio || m_out.m_audio.m_codec_ctx == nullptr || m_out.m_video.m_stream_idx > -1)
+    {
+        // Only for audio files
+        return 0;
+    }
+
+    switch (m_out.m_filetype)
+    {
+    case FILETYPE_MP3:
+    case FILETYPE_OPUS:
+    {
+        // Frames can simply be concatenated
+        break;
+    }
+    default:
+    {
+        return 0;
+    }
+    }
+
+    if (m_virtualfile->m_type != VIRTUALTYPE_DISK ||
+            m_in.m_format_ctx->duration == AV_NOPTS_VALUE ||
+            m_out.m_audio.m_codec_ctx->frame_size <= 0 ||
+            (m_out.m_audio.m_codec_ctx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+    {
+        // Segment boundaries must be predictable
+        return 0;
+    }
+
+    int64_t segments = std::min(static_cast<int64_t>(params.m_audio_segments), m_in.m_format_ctx->duration / (SEGMENT_MIN_DURATION * AV_TIME_BASE));
+    if (segments < 2)
+    {
+        // Too short
+        return 0;
+    }
+
+    int frame_size              = m_out.m_audio.m_codec_ctx->frame_size;
+    int sample_rate             = m_out.m_audio.m_codec_ctx->sample_rate;
+    int64_t total_packets       = av_rescale(m_in.m_format_ctx->duration, sample_rate, AV_TIME_BASE) / frame_size;
+    int64_t segment_packets     = total_packets / segments;
+    int64_t preroll             = (static_cast<int64_t>(sample_rate) * SEGMENT_PREROLL_MS / 1000 + frame_size - 1) / frame_size;
+
+    // First segment is done by ourselves
+    m_first_packet  = 0;
+    m_end_packet    = segment_packets;
+
+    for (int64_t n = 1; n < segments; n++)
+    {
+        std::shared_ptr<SEGMENT> segment = std::make_shared<SEGMENT>();
+
+        segment->m_virtualfile  = m_virtualfile;
+        segment->m_no           = static_cast<int>(n);
+        segment->m_first_packet = n * segment_packets;
+        segment->m_end_packet   = (n < segments - 1) ? (n + 1) * segment_packets : INT64_MAX;
+        segment->m_preroll      = preroll;
+        segment->m_max_bytes    = SEGMENT_QUEUE_SIZE;
+
+        m_segments.push_back(segment);
+
+        std::shared_ptr<SEGMENT> *opaque = new(std::nothrow) std::shared_ptr<SEGMENT>(segment);
+        if (opaque == nullptr || !tp->schedule_thread(&segment_thread, opaque))
+        {
+            // Will be transcoded by ourselves when due
+            delete opaque;
+        }
+    }
+
+    m_segment_idx = 0;
+
+    Logging::info(destname(), "Transcoding %1 segments of %2 in parallel.", segments, format_duration(av_rescale(segment_packets * frame_size, AV_TIME_BASE, sample_rate)).c_str());
+#endif // LAVC_NEW_PACKET_INTERFACE
+
+    return 0;
+}
+
+void FFmpeg_Transcoder::stop_segments()
+{
+    for (std::vector<std::shared_ptr<SEGMENT>> * segments : { &m_segments, &m_video_chunks })
+    {
+        for (std::shared_ptr<SEGMENT> & segment : *segments)
+        {
+            {
+                std::lock_guard<std::mutex> lock(segment->m_mutex);
+
+                segment->m_abort = true;
+
+                while (!segment->m_packets.empty())
+                {
+                    AVPacket *pkt = segment->m_packets.front();
+                    segment->m_packets.pop_front();
+                    av_packet_free(&pkt);
+                }
+
+                segment->m_queued_bytes = 0;
+            }
+
+            // Release the producer if waiting for room
+            segment->m_cond.notify_all();
+        }
+
+        segments->clear();
+    }
+
+    if (m_direct_segment != nullptr)
+    {
+        std::shared_ptr<SEGMENT> segment = m_direct_segment->m_segment;
+
+        end_segment(m_direct_segment, segment, AVERROR_EXIT);
+        m_direct_segment = nullptr;
+    }
+
+    m_segment_idx       = 0;
+    m_video_chunk_idx   = 0;
+}
+
+int FFmpeg_Transcoder::store_segment_packet(AVPacket *pkt)
+{
+#if LAVC_NEW_PACKET_INTERFACE
+    AVPacket *clone = av_packet_clone(pkt);
+    if (clone == nullptr)
+    {
+        Logging::error(destname(), "Could not store packet of segment %1.", m_segment->m_no);
+        return AVERROR(ENOMEM);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_segment->m_mutex);
+
+        // Wait until the stitcher has caught up
+        m_segment->m_cond.wait(lock, [this]{ return (!m_segment->m_max_bytes || m_segment->m_queued_bytes < m_segment->m_max_bytes || m_segment->m_abort); });
+
+        if (m_segment->m_abort)
+        {
+            // Nobody is interested anymore
+            av_packet_free(&clone);
+            return AVERROR_EXIT;
+        }
+
+        m_segment->m_packets.push_back(clone);
+        m_segment->m_queued_bytes += static_cast<size_t>(clone->size);
+    }
+
+    m_segment->m_cond.notify_all();
+
+    return 0;
+#else
+    (void)pkt;
+    return AVERROR(ENOSYS);
+#endif // LAVC_NEW_PACKET_INTERFACE
+}
+
+int FFmpeg_Transcoder::stitch_segments(int *finished)
+{
+    while (m_segment_idx < m_segments.size())
+    {
+        std::shared_ptr<SEGMENT> segment = m_segments[m_segment_idx];
+        std::deque<AVPacket*> packets;
+        bool done;
+        int error;
+        int ret = 0;
+
+        if (segment->m_state == SEGMENT_QUEUED || m_direct_segment != nullptr)
+        {
+            // No pool thread has picked it up, do it ourselves instead of waiting for one
+            run_segment_direct(segment);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(segment->m_mutex);
+
+            if (segment->m_packets.empty() && segment->m_state != SEGMENT_DONE)
+            {
+                segment->m_cond.wait_for(lock, std::chrono::milliseconds(SEGMENT_WAIT_MS));
+            }
+
+            packets.swap(segment->m_packets);
+            segment->m_queued_bytes = 0;
+            done    = (segment->m_state == SEGMENT_DONE);
+            error   = segment->m_error;
+        }
+
+        // Make room for the encoder
+        segment->m_cond.notify_all();
+
+        while (!packets.empty())
+        {
+            AVPacket *pkt = packets.front();
+            packets.pop_front();
+
+            if (!ret)
+            {
+                pkt->stream_index = m_out.m_audio.m_stream_idx;
+
+                produce_audio_dts(pkt);
+
+                ret = store_packet(pkt, "audio");
+            }
+
+            av_packet_free(&pkt);
+        }
+
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        if (!done)
+        {
+            // Come back later for more
+            return 0;
+        }
+
+        if (error)
+        {
+            Logging::error(destname(), "Segment %1 failed (error '%2').", segment->m_no, ffmpeg_geterror(error).c_str());
+            return error;
+        }
+
+        Logging::debug(destname(), "Segment %1 complete.", segment->m_no);
+
+        m_segment_idx++;
+    }
+
+    *finished = 1;
+
+    return 0;
+}
+
+int FFmpeg_Transcoder::start_video_chunks()
+{
+#if LAVC_NEW_PACKET_INTERFACE
+    if (m_segment != nullptr || m_range_output || m_copy_video || m_out.m_video.m_codec_ctx == nullptr || m_in.m_video.m_stream == nullptr)
+    {
+        // Only if video is encoded
+        return 0;
+    }
+
+    switch (m_out.m_filetype)
+    {
+    case FILETYPE_MP4:
+    case FILETYPE_WEBM:
+    case FILETYPE_MOV:
+    case FILETYPE_PRORES:
+    {
+        // Chunks starting with a key frame can simply be appended
+        break;
+    }
+    default:
+    {
+        return 0;
+    }
+    }
+
+    if (m_virtualfile->m_type != VIRTUALTYPE_DISK || m_in.m_format_ctx->duration == AV_NOPTS_VALUE)
+    {
+        // Chunk boundaries must be seekable
+        return 0;
+    }
+
+#ifndef USING_LIBAV
+    if (m_filter_graph != nullptr)
+    {
+        // The deinterlace filter holds back frames, they would be lost at the chunk boundaries
+        return 0;
+    }
+#endif // !USING_LIBAV
+
+    int64_t chunks = std::min(static_cast<int64_t>(params.m_video_chunks), m_in.m_format_ctx->duration / (VIDEO_CHUNK_MIN_DURATION * AV_TIME_BASE));
+    if (chunks < 2)
+    {
+        // Too short
+        return 0;
+    }
+
+    int64_t chunk_duration = m_in.m_format_ctx->duration / chunks;
+
+    // First chunk is done by ourselves
+    m_video_chunk_start     = AV_NOPTS_VALUE;
+    m_video_chunk_end       = chunk_duration;
+    m_video_chunk_started   = true;
+
+    for (int64_t n = 1; n < chunks; n++)
+    {
+        std::shared_ptr<SEGMENT> segment = std::make_shared<SEGMENT>();
+
+        segment->m_virtualfile  = m_virtualfile;
+        segment->m_no           = static_cast<int>(n);
+        segment->m_video        = true;
+        segment->m_start_pos    = n * chunk_duration;
+        segment->m_end_pos      = (n < chunks - 1) ? (n + 1) * chunk_duration : AV_NOPTS_VALUE;
+        segment->m_max_bytes    = VIDEO_CHUNK_QUEUE_SIZE;
+
+        m_video_chunks.push_back(segment);
+
+        std::shared_ptr<SEGMENT> *opaque = new(std::nothrow) std::shared_ptr<SEGMENT>(segment);
+        if (opaque == nullptr || !tp->schedule_thread(&segment_thread, opaque))
+        {
+            // Will be encoded by ourselves when due
+            delete opaque;
+        }
+    }
+
+    m_video_chunk_idx = 0;
+
+    Logging::info(destname(), "Encoding %1 video chunks of %2 in parallel.", chunks, format_duration(chunk_duration).c_str());
+#endif // LAVC_NEW_PACKET_INTERFACE
+
+    return 0;
+}
+
+bool FFmpeg_Transcoder::video_chunk_frame(const AVFrame *frame)
+{
+    if (m_video_chunk_start == AV_NOPTS_VALUE && m_video_chunk_end == AV_NOPTS_VALUE)
+    {
+        // Not chunked
+        return true;
+    }
+
+    if (m_video_chunk_full)
+    {
+        return false;
+    }
+
+    int64_t ts = (frame->pts != AV_NOPTS_VALUE) ? frame->pts : m_pts;
+
+    if (ts == AV_NOPTS_VALUE)
+    {
+        return m_video_chunk_started;
+    }
+
+    int64_t pos = av_rescale_q(ts, m_in.m_video.m_stream->time_base, av_get_time_base_q());
+
+    if (m_in.m_format_ctx->start_time != AV_NOPTS_VALUE)
+    {
+        pos -= m_in.m_format_ctx->start_time;
+    }
+
+    if (!m_video_chunk_started)
+    {
+        if (!frame->key_frame || pos < m_video_chunk_start)
+        {
+            // Still part of the previous chunk
+            return false;
+        }
+
+        m_video_chunk_started = true;
+    }
+
+    if (m_video_chunk_end != AV_NOPTS_VALUE && frame->key_frame && pos >= m_video_chunk_end)
+    {
+        // Next chunk starts here
+        m_video_chunk_full = true;
+        return false;
+    }
+
+    return true;
+}
+
+int FFmpeg_Transcoder::stitch_video_chunks(bool *done)
+{
+    int ret = 0;
+
+    *done = false;
+
+    if (!m_video_chunk_flushed)
+    {
+        // Our own chunk is complete, flush the encoder as it may have delayed frames.
+        int data_written = 0;
+        do
+        {
+            ret = encode_video_frame(nullptr, &data_written);
+            if (ret == AVERROR_EOF)
+            {
+                // Not an error
+                break;
+            }
+
+            if (ret < 0 && ret != AVERROR(EAGAIN))
+            {
+                Logging::error(destname(), "Could not encode video frame (error '%1').", ffmpeg_geterror(ret).c_str());
+                return ret;
+            }
+        }
+        while (data_written);
+
+        m_video_chunk_flushed = true;
+    }
+
+    while (m_video_chunk_idx < m_video_chunks.size())
+    {
+        std::shared_ptr<SEGMENT> segment = m_video_chunks[m_video_chunk_idx];
+        std::deque<AVPacket*> packets;
+        bool chunk_done;
+        int error;
+
+        ret = 0;
+
+        if (segment->m_state == SEGMENT_QUEUED || m_direct_segment != nullptr)
+        {
+            // No pool thread has picked it up, do it ourselves instead of waiting for one
+            run_segment_direct(segment);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(segment->m_mutex);
+
+            if (segment->m_packets.empty() && segment->m_state != SEGMENT_DONE &&
+                    (m_video_chunk_input_done || m_video_chunk_read_pos > m_video_chunk_mux_pos + VIDEO_CHUNK_AUDIO_LEAD))
+            {
+                // Nothing else to do, audio is ahead
+                segment->m_cond.wait_for(lock, std::chrono::milliseconds(SEGMENT_WAIT_MS));
+            }
+
+            packets.swap(segment->m_packets);
+            segment->m_queued_bytes = 0;
+            chunk_done  = (segment->m_state == SEGMENT_DONE);
+            error       = segment->m_error;
+        }
+
+        // Make room for the encoder
+        segment->m_cond.notify_all();
+
+        if (!packets.empty())
+        {
+            // The stream header (e.g. stsd of MP4/MOV) is written once for the whole file, the chunk must fit in
+            const AVCodecContext *codec_ctx = m_out.m_video.m_codec_ctx;
+            size_t extradata_size = (codec_ctx->extradata != nullptr && codec_ctx->extradata_size > 0) ? static_cast<size_t>(codec_ctx->extradata_size) : 0;
+
+            if (segment->m_extradata.size() != extradata_size || !std::equal(segment->m_extradata.begin(), segment->m_extradata.end(), codec_ctx->extradata))
+            {
+                Logging::error(destname(), "Video chunk %1 has been encoded with different codec parameters and cannot be stitched.", segment->m_no);
+                ret = AVERROR(EINVAL);
+            }
+        }
+
+        while (!packets.empty())
+        {
+            AVPacket *pkt = packets.front();
+            packets.pop_front();
+
+            if (!ret)
+            {
+                pkt->stream_index = m_out.m_video.m_stream_idx;
+
+                fix_video_dts(pkt);
+
+                if (pkt->pts != AV_NOPTS_VALUE)
+                {
+                    m_video_chunk_mux_pos = av_rescale_q(pkt->pts, m_out.m_video.m_stream->time_base, av_get_time_base_q());
+                }
+
+                ret = store_packet(pkt, "video");
+            }
+
+            av_packet_free(&pkt);
+        }
+
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        if (!chunk_done)
+        {
+            // Come back later for more
+            return 0;
+        }
+
+        if (error)
+        {
+            Logging::error(destname(), "Video chunk %1 failed (error '%2').", segment->m_no, ffmpeg_geterror(error).c_str());
+            return error;
+        }
+
+        Logging::debug(destname(), "Video chunk %1 complete.", segment->m_no);
+
+        m_video_chunk_idx++;
     }
 
-    // Process metadata. The decoder will call the encoder to set appropriate
-    // tag values for the output file.
-    ret = process_metadata();
-    if (ret)
+    *done = true;
+
+    return 0;
+}
+
+size_t FFmpeg_Transcoder::range_start() const
+{
+    return m_range_start;
+}
+
+size_t FFmpeg_Transcoder::range_pos() const
+{
+    return m_range_pos;
+}
+
+const SEEK_INDEX & FFmpeg_Transcoder::seek_index() const
+{
+    return m_seek_index;
+}
+
+size_t FFmpeg_Transcoder::resume_point(size_t data_offset, size_t offset, int64_t *pos) const
+{
+    if ((m_out.m_filetype != FILETYPE_WAV && m_out.m_filetype != FILETYPE_AIFF) || m_range_output || m_out.m_audio.m_stream == nullptr || !data_offset || offset <= data_offset)
     {
-        return ret;
+        return 0;
     }
 
-    // Write the header of the output file container.
-    ret = write_output_file_header();
-    if (ret)
+    // Size of one sample for all channels. This is exactly the size PCM data takes in the output file.
+    int block_align = CODECPAR(m_out.m_audio.m_stream)->channels * av_get_bits_per_sample(CODECPAR(m_out.m_audio.m_stream)->codec_id) / 8;
+    int sample_rate = CODECPAR(m_out.m_audio.m_stream)->sample_rate;
+
+    if (block_align <= 0 || sample_rate <= 0)
     {
-        return ret;
+        return 0;
     }
 
-    // Process album arts: copy all from source file to target.
-    ret = process_albumarts();
-    if (ret)
+    int64_t sample_pos = static_cast<int64_t>(offset - data_offset) / block_align;
+
+    if (!sample_pos)
     {
-        return ret;
+        return 0;
     }
 
-    return 0;
+    *pos = av_rescale_q(sample_pos, { 1, sample_rate }, av_get_time_base_q());
+
+    return data_offset + static_cast<size_t>(sample_pos * block_align);
 }
 
 bool FFmpeg_Transcoder::get_output_sample_rate(int input_sample_rate, int max_sample_rate, int *output_sample_rate /*= nullptr*/)
@@ -1406,6 +2529,12 @@ int FFmpeg_Transcoder::add_stream(AVCodecID codec_id)
         output_codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
+    if (m_segment != nullptr && codec_id == AV_CODEC_ID_MP3)
+    {
+        // Frames must not reference data of preceding frames, these are discarded or come from another segment
+        av_dict_set_with_check(&opt, "reservoir", "0", 0, destname());
+    }
+
     if (!av_dict_get(opt, "threads", nullptr, 0))
     {
         Logging::trace(destname(), "Setting threads to auto for codec %1.", get_codec_name(output_codec_ctx->codec_id, false));
@@ -1696,8 +2825,8 @@ int FFmpeg_Transcoder::open_output_filestreams(Buffer *buffer)
     Logging::debug(destname(), "Opening format type '%1'.", m_current_format->desttype().c_str());
 
     // Check if we can copy audio or video.
-    m_copy_audio = can_copy_stream(m_in.m_audio.m_stream);
-    m_copy_video = can_copy_stream(m_in.m_video.m_stream);
+    m_copy_audio = !m_range_output && !m_resume_output && m_segment == nullptr && m_virtualfile->m_type != VIRTUALTYPE_HLS && can_copy_stream(m_in.m_audio.m_stream);   // Range, resume and segment output must decode to be sample exact
+    m_copy_video = m_virtualfile->m_type != VIRTUALTYPE_HLS && can_copy_stream(m_in.m_video.m_stream);      // HLS segments must be cut exactly
 
     // Create a new format context for the output container format.
     if (m_current_format->format_name() != "m4a")
@@ -1812,8 +2941,8 @@ int FFmpeg_Transcoder::open_output_filestreams(Buffer *buffer)
                 1,
                 static_cast<void *>(buffer),
                 nullptr,        // read not required
-                output_write,   // write
-                (m_current_format->audio_codec_id() != AV_CODEC_ID_OPUS) ? seek : nullptr);          // seek
+                (!m_range_output && m_segment == nullptr) ? output_write : nullptr,   // write, header and trailer are discarded in range and segment mode
+                (m_current_format->audio_codec_id() != AV_CODEC_ID_OPUS && !m_range_output && m_segment == nullptr) ? seek : nullptr);          // seek
 
     // Some formats require the time stamps to start at 0, so if there is a difference between
     // the streams we need to drop audio or video until we are in sync.
@@ -2018,7 +3147,7 @@ int FFmpeg_Transcoder::write_output_file_header()
         return ret;
     }
 
-    if (m_out.m_filetype == FILETYPE_WAV)
+    if (m_out.m_filetype == FILETYPE_WAV && !m_range_output)
     {
         // Insert fake WAV header (fill in size fields with estimated values instead of setting to -1)
         AVIOContext * output_io_context = static_cast<AVIOContext *>(m_out.m_format_ctx->pb);
@@ -2048,24 +3177,12 @@ int FFmpeg_Transcoder::write_output_file_header()
 AVFrame *FFmpeg_Transcoder::alloc_picture(AVPixelFormat pix_fmt, int width, int height)
 {
     AVFrame *picture;
-    int ret;
 
-    picture = av_frame_alloc();
+    // Reuse the buffers of frames already freed, same size and format most of the time
+    picture = m_frame_pool.get(pix_fmt, width, height);
     if (picture == nullptr)
-    {
-        return nullptr;
-    }
-
-    picture->format = pix_fmt;
-    picture->width  = width;
-    picture->height = height;
-
-    // allocate the buffers for the frame data
-    ret = av_frame_get_buffer(picture, 32);
-    if (ret < 0)
     {
         Logging::error(destname(), "Could not allocate frame data.");
-        av_frame_free(&picture);
         return nullptr;
     }
 
@@ -2179,6 +3296,36 @@ int FFmpeg_Transcoder::decode_audio_frame(AVPacket *pkt, int *decoded)
 
         *decoded += pkt->size;
 #endif
+        if (m_range_skip_pts != AV_NOPTS_VALUE && data_present && frame->nb_samples)
+        {
+            // First frame after seek in range mode: get to the exact sample position
+            int64_t frame_pts = (frame->pts != AV_NOPTS_VALUE) ? frame->pts : pkt->pts;
+
+            if (frame_pts != AV_NOPTS_VALUE)
+            {
+                AVRational sample_time_base = { 1, m_out.m_audio.m_codec_ctx->sample_rate };
+                int64_t skip = av_rescale_q(m_range_skip_pts - frame_pts, m_in.m_audio.m_stream->time_base, sample_time_base);
+
+                if (skip > 0)
+                {
+                    // Drop samples before seek position
+                    m_range_skip_samples = static_cast<int>(skip);
+                }
+                else if (skip < 0 && m_range_output)
+                {
+                    // Seek went too far, move range start accordingly
+                    m_range_start   += static_cast<size_t>(-skip * m_range_block_align);
+                    m_range_pos     = m_range_start;
+                }
+                else if (skip < 0 && m_resume_output)
+                {
+                    Logging::warning(destname(), "Seek went %1 samples too far, resumed file will be short by these.", -skip);
+                }
+            }
+
+            m_range_skip_pts = AV_NOPTS_VALUE;
+        }
+
         // If there is decoded data, convert and store it
         if (data_present && frame->nb_samples)
         {
@@ -2224,6 +3371,14 @@ int FFmpeg_Transcoder::decode_audio_frame(AVPacket *pkt, int *decoded)
                 {
                     throw ret;
                 }
+
+                if (m_range_skip_samples > 0)
+                {
+                    int skip = std::min(av_audio_fifo_size(m_audio_fifo), m_range_skip_samples);
+
+                    av_audio_fifo_drain(m_audio_fifo, skip);
+                    m_range_skip_samples -= skip;
+                }
                 ret = 0;
             }
             catch (int _ret)
@@ -2350,103 +3505,452 @@ int FFmpeg_Transcoder::decode_video_frame(AVPacket *pkt, int *decoded)
             m_pos = pkt->pos;
         }
 
-        if (data_present && !(frame->flags & AV_FRAME_FLAG_CORRUPT || frame->flags & AV_FRAME_FLAG_DISCARD))
+        if (data_present && outside_hls_segment((frame->pts != AV_NOPTS_VALUE) ? frame->pts : m_pts, m_in.m_video.m_stream->time_base))
+        {
+            // Not part of the HLS segment
+            data_present = 0;
+        }
+
+        if (data_present && !video_chunk_frame(frame))
+        {
+            // Not part of the video chunk encoded by us
+            data_present = 0;
+        }
+
+        if (data_present && !(frame->flags & AV_FRAME_FLAG_CORRUPT || frame->flags & AV_FRAME_FLAG_DISCARD))
+        {
+            if (m_pipeline_running)
+            {
+                // Hand over to filter stage
+                DECODED_FRAME decoded_frame;
+
+                decoded_frame.m_frame   = frame;
+                decoded_frame.m_pts     = m_pts;
+
+                if (!m_filter_queue.push(decoded_frame))
+                {
+                    av_frame_free(&frame);
+                    ret = m_pipeline_error ? static_cast<int>(m_pipeline_error) : AVERROR_EXIT;
+                    return ret;
+                }
+            }
+            else
+            {
+                ret = process_video_frame(frame, m_pts);
+                if (ret < 0)
+                {
+                    return ret;
+                }
+            }
+        }
+        else
+        {
+            // unused frame
+            av_frame_free(&frame);
+        }
+    }
+
+    return ret;
+}
+
+int FFmpeg_Transcoder::process_video_frame(AVFrame *frame, int64_t pts)
+{
+    int ret = 0;
+
+#ifndef USING_LIBAV
+    frame = send_filters(frame, ret);
+    if (ret)
+    {
+        av_frame_free(&frame);
+        return ret;
+    }
+#endif
+
+    if (m_sws_ctx != nullptr)
+    {
+        AVCodecContext *codec_ctx = m_out.m_video.m_codec_ctx;
+
+        AVFrame * tmp_frame = alloc_picture(codec_ctx->pix_fmt, codec_ctx->width, codec_ctx->height);
+        if (tmp_frame == nullptr)
+        {
+            av_frame_free(&frame);
+            return AVERROR(ENOMEM);
+        }
+
+        sws_scale(m_sws_ctx,
+                  static_cast<const uint8_t * const *>(frame->data), frame->linesize,
+                  0, frame->height,
+                  tmp_frame->data, tmp_frame->linesize);
+
+        tmp_frame->pts = frame->pts;
+#ifndef USING_LIBAV
+        tmp_frame->best_effort_timestamp = frame->best_effort_timestamp;
+#endif
+
+        av_frame_free(&frame);
+
+        frame = tmp_frame;
+    }
+
+#ifndef USING_LIBAV
+#if LAVF_DEP_AVSTREAM_CODEC
+    int64_t best_effort_timestamp = frame->best_effort_timestamp;
+#else
+    int64_t best_effort_timestamp = av_frame_get_best_effort_timestamp(frame);
+#endif
+
+    if (best_effort_timestamp != AV_NOPTS_VALUE)
+    {
+        frame->pts = best_effort_timestamp;
+    }
+#endif
+
+    if (frame->pts == AV_NOPTS_VALUE)
+    {
+        frame->pts = pts;
+    }
+
+    if (m_out.m_video.m_stream != nullptr)
+    {
+        // Rescale to our time base, but only if nessessary
+        if (frame->pts != AV_NOPTS_VALUE && (m_in.m_video.m_stream->time_base.den != m_out.m_video.m_stream->time_base.den || m_in.m_video.m_stream->time_base.num != m_out.m_video.m_stream->time_base.num))
+        {
+            frame->pts = av_rescale_q_rnd(frame->pts, m_in.m_video.m_stream->time_base, m_out.m_video.m_stream->time_base, static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+        }
+
+        frame->quality = m_out.m_video.m_codec_ctx->global_quality;
+    }
+
+    // Fix for issue #46: bitrate too high.
+    // Solution found here https://stackoverflow.com/questions/11466184/setting-video-bit-rate-through-ffmpeg-api-is-ignored-for-libx264-codec
+    // This is permanently used in the current ffmpeg.c code (see commit: e3fb9af6f1353f30855eaa1cbd5befaf06e303b8 Date:Wed Jan 22 15:52:10 2020 +0100)
+    frame->pts = av_rescale_q(frame->pts, m_out.m_video.m_stream->time_base, m_out.m_video.m_codec_ctx->time_base);
+
+#ifndef USING_LIBAV
+    frame->pict_type = AV_PICTURE_TYPE_NONE;	// other than AV_PICTURE_TYPE_NONE causes warnings
+#else
+    frame->pict_type = (AVPictureType)0;        // other than 0 causes warnings
+#endif
+
+    if (m_pipeline_running)
+    {
+        // Hand over to encode stage
+        if (!m_encode_queue.push(frame))
+        {
+            av_frame_free(&frame);
+            ret = m_pipeline_error ? static_cast<int>(m_pipeline_error) : AVERROR_EXIT;
+        }
+    }
+    else
+    {
+        m_video_fifo.push(frame);
+    }
+
+
+    return ret;
+}
+
+int FFmpeg_Transcoder::store_packet(AVPacket *pkt, const char *type)
+{
+    if (m_segment != nullptr && m_segment->m_video)
+    {
+        // Encoding a video chunk, will be stitched by the transcoder writing the file
+        return store_segment_packet(pkt);
+    }
+
+    if (m_range_output)
+    {
+        // PCM data goes straight to its position in the buffer
+        size_t size = static_cast<size_t>(pkt->size);
+
+        if (m_range_buffer->write(pkt->data, size, m_range_pos) != size)
+        {
+            int ret = AVERROR(errno);
+            Logging::error(destname(), "Could not write %1 frame at offset %2 (error '%3').", type, m_range_pos, ffmpeg_geterror(ret).c_str());
+            return ret;
+        }
+
+        m_range_pos += size;
+
+        return 0;
+    }
+
+#if LAVC_NEW_PACKET_INTERFACE
+    if (m_pipeline_running)
+    {
+        // Hand over to mux stage. Packet data may be reused by the caller, so make a copy.
+        AVPacket *tmp_pkt = av_packet_clone(pkt);
+        if (tmp_pkt == nullptr)
+        {
+            int ret = AVERROR(ENOMEM);
+            Logging::error(destname(), "Could not write %1 frame (error '%2').", type, ffmpeg_geterror(ret).c_str());
+            return ret;
+        }
+
+        if (!m_mux_queue.push(tmp_pkt))
+        {
+            av_packet_free(&tmp_pkt);
+            return (m_pipeline_error ? static_cast<int>(m_pipeline_error) : AVERROR_EXIT);
+        }
+
+        return 0;
+    }
+#endif
+
+    return mux_packet(pkt, type);
+}
+
+int FFmpeg_Transcoder::mux_packet(AVPacket *pkt, const char *type)
+{
+    // Packet data starts about here. Muxers that hold packets back (e.g. fragmented MP4) will write it a bit later.
+    int64_t offset      = (m_out.m_format_ctx->pb != nullptr) ? avio_tell(m_out.m_format_ctx->pb) : -1;
+    int stream_index    = pkt->stream_index;
+    int64_t pts         = pkt->pts;
+    bool keyframe       = (pkt->flags & AV_PKT_FLAG_KEY) && stream_index == m_out.m_video.m_stream_idx;
+
+    int ret = av_write_frame(m_out.m_format_ctx, pkt);
+
+    if (ret < 0)
+    {
+        Logging::error(destname(), "Could not write %1 frame (error '%2').", type, ffmpeg_geterror(ret).c_str());
+        return ret;
+    }
+
+    // Index the main stream only: video if present, audio otherwise.
+    if (offset >= 0 && pts != AV_NOPTS_VALUE && stream_index == (m_out.m_video.m_stream_idx > -1 ? m_out.m_video.m_stream_idx : m_out.m_audio.m_stream_idx))
+    {
+        // Output pts, counted from 0 like the source positions minus start time
+        int64_t pos = av_rescale_q(pts, m_out.m_format_ctx->streams[stream_index]->time_base, av_get_time_base_q());
+
+        if (keyframe || m_seek_index.empty() || pos - m_seek_index.back().m_pos >= SEEK_INDEX_INTERVAL)
+        {
+            SEEK_INDEX_ENTRY entry;
+
+            entry.m_offset      = static_cast<uint64_t>(offset);
+            entry.m_pos         = pos;
+            entry.m_flags       = keyframe ? SEEK_INDEX_KEYFRAME : 0;
+            entry.m_reserved    = 0;
+
+            m_seek_index.push_back(entry);
+        }
+    }
+
+    return ret;
+}
+
+int FFmpeg_Transcoder::start_pipeline()
+{
+#if LAVC_NEW_PACKET_INTERFACE
+    if (m_pipeline_running)
+    {
+        return 0;
+    }
+
+    Logging::debug(destname(), "Starting pipelined transcoding: Filter, encoder and muxer run in separate threads.");
+
+    m_pipeline_error = 0;
+
+    m_filter_queue.reset();
+    m_encode_queue.reset();
+    m_mux_queue.reset();
+
+    m_pipeline_running = true;
+
+    m_mux_thread    = std::thread(&FFmpeg_Transcoder::mux_thread_starter, std::ref(*this));
+    m_encode_thread = std::thread(&FFmpeg_Transcoder::encode_thread_starter, std::ref(*this));
+    m_filter_thread = std::thread(&FFmpeg_Transcoder::filter_thread_starter, std::ref(*this));
+#else
+    Logging::warning(destname(), "Pipelined transcoding requires a newer FFmpeg version. Using single threaded transcoding.");
+#endif
+    return 0;
+}
+
+int FFmpeg_Transcoder::stop_pipeline(bool drain)
+{
+    if (!m_pipeline_running)
+    {
+        return 0;
+    }
+
+    if (!drain)
+    {
+        m_filter_queue.abort();
+        m_encode_queue.abort();
+        m_mux_queue.abort();
+    }
+
+    // Stop the stages one by one from start to end, so that each stage
+    // can process everything its predecessor has left over.
+    m_filter_queue.close();
+    if (m_filter_thread.joinable())
+    {
+        m_filter_thread.join();
+    }
+
+    m_encode_queue.close();
+    if (m_encode_thread.joinable())
+    {
+        m_encode_thread.join();
+    }
+
+    m_mux_queue.close();
+    if (m_mux_thread.joinable())
+    {
+        m_mux_thread.join();
+    }
+
+    m_pipeline_running = false;
+
+    // Free anything left over after an abort
+    size_t frames_left = 0;
+    size_t packets_left = 0;
+    {
+        DECODED_FRAME decoded_frame;
+        while (m_filter_queue.try_pop(&decoded_frame))
+        {
+            av_frame_free(&decoded_frame.m_frame);
+            frames_left++;
+        }
+    }
+
+    {
+        AVFrame *frame;
+        while (m_encode_queue.try_pop(&frame))
+        {
+            av_frame_free(&frame);
+            frames_left++;
+        }
+    }
+
+#if LAVC_NEW_PACKET_INTERFACE
+    {
+        AVPacket *pkt;
+        while (m_mux_queue.try_pop(&pkt))
         {
-#ifndef USING_LIBAV
-            frame = send_filters(frame, ret);
-            if (ret)
-            {
-                return ret;
-            }
+            av_packet_free(&pkt);
+            packets_left++;
+        }
+    }
 #endif
 
-            if (m_sws_ctx != nullptr)
-            {
-                AVCodecContext *codec_ctx = m_out.m_video.m_codec_ctx;
+    if (drain && (frames_left || packets_left))
+    {
+        Logging::warning(destname(), "%1 video frames and %2 packets left in pipeline and not written to target file!", frames_left, packets_left);
+    }
 
-                AVFrame * tmp_frame = alloc_picture(codec_ctx->pix_fmt, codec_ctx->width, codec_ctx->height);
-                if (tmp_frame == nullptr)
-                {
-                    return AVERROR(ENOMEM);
-                }
+    Logging::debug(destname(), "Pipelined transcoding stopped.");
 
-                sws_scale(m_sws_ctx,
-                          static_cast<const uint8_t * const *>(frame->data), frame->linesize,
-                          0, frame->height,
-                          tmp_frame->data, tmp_frame->linesize);
+    return m_pipeline_error;
+}
 
-                tmp_frame->pts = frame->pts;
-#ifndef USING_LIBAV
-                tmp_frame->best_effort_timestamp = frame->best_effort_timestamp;
-#endif
+void FFmpeg_Transcoder::pipeline_error(int ret)
+{
+    int expected = 0;
 
-                av_frame_free(&frame);
+    // Only keep the first error, it is most likely the cause for the others.
+    m_pipeline_error.compare_exchange_strong(expected, ret);
 
-                frame = tmp_frame;
-            }
+    m_filter_queue.abort();
+    m_encode_queue.abort();
+    m_mux_queue.abort();
+}
 
-#ifndef USING_LIBAV
-#if LAVF_DEP_AVSTREAM_CODEC
-            int64_t best_effort_timestamp = frame->best_effort_timestamp;
-#else
-            int64_t best_effort_timestamp = av_frame_get_best_effort_timestamp(frame);
-#endif
+void FFmpeg_Transcoder::filter_thread_starter(FFmpeg_Transcoder & transcoder)
+{
+    transcoder.filter_thread();
+}
 
-            if (best_effort_timestamp != AV_NOPTS_VALUE)
-            {
-                frame->pts = best_effort_timestamp;
-            }
-#endif
+void FFmpeg_Transcoder::encode_thread_starter(FFmpeg_Transcoder & transcoder)
+{
+    transcoder.encode_thread();
+}
 
-            if (frame->pts == AV_NOPTS_VALUE)
-            {
-                frame->pts = m_pts;
-            }
+void FFmpeg_Transcoder::mux_thread_starter(FFmpeg_Transcoder & transcoder)
+{
+    transcoder.mux_thread();
+}
 
-            if (m_out.m_video.m_stream != nullptr)
-            {
-                // Rescale to our time base, but only if nessessary
-                if (frame->pts != AV_NOPTS_VALUE && (m_in.m_video.m_stream->time_base.den != m_out.m_video.m_stream->time_base.den || m_in.m_video.m_stream->time_base.num != m_out.m_video.m_stream->time_base.num))
-                {
-                    frame->pts = av_rescale_q_rnd(frame->pts, m_in.m_video.m_stream->time_base, m_out.m_video.m_stream->time_base, static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-                }
+void FFmpeg_Transcoder::filter_thread()
+{
+    DECODED_FRAME decoded_frame;
 
-                frame->quality = m_out.m_video.m_codec_ctx->global_quality;
-            }
+    while (m_filter_queue.pop(&decoded_frame))
+    {
+        int ret = process_video_frame(decoded_frame.m_frame, decoded_frame.m_pts);
+        if (ret < 0)
+        {
+            pipeline_error(ret);
+            break;
+        }
+    }
+}
 
-			// Fix for issue #46: bitrate too high.
-            // Solution found here https://stackoverflow.com/questions/11466184/setting-video-bit-rate-through-ffmpeg-api-is-ignored-for-libx264-codec
-			// This is permanently used in the current ffmpeg.c code (see commit: e3fb9af6f1353f30855eaa1cbd5befaf06e303b8 Date:Wed Jan 22 15:52:10 2020 +0100)
-            frame->pts = av_rescale_q(frame->pts, m_out.m_video.m_stream->time_base, m_out.m_video.m_codec_ctx->time_base);
+void FFmpeg_Transcoder::encode_thread()
+{
+    AVFrame *frame;
+    int ret = 0;
 
-#ifndef USING_LIBAV
-            frame->pict_type = AV_PICTURE_TYPE_NONE;	// other than AV_PICTURE_TYPE_NONE causes warnings
-            m_video_fifo.push(frame);
-#else
-            frame->pict_type = (AVPictureType)0;        // other than 0 causes warnings
-            m_video_fifo.push(frame);
-#endif
-        }
-        else
+    while (m_encode_queue.pop(&frame))
+    {
+        int data_written = 0;
+
+        frame->key_frame = 0;    // Leave that decision to encoder
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+
+        ret = encode_video_frame(frame, &data_written);
+
+        av_frame_free(&frame);
+
+        if (ret < 0 && ret != AVERROR(EAGAIN))
         {
-            // unused frame
-            av_frame_free(&frame);
+            pipeline_error(ret);
+            return;
         }
     }
 
-    return ret;
+    if (m_encode_queue.aborted())
+    {
+        return;
+    }
+
+    // Queue closed: flush the encoder as it may have delayed frames.
+    int data_written = 0;
+    do
+    {
+        ret = encode_video_frame(nullptr, &data_written);
+        if (ret == AVERROR_EOF)
+        {
+            // Not an error
+            break;
+        }
+        if (ret < 0 && ret != AVERROR(EAGAIN))
+        {
+            Logging::error(destname(), "Could not encode video frame (error '%1').", ffmpeg_geterror(ret).c_str());
+            pipeline_error(ret);
+            break;
+        }
+    }
+    while (data_written);
 }
 
-int FFmpeg_Transcoder::store_packet(AVPacket *pkt, const char *type)
+void FFmpeg_Transcoder::mux_thread()
 {
-    int ret = av_write_frame(m_out.m_format_ctx, pkt);
+#if LAVC_NEW_PACKET_INTERFACE
+    AVPacket *pkt;
 
-    if (ret < 0)
+    while (m_mux_queue.pop(&pkt))
     {
-        Logging::error(destname(), "Could not write %1 frame (error '%2').", type, ffmpeg_geterror(ret).c_str());
-    }
+        int ret = mux_packet(pkt, pkt->stream_index == m_out.m_video.m_stream_idx ? "video" : "audio");
 
-    return ret;
+        av_packet_free(&pkt);
+
+        if (ret < 0)
+        {
+            pipeline_error(ret);
+            break;
+        }
+    }
+#endif
 }
 
 int FFmpeg_Transcoder::decode_frame(AVPacket *pkt)
@@ -2828,7 +4332,42 @@ int FFmpeg_Transcoder::read_decode_convert_and_store(int *finished)
             }
         }
 
-        if (!*finished)
+        bool skip = false;
+
+        if (!*finished && m_virtualfile->m_type == VIRTUALTYPE_HLS)
+        {
+            // Stop at the end of the HLS segment
+            skip = past_hls_segment(&pkt, finished);
+        }
+
+        if (!*finished && m_segment != nullptr && m_segment->m_video)
+        {
+            // Encoding a video chunk: only video is required, stop at the end of the chunk
+            if (m_video_chunk_full)
+            {
+                *finished = 1;
+            }
+            skip = (pkt.stream_index != m_in.m_video.m_stream_idx);
+        }
+        else if (!*finished && m_video_chunk_full && !m_video_chunks.empty())
+        {
+            // Video has been taken care of, keep track how far audio got
+            if (pkt.stream_index == m_in.m_video.m_stream_idx)
+            {
+                skip = true;
+            }
+            else if (pkt.dts != AV_NOPTS_VALUE && pkt.stream_index >= 0 && pkt.stream_index < static_cast<int>(m_in.m_format_ctx->nb_streams))
+            {
+                m_video_chunk_read_pos = av_rescale_q(pkt.dts, m_in.m_format_ctx->streams[pkt.stream_index]->time_base, av_get_time_base_q());
+
+                if (m_in.m_format_ctx->start_time != AV_NOPTS_VALUE)
+                {
+                    m_video_chunk_read_pos -= m_in.m_format_ctx->start_time;
+                }
+            }
+        }
+
+        if (!*finished && !skip)
         {
             // Decode one packet, at least with the old API (!LAV_NEW_PACKET_INTERFACE)
             // it seems a packet can contain more than one frame so loop around it
@@ -2840,7 +4379,7 @@ int FFmpeg_Transcoder::read_decode_convert_and_store(int *finished)
                 throw ret;
             }
         }
-        else
+        else if (*finished)
         {
             // Flush cached frames, ignoring any errors
             flush_frames_all(true);
@@ -2988,16 +4527,36 @@ int FFmpeg_Transcoder::encode_audio_frame(const AVFrame *frame, int *data_presen
         // Write one audio frame from the temporary packet to the output buffer.
         if (*data_present)
         {
-            pkt.stream_index = m_out.m_audio.m_stream_idx;
-
-            produce_audio_dts(&pkt);
+            int64_t packet_no = m_packet_no++;
 
-            ret = store_packet(&pkt, "audio");
-            if (ret < 0)
+            if (packet_no >= m_end_packet)
             {
-                av_packet_unref(&pkt);
-                return ret;
+                // Belongs to the next segment
+                m_segment_full = true;
+            }
+            else if (packet_no >= m_first_packet)
+            {
+                pkt.stream_index = m_out.m_audio.m_stream_idx;
+
+                if (m_segment != nullptr)
+                {
+                    // Hand packet over to the transcoder writing the file
+                    ret = store_segment_packet(&pkt);
+                }
+                else
+                {
+                    produce_audio_dts(&pkt);
+
+                    ret = store_packet(&pkt, "audio");
+                }
+
+                if (ret < 0)
+                {
+                    av_packet_unref(&pkt);
+                    return ret;
+                }
             }
+            // else: Pre-roll packet, discard
         }
 
         av_packet_unref(&pkt);
@@ -3097,42 +4656,7 @@ int FFmpeg_Transcoder::encode_video_frame(const AVFrame *frame, int *data_presen
                     pkt.dts -=  m_out.m_video_start_pts;
                 }
 
-                if (!(m_out.m_format_ctx->oformat->flags & AVFMT_NOTIMESTAMPS))
-                {
-                    if (pkt.dts != AV_NOPTS_VALUE &&
-                            pkt.pts != AV_NOPTS_VALUE &&
-                            pkt.dts > pkt.pts &&
-                            m_out.m_last_mux_dts != AV_NOPTS_VALUE)
-                    {
-
-                        Logging::warning(destname(), "Invalid DTS: %1 PTS: %2 in video output, replacing by guess.", pkt.dts, pkt.pts);
-
-                        pkt.pts =
-                                pkt.dts = pkt.pts + pkt.dts + m_out.m_last_mux_dts + 1
-                                - FFMIN3(pkt.pts, pkt.dts, m_out.m_last_mux_dts + 1)
-                                - FFMAX3(pkt.pts, pkt.dts, m_out.m_last_mux_dts + 1);
-                    }
-
-                    if (pkt.dts != AV_NOPTS_VALUE && m_out.m_last_mux_dts != AV_NOPTS_VALUE)
-                    {
-                        int64_t max = m_out.m_last_mux_dts + !(m_out.m_format_ctx->oformat->flags & AVFMT_TS_NONSTRICT);
-                        // AVRational avg_frame_rate = { m_out.m_video.m_stream->avg_frame_rate.den, m_out.m_video.m_stream->avg_frame_rate.num };
-                        // int64_t max = m_out.m_last_mux_dts + av_rescale_q(1, avg_frame_rate, m_out.m_video.m_stream->time_base);
-
-                        if (pkt.dts < max)
-                        {
-                            Logging::trace(destname(), "Non-monotonous DTS in video output stream; previous: %1, current: %2; changing to %3. This may result in incorrect timestamps in the output.", m_out.m_last_mux_dts, pkt.dts, max);
-
-                            if (pkt.pts >= pkt.dts)
-                            {
-                                pkt.pts = FFMAX(pkt.pts, max);
-                            }
-                            pkt.dts = max;
-                        }
-                    }
-                }
-
-                m_out.m_last_mux_dts = pkt.dts;
+                fix_video_dts(&pkt);
 
 #ifndef USING_LIBAV
                 if (frame != nullptr && !pkt.duration)
@@ -3161,6 +4685,46 @@ int FFmpeg_Transcoder::encode_video_frame(const AVFrame *frame, int *data_presen
     return ret;
 }
 
+void FFmpeg_Transcoder::fix_video_dts(AVPacket *pkt)
+{
+    if (!(m_out.m_format_ctx->oformat->flags & AVFMT_NOTIMESTAMPS))
+    {
+        if (pkt->dts != AV_NOPTS_VALUE &&
+                pkt->pts != AV_NOPTS_VALUE &&
+                pkt->dts > pkt->pts &&
+                m_out.m_last_mux_dts != AV_NOPTS_VALUE)
+        {
+
+            Logging::warning(destname(), "Invalid DTS: %1 PTS: %2 in video output, replacing by guess.", pkt->dts, pkt->pts);
+
+            pkt->pts =
+                    pkt->dts = pkt->pts + pkt->dts + m_out.m_last_mux_dts + 1
+                    - FFMIN3(pkt->pts, pkt->dts, m_out.m_last_mux_dts + 1)
+                    - FFMAX3(pkt->pts, pkt->dts, m_out.m_last_mux_dts + 1);
+        }
+
+        if (pkt->dts != AV_NOPTS_VALUE && m_out.m_last_mux_dts != AV_NOPTS_VALUE)
+        {
+            int64_t max = m_out.m_last_mux_dts + !(m_out.m_format_ctx->oformat->flags & AVFMT_TS_NONSTRICT);
+            // AVRational avg_frame_rate = { m_out.m_video.m_stream->avg_frame_rate.den, m_out.m_video.m_stream->avg_frame_rate.num };
+            // int64_t max = m_out.m_last_mux_dts + av_rescale_q(1, avg_frame_rate, m_out.m_video.m_stream->time_base);
+
+            if (pkt->dts < max)
+            {
+                Logging::trace(destname(), "Non-monotonous DTS in video output stream; previous: %1, current: %2; changing to %3. This may result in incorrect timestamps in the output.", m_out.m_last_mux_dts, pkt->dts, max);
+
+                if (pkt->pts >= pkt->dts)
+                {
+                    pkt->pts = FFMAX(pkt->pts, max);
+                }
+                pkt->dts = max;
+            }
+        }
+    }
+
+    m_out.m_last_mux_dts = pkt->dts;
+}
+
 int FFmpeg_Transcoder::load_encode_and_write(int frame_size)
 {
     // Temporary storage of the output samples of the frame written to the file.
@@ -3345,7 +4909,64 @@ int FFmpeg_Transcoder::process_single_fr(int &status)
 
     try
     {
-        if (!m_copy_audio && m_out.m_audio.m_stream_idx > -1)
+        if (m_pipeline_error)
+        {
+            // One of the pipeline stages failed
+            throw static_cast<int>(m_pipeline_error);
+        }
+
+        if (m_segment_full)
+        {
+            if (m_segment != nullptr)
+            {
+                // Segment has been transcoded
+                status = 1;
+                return 0;
+            }
+
+            // Our own part is done, now collect the segments transcoded in parallel
+            ret = stitch_segments(&finished);
+            if (ret < 0)
+            {
+                throw ret;
+            }
+
+            if (finished)
+            {
+                status = 1;
+            }
+            return 0;
+        }
+
+        if (m_video_chunk_full && !m_video_chunks.empty())
+        {
+            // Our own part of the video is done, now collect the chunks encoded in parallel
+            bool done = false;
+
+            ret = stitch_video_chunks(&done);
+            if (ret < 0)
+            {
+                throw ret;
+            }
+
+            if (m_video_chunk_input_done)
+            {
+                // Audio is complete
+                if (done)
+                {
+                    status = 1;
+                }
+                return 0;
+            }
+
+            if (!done && m_video_chunk_read_pos > m_video_chunk_mux_pos + VIDEO_CHUNK_AUDIO_LEAD)
+            {
+                // Let the video catch up first, so audio and video remain interleaved
+                return 0;
+            }
+        }
+
+        if (!m_copy_audio && m_out.m_audio.m_stream_idx > -1 && (m_segment == nullptr || !m_segment->m_video))
         {
             int output_frame_size;
 
@@ -3390,7 +5011,7 @@ int FFmpeg_Transcoder::process_single_fr(int &status)
             // At the end of the file, we pass the remaining samples to
             // the encoder.
 
-            while (av_audio_fifo_size(m_audio_fifo) >= output_frame_size || (finished && av_audio_fifo_size(m_audio_fifo) > 0))
+            while ((av_audio_fifo_size(m_audio_fifo) >= output_frame_size || (finished && av_audio_fifo_size(m_audio_fifo) > 0)) && !m_segment_full)
             {
                 // Take one frame worth of audio samples from the FIFO buffer,
                 // encode it and write it to the output file.
@@ -3437,7 +5058,17 @@ int FFmpeg_Transcoder::process_single_fr(int &status)
                     while (data_written);
                 }
 
-                status = 1;
+                if (m_video_chunk_idx < m_video_chunks.size())
+                {
+                    // Video chunks still need to be stitched
+                    m_video_chunk_input_done    = true;
+                    m_video_chunk_full          = true;
+                }
+                else if (!m_segment_full || m_segment != nullptr)
+                {
+                    status = 1;
+                }
+                // else: Parallel segments still need to be stitched
             }
         }
         else
@@ -3452,7 +5083,16 @@ int FFmpeg_Transcoder::process_single_fr(int &status)
 
             if (finished)
             {
-                status = 1;
+                if (m_video_chunk_idx < m_video_chunks.size())
+                {
+                    // Video chunks still need to be stitched
+                    m_video_chunk_input_done    = true;
+                    m_video_chunk_full          = true;
+                }
+                else
+                {
+                    status = 1;
+                }
             }
         }
 
@@ -3490,7 +5130,16 @@ int FFmpeg_Transcoder::process_single_fr(int &status)
 
             if (finished)
             {
-                if (m_out.m_video.m_codec_ctx != nullptr)
+                if (m_pipeline_running)
+                {
+                    // Let all stages finish their work, the encoder will be flushed by the encode stage.
+                    ret = stop_pipeline(true);
+                    if (ret < 0)
+                    {
+                        throw ret;
+                    }
+                }
+                else if (m_out.m_video.m_codec_ctx != nullptr)
                 {
                     // Flush the encoder as it may have delayed frames.
                     int data_written = 0;
@@ -3518,7 +5167,11 @@ int FFmpeg_Transcoder::process_single_fr(int &status)
                     while (data_written);
                 }
 
-                status = 1;
+                if (!m_video_chunk_input_done)
+                {
+                    status = 1;
+                }
+                // else: Video chunks still need to be stitched
             }
         }
     }
@@ -3728,74 +5381,106 @@ bool FFmpeg_Transcoder::video_size(size_t *filesize, AVCodecID codec_id, BITRATE
 
 size_t FFmpeg_Transcoder::calculate_predicted_filesize() const
 {
-    if (m_in.m_format_ctx == nullptr)
+    if (m_current_format == nullptr)
     {
+        // Should ever happen, but better check this to avoid crashes.
         return 0;
     }
 
-    if (m_current_format == nullptr)
+    PROBE_INFO probe_info;
+
+    if (!get_probe_info(&probe_info))
     {
-        // Should ever happen, but better check this to avoid crashes.
         return 0;
     }
 
-    size_t filesize = 0;
+    if (m_virtualfile->m_type == VIRTUALTYPE_HLS)
+    {
+        // Only a segment of the source file
+        probe_info.m_duration = m_virtualfile->m_duration;
+    }
+
+    return calculate_predicted_filesize(probe_info, m_current_format, filename());
+}
+
+bool FFmpeg_Transcoder::get_probe_info(PROBE_INFO *probe_info) const
+{
+    if (m_in.m_format_ctx == nullptr)
+    {
+        return false;
+    }
 
-    int64_t duration = m_in.m_format_ctx->duration != AV_NOPTS_VALUE ? m_in.m_format_ctx->duration : 0;
-    BITRATE input_audio_bit_rate = 0;
-    int input_sample_rate = 0;
-    BITRATE input_video_bit_rate = 0;
+    probe_info->m_duration          = m_in.m_format_ctx->duration != AV_NOPTS_VALUE ? m_in.m_format_ctx->duration : 0;
+    probe_info->m_audiobitrate      = 0;
+    probe_info->m_audiochannels     = 0;
+    probe_info->m_audiosamplerate   = 0;
+    probe_info->m_videobitrate      = 0;
+    probe_info->m_videowidth        = 0;
+    probe_info->m_videoheight       = 0;
+    probe_info->m_interlaced        = false;
+    probe_info->m_framerate_num     = 0;
+    probe_info->m_framerate_den     = 1;
 
     if (m_fileio->duration() != AV_NOPTS_VALUE)
     {
-        duration = m_fileio->duration();
+        probe_info->m_duration = m_fileio->duration();
     }
 
     if (m_in.m_audio.m_stream_idx > -1)
     {
-        input_sample_rate = CODECPAR(m_in.m_audio.m_stream)->sample_rate;
-        input_audio_bit_rate = (CODECPAR(m_in.m_audio.m_stream)->bit_rate != 0) ? CODECPAR(m_in.m_audio.m_stream)->bit_rate : m_in.m_format_ctx->bit_rate;
+        probe_info->m_audiosamplerate   = CODECPAR(m_in.m_audio.m_stream)->sample_rate;
+        probe_info->m_audiobitrate      = (CODECPAR(m_in.m_audio.m_stream)->bit_rate != 0) ? CODECPAR(m_in.m_audio.m_stream)->bit_rate : m_in.m_format_ctx->bit_rate;
+        probe_info->m_audiochannels     = m_in.m_audio.m_codec_ctx->channels;
     }
 
-    if (m_in.m_video.m_stream_idx > -1)
+    if (m_in.m_video.m_stream_idx > -1 && m_is_video)
     {
-        input_video_bit_rate = (CODECPAR(m_in.m_video.m_stream)->bit_rate != 0) ? CODECPAR(m_in.m_video.m_stream)->bit_rate : m_in.m_format_ctx->bit_rate;
+        probe_info->m_videobitrate      = (CODECPAR(m_in.m_video.m_stream)->bit_rate != 0) ? CODECPAR(m_in.m_video.m_stream)->bit_rate : m_in.m_format_ctx->bit_rate;
+        probe_info->m_videowidth        = CODECPAR(m_in.m_video.m_stream)->width;
+        probe_info->m_videoheight       = CODECPAR(m_in.m_video.m_stream)->height;
+#ifndef USING_LIBAV
+        probe_info->m_interlaced        = (CODECPAR(m_in.m_video.m_stream)->field_order != AV_FIELD_PROGRESSIVE);
+#endif // !USING_LIBAV
+#if LAVF_DEP_AVSTREAM_CODEC
+        probe_info->m_framerate_num     = m_in.m_video.m_stream->avg_frame_rate.num;
+        probe_info->m_framerate_den     = m_in.m_video.m_stream->avg_frame_rate.den;
+#else
+        probe_info->m_framerate_num     = m_in.m_video.m_stream->codec->framerate.num;
+        probe_info->m_framerate_den     = m_in.m_video.m_stream->codec->framerate.den;
+#endif
     }
+    // else      /** @todo: Feature #2260: Add picture size */
+    // {
+    // }
 
-    if (input_audio_bit_rate)
-    {
-        int channels = m_in.m_audio.m_codec_ctx->channels;
+    return true;
+}
+
+size_t FFmpeg_Transcoder::calculate_predicted_filesize(const PROBE_INFO & probe_info, const FFmpegfs_Format *current_format, const char *filename)
+{
+    size_t filesize = 0;
 
-        if (!audio_size(&filesize, m_current_format->audio_codec_id(), input_audio_bit_rate, duration, channels, input_sample_rate))
+    if (probe_info.m_audiobitrate)
+    {
+        if (!audio_size(&filesize, current_format->audio_codec_id(), probe_info.m_audiobitrate, probe_info.m_duration, probe_info.m_audiochannels, probe_info.m_audiosamplerate))
         {
-            Logging::warning(filename(), "Unsupported audio codec '%1' for format %2.", get_codec_name(m_current_format->audio_codec_id(), 0), m_current_format->desttype().c_str());
+            Logging::warning(filename, "Unsupported audio codec '%1' for format %2.", get_codec_name(current_format->audio_codec_id(), 0), current_format->desttype().c_str());
         }
     }
 
-    if (input_video_bit_rate)
+    if (probe_info.m_videobitrate)
     {
-        if (m_is_video)
-        {
-            int width = CODECPAR(m_in.m_video.m_stream)->width;
-            int height = CODECPAR(m_in.m_video.m_stream)->height;
 #ifdef USING_LIBAV
-            int interleaved = 0;    /** @todo: Check source if interlaced and do interlace if required */
+        int interleaved = 0;    /** @todo: Check source if interlaced and do interlace if required */
 #else
-            int interleaved = params.m_deinterlace ? 0 : (CODECPAR(m_in.m_video.m_stream)->field_order != AV_FIELD_PROGRESSIVE);    // Deinterlace only if source is interlaced
+        int interleaved = params.m_deinterlace ? 0 : probe_info.m_interlaced;    // Deinterlace only if source is interlaced
 #endif // !USING_LIBAV
-#if LAVF_DEP_AVSTREAM_CODEC
-            AVRational framerate = m_in.m_video.m_stream->avg_frame_rate;
-#else
-            AVRational framerate = m_in.m_video.m_stream->codec->framerate;
-#endif
-            if (!video_size(&filesize, m_current_format->video_codec_id(), input_video_bit_rate, duration, width, height, interleaved, framerate))
-            {
-                Logging::warning(filename(), "Unsupported video codec '%1' for format %2.", get_codec_name(m_current_format->video_codec_id(), 0), m_current_format->desttype().c_str());
-            }
+        AVRational framerate = { probe_info.m_framerate_num, probe_info.m_framerate_den };
+
+        if (!video_size(&filesize, current_format->video_codec_id(), probe_info.m_videobitrate, probe_info.m_duration, probe_info.m_videowidth, probe_info.m_videoheight, interleaved, framerate))
+        {
+            Logging::warning(filename, "Unsupported video codec '%1' for format %2.", get_codec_name(current_format->video_codec_id(), 0), current_format->desttype().c_str());
         }
-        // else      /** @todo: Feature #2260: Add picture size */
-        // {
-        // }
     }
 
     return filesize;
@@ -3981,6 +5666,9 @@ bool FFmpeg_Transcoder::close_output_file()
         closed = true;
     }
 
+    // Frames still in use keep their buffers
+    m_frame_pool.clear();
+
     // Close output file
 #if !LAVF_DEP_AVSTREAM_CODEC
     if (m_out.m_audio.m_codec_ctx)
@@ -4140,6 +5828,12 @@ void FFmpeg_Transcoder::close()
 {
     bool closed = false;
 
+    // Stop pipeline threads, if still running
+    stop_pipeline(false);
+
+    // Abort parallel segments, if any
+    stop_segments();
+
     // Close input file
     closed |= close_input_file();
 
@@ -40,10 +40,18 @@
 #include "ffmpegfs.h"
 #include "fileio.h"
 #include "ffmpeg_profiles.h"
+#include "bounded_queue.h"
+#include "frame_pool.h"
+#include "seek_index.h"
 
 #include <queue>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
 
 class Buffer;
+struct PROBE_INFO;
 #if LAVR_DEPRECATE
 struct SwrContext;
 #else
@@ -144,6 +152,61 @@ public:
         ID3v1                   m_id3v1;                /**< @brief mp3 only, can be referenced at any time */
     };
 
+    /**
+     * @brief Segment state
+     */
+    typedef enum SEGMENT_STATE
+    {
+        SEGMENT_QUEUED,                                 /**< @brief Waiting for a pool thread */
+        SEGMENT_RUNNING,                                /**< @brief Being transcoded */
+        SEGMENT_DONE                                    /**< @brief Transcoding ended, see m_error */
+    } SEGMENT_STATE;
+
+    /**
+     * @brief Part of an audio file or of the video stream of a video file transcoded in parallel to the others.
+     *
+     * Shared by the transcoder that stitches the segments together and the one
+     * that produces the packets. Packets are kept in memory until stitched. If
+     * m_max_bytes is set, the producer waits while that much is queued.
+     */
+    struct SEGMENT
+    {
+        SEGMENT() :
+            m_virtualfile(nullptr),
+            m_no(0),
+            m_first_packet(0),
+            m_end_packet(0),
+            m_preroll(0),
+            m_video(false),
+            m_start_pos(0),
+            m_end_pos(AV_NOPTS_VALUE),
+            m_max_bytes(0),
+            m_queued_bytes(0),
+            m_state(SEGMENT_QUEUED),
+            m_abort(false),
+            m_error(0)
+        {}
+
+        LPVIRTUALFILE           m_virtualfile;          /**< @brief File to transcode */
+        int                     m_no;                   /**< @brief Segment number, for logging */
+        int64_t                 m_first_packet;         /**< @brief Number of first output packet belonging to this segment */
+        int64_t                 m_end_packet;           /**< @brief Number of first output packet belonging to the next segment, INT64_MAX for last segment */
+        int64_t                 m_preroll;              /**< @brief Packets to encode and discard before first packet to get encoder into the same state */
+        bool                    m_video;                /**< @brief true for a chunk of the video stream, false for a segment of an audio file */
+        int64_t                 m_start_pos;            /**< @brief Video only: Chunk starts at the first key frame at or after this position, AV_TIME_BASE units */
+        int64_t                 m_end_pos;              /**< @brief Video only: Next chunk starts at the first key frame at or after this position, AV_NOPTS_VALUE for last chunk */
+        std::vector<uint8_t>    m_extradata;            /**< @brief Video only: Extradata of the chunk's encoder, must be the same as the one in the file header */
+
+        std::mutex              m_mutex;                /**< @brief Access mutex for packets and error */
+        std::condition_variable m_cond;                 /**< @brief Signalled when a packet was added or taken off, or the segment is done or aborted */
+        std::deque<AVPacket*>   m_packets;              /**< @brief Encoded packets not yet stitched */
+        size_t                  m_max_bytes;            /**< @brief Producer waits while this many bytes are queued, 0 for no limit */
+        size_t                  m_queued_bytes;         /**< @brief Size of packets in m_packets */
+        std::atomic_int         m_state;                /**< @brief Current state, see SEGMENT_STATE */
+        std::atomic_bool        m_abort;                /**< @brief Set to abort transcoding, e.g. if output file is closed */
+        int                     m_error;                /**< @brief 0 if segment was completely transcoded, negative AVERROR if not */
+    };
+
 public:
     /**
      * Construct FFmpeg_Transcoder object
@@ -178,6 +241,96 @@ public:
      * @return On success returns 0; on error negative AVERROR.
      */
     int                         open_output_file(Buffer* buffer);
+    /**
+     * @brief Open output to fill in a byte range of a PCM (WAV or AIFF) file.
+     *
+     * For PCM formats each output byte maps exactly to a sample position. The input file will be positioned
+     * to the sample at offset, and audio data is written directly to the buffer from that offset on, bypassing
+     * the muxer. The file header is expected to have been written by the sequential transcoder already.
+     * @param[in] buffer - Cache buffer to be written.
+     * @param[in] data_offset - Offset of the first audio sample in buffer, i.e. header size.
+     * @param[in] offset - Byte offset to start at. Will be aligned to the next lower sample.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         open_output_range(Buffer* buffer, size_t data_offset, size_t offset);
+    /**
+     * @brief Open output to resume an interrupted transcode of a PCM (WAV or AIFF) file.
+     *
+     * The header is written again, then the input file will be positioned to the sample at offset and
+     * the muxer continues writing from there. As PCM muxers derive all sizes from the file position, the
+     * trailer will be the same as if the file had been transcoded in one go.
+     * If the input file cannot be positioned, the file will be transcoded from the start.
+     * @param[in] buffer - Cache buffer to be written. Must contain valid data up to offset.
+     * @param[in] offset - Byte offset to resume at. Will be aligned to the next lower sample.
+     * @param[out] data_offset - Offset of the first audio sample in buffer, i.e. header size.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         open_output_resume(Buffer* buffer, size_t offset, size_t *data_offset);
+    /**
+     * @brief Open output to transcode a segment of an audio file or a chunk of the video stream.
+     *
+     * The output is not muxed, instead the encoded packets are added to the segment
+     * to be stitched together by the transcoder that writes the file.
+     * @param[in] segment - Segment to transcode.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         open_output_segment(const std::shared_ptr<SEGMENT> & segment);
+    /**
+     * @brief Transcode a segment in a pool thread.
+     *
+     * Does nothing if the segment has already been started by someone else.
+     * @param[in] segment - Segment to transcode.
+     */
+    static void                 run_segment(const std::shared_ptr<SEGMENT> & segment);
+    /**
+     * @brief Open a transcoder for a segment. The segment must have been set to SEGMENT_RUNNING.
+     * @param[in] segment - Segment to transcode.
+     * @param[out] ret - On error negative AVERROR.
+     * @return On success returns the transcoder; on error nullptr.
+     */
+    static FFmpeg_Transcoder *  begin_segment(const std::shared_ptr<SEGMENT> & segment, int *ret);
+    /**
+     * @brief Transcode the next frame of a segment.
+     * @param[in] transcoder - Transcoder returned by #begin_segment().
+     * @param[in] segment - Segment to transcode.
+     * @return Returns 0 if there is more to do, 1 if the segment is complete, or negative AVERROR.
+     */
+    static int                  step_segment(FFmpeg_Transcoder *transcoder, const std::shared_ptr<SEGMENT> & segment);
+    /**
+     * @brief Free the transcoder of a segment and set the segment to SEGMENT_DONE.
+     * @param[in] transcoder - Transcoder returned by #begin_segment(), may be nullptr.
+     * @param[in] segment - Segment transcoded.
+     * @param[in] ret - Result of last #step_segment() call: 1 if complete, or negative AVERROR.
+     */
+    static void                 end_segment(FFmpeg_Transcoder *transcoder, const std::shared_ptr<SEGMENT> & segment, int ret);
+    /**
+     * @brief Get the start of the range being filled in by #open_output_range().
+     * @return Returns the start of the range.
+     */
+    size_t                      range_start() const;
+    /**
+     * @brief Get the current write position if filling in a range with #open_output_range().
+     * @return Returns the current write position.
+     */
+    size_t                      range_pos() const;
+    /**
+     * @brief Get a checkpoint the transcode can be resumed from with #open_output_resume().
+     *
+     * Only PCM formats can be resumed, where each output byte maps exactly to a sample position.
+     * @param[in] data_offset - Offset of the first audio sample in the output file, i.e. header size.
+     * @param[in] offset - Size of the output file that has been written so far.
+     * @param[out] pos - Position in the source file matching the checkpoint, in AV_TIME_BASE fractional seconds.
+     * @return Returns offset aligned to the next lower sample, or 0 if the output file cannot be resumed.
+     */
+    size_t                      resume_point(size_t data_offset, size_t offset, int64_t *pos) const;
+    /**
+     * @brief Get the seek index of the output file.
+     *
+     * An entry is recorded for each video keyframe and about every second of the main stream (video if present,
+     * audio otherwise) when the packet is handed to the muxer. Must not be called while the pipeline is running.
+     * @return Returns the seek index, ordered by offset.
+     */
+    const SEEK_INDEX &          seek_index() const;
     /**
      * Process a single frame of audio data. The encode_pcm_data() method
      * of the Encoder will be used to process the resulting audio data, with the
@@ -245,6 +398,29 @@ public:
      * @return On success, returns true; on failure, returns false.
      */
     static bool                 video_size(size_t *filesize, AVCodecID codec_id, BITRATE bit_rate, int64_t duration, int width, int height, int interleaved, const AVRational & framerate);
+    /**
+     * @brief Get the results of probing the input file.
+     *
+     * Collects everything required to predict the size of the transcoded file,
+     * see calculate_predicted_filesize(const PROBE_INFO &, const FFmpegfs_Format *, const char *).
+     * Input file must be open. m_origfile, m_file_time and m_file_size are not set.
+     *
+     * @param[out] probe_info - Structure with probe info data.
+     * @return Returns true on success; false if the input file is not open.
+     */
+    bool                        get_probe_info(PROBE_INFO *probe_info) const;
+    /**
+     * @brief Predict the size of the transcoded file from the results of probing the input file.
+     *
+     * Does not need access to the input file, so this can be used with probe info
+     * stored in the cache index.
+     *
+     * @param[in] probe_info - Structure with probe info data.
+     * @param[in] current_format - Output format.
+     * @param[in] filename - Name of input file, for logging only.
+     * @return Predicted file size in bytes.
+     */
+    static size_t               calculate_predicted_filesize(const PROBE_INFO & probe_info, const FFmpegfs_Format *current_format, const char *filename);
     /**
      * @brief Closes the output file of open and reports lost packets. Can safely be called again after the file was already closed or if the file was never open.
      * @return Returns true if the output file was closed, false if it was not upon upon calling this function.
@@ -442,6 +618,8 @@ protected:
     int                         init_audio_output_frame(AVFrame **frame, int frame_size);
     /**
      * @brief Allocate memory for one picture.
+     *
+     * The image buffer is taken from m_frame_pool and returned there when the frame is freed.
      * @param[in] pix_fmt - Pixel format
      * @param[in] width - Picture width
      * @param[in] height - Picture height
@@ -478,6 +656,11 @@ protected:
      * @return On success returns 0. On error, returns a negative AVERROR value.
      */
     int                         encode_video_frame(const AVFrame *frame, int *data_present);
+    /**
+     * @brief Make sure DTS of video packets are valid and monotonously increasing before muxing.
+     * @param[in] pkt - Video packet, timestamps in output stream time base.
+     */
+    void                        fix_video_dts(AVPacket *pkt);
     /**
      * @brief Load one audio frame from the FIFO buffer, encode and write it to the output file.
      * @param[in] frame_size - Size of frame.
@@ -615,6 +798,165 @@ protected:
      * @brief Purge FIFO buffers and report lost packet.
      */
     void                        purge_fifos();
+    /**
+     * @brief Filter and rescale a decoded video frame and pass it on to the encoder.
+     *
+     * In pipelined mode this runs in the filter thread and the frame is passed on to the encode
+     * queue, otherwise the frame is added to the video FIFO.
+     * @param[in] frame - Decoded video frame. Will be either passed on or freed.
+     * @param[in] pts - PTS to be used if the frame does not carry its own.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         process_video_frame(AVFrame *frame, int64_t pts);
+    /**
+     * @brief Write packet to output file. Actually calls the muxer, #store_packet() may queue the packet instead.
+     * @param[in] pkt - Packet to write.
+     * @param[in] type - Type of packet, used for logging.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         mux_packet(AVPacket *pkt, const char *type);
+    /**
+     * @brief Start pipelined mode: Create filter, encoder and muxer threads.
+     *
+     * Demuxing and decoding is still done by the caller of #process_single_fr().
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         start_pipeline();
+    /**
+     * @brief Stop pipelined mode and end all threads.
+     * @param[in] drain - If true, process all queued frames and packets and flush the encoder; if false, discard them.
+     * @return On success returns 0; on error negative AVERROR returned by one of the stages.
+     */
+    int                         stop_pipeline(bool drain);
+    /**
+     * @brief Report an error in one of the pipeline stages and release all other stages.
+     * @param[in] ret - Negative AVERROR value.
+     */
+    void                        pipeline_error(int ret);
+    /**
+     * @brief Filter/rescale stage: Take decoded video frames off the filter queue and process them.
+     */
+    void                        filter_thread();
+    /**
+     * @brief Encode stage: Take video frames off the encode queue and encode them.
+     */
+    void                        encode_thread();
+    /**
+     * @brief Mux stage: Take packets off the mux queue and write them to the output file.
+     */
+    void                        mux_thread();
+    /**
+     * @brief Start filter stage thread.
+     * @param[in] transcoder - Owner FFmpeg_Transcoder object.
+     */
+    static void                 filter_thread_starter(FFmpeg_Transcoder & transcoder);
+    /**
+     * @brief Start encode stage thread.
+     * @param[in] transcoder - Owner FFmpeg_Transcoder object.
+     */
+    static void                 encode_thread_starter(FFmpeg_Transcoder & transcoder);
+    /**
+     * @brief Start mux stage thread.
+     * @param[in] transcoder - Owner FFmpeg_Transcoder object.
+     */
+    static void                 mux_thread_starter(FFmpeg_Transcoder & transcoder);
+    /**
+     * @brief Seek input file so that decoding starts at a certain output audio sample.
+     *
+     * Samples in front of the position will be dropped by the decoder.
+     * @param[in] sample_pos - Sample position, based on output sample rate.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         seek_to_sample(int64_t sample_pos);
+    /**
+     * @brief Split audio file into segments and transcode all but the first one in parallel.
+     *
+     * Does nothing if the file is too short or the output format cannot be segmented.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         start_segments();
+    /**
+     * @brief Split the video stream into chunks and encode all but the first one in parallel.
+     *
+     * Each chunk starts at a key frame of the source and is encoded by its own encoder,
+     * so it begins with a closed GOP and can simply be appended. Audio is transcoded by
+     * this object only. Does nothing if the file is too short or the output format cannot
+     * be chunked.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         start_video_chunks();
+    /**
+     * @brief Check if a decoded video frame belongs to the chunk encoded by this object.
+     *
+     * Marks the chunk as started at its first key frame and as full at the key frame
+     * the next chunk starts with.
+     * @param[in] frame - Decoded video frame.
+     * @return Returns true if the frame is to be encoded.
+     */
+    bool                        video_chunk_frame(const AVFrame *frame);
+    /**
+     * @brief Mux the packets of the video chunks encoded in parallel in order.
+     *
+     * Waits a short while for packets only if audio has got ahead of the video.
+     * Fails if a chunk's encoder has been set up differently from ours, its packets
+     * would not match the stream header of the file.
+     * @param[out] done - Set to true after the last packet of the last chunk has been muxed.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         stitch_video_chunks(bool *done);
+    /**
+     * @brief Position the input file to the start of the HLS segment to be transcoded.
+     *
+     * Output timestamps continue from the segment start, so segments play back seamlessly.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         start_hls_segment();
+    /**
+     * @brief Check if a timestamp lies outside the HLS segment being transcoded.
+     * @param[in] ts - Timestamp to check.
+     * @param[in] time_base - Time base of ts.
+     * @return Returns true if ts is before the start or at or after the end of the segment.
+     */
+    bool                        outside_hls_segment(int64_t ts, const AVRational & time_base) const;
+    /**
+     * @brief Check if a packet has been read beyond the end of the HLS segment.
+     *
+     * Once all streams have reached the end, the segment is complete.
+     * @param[in] pkt - Packet read from the input file.
+     * @param[out] finished - Set to 1 if the segment is complete.
+     * @return Returns true if the packet is beyond the end and must not be decoded.
+     */
+    bool                        past_hls_segment(const AVPacket *pkt, int *finished);
+    /**
+     * @brief Transcode a segment no pool thread has picked up in our own thread.
+     *
+     * Transcodes until packets are available to stitch or the segment is complete, so
+     * the segment is not kept in memory completely. The segment's queue is not limited
+     * then, we would wait for ourselves.
+     * @param[in] segment - Segment being stitched.
+     */
+    void                        run_segment_direct(const std::shared_ptr<SEGMENT> & segment);
+    /**
+     * @brief Abort all segments and video chunks and free their packets.
+     */
+    void                        stop_segments();
+    /**
+     * @brief Mux the packets of the parallel segments in order.
+     * @param[out] finished - Set to 1 after the last packet of the last segment has been muxed.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         stitch_segments(int *finished);
+    /**
+     * @brief Add encoded packet to the segment or video chunk transcoded by this object.
+     * @param[in] pkt - Packet to add. Will be copied.
+     * @return On success returns 0; on error negative AVERROR.
+     */
+    int                         store_segment_packet(AVPacket *pkt);
+    /**
+     * @brief Pool thread function for segments.
+     * @param[in] opaque - Pointer to a std::shared_ptr<SEGMENT>, will be freed.
+     */
+    static void                 segment_thread(void *opaque);
 
 private:
     FileIO *                    m_fileio;                   /**< @brief FileIO object of input file */
@@ -642,6 +984,7 @@ private:
     AVFilterGraph *             m_filter_graph;             /**< @brief Video filter graph */
 #endif
     std::queue<AVFrame*>        m_video_fifo;               /**< @brief Video frame FIFO */
+    Frame_Pool                  m_frame_pool;               /**< @brief Reusable frame buffers for scaler output */
     int64_t                     m_pts;                      /**< @brief Generated PTS */
     int64_t                     m_pos;                      /**< @brief Generated position */
 
@@ -654,6 +997,64 @@ private:
 
     FFmpegfs_Format *           m_current_format;           /**< @brief Currently used output format(s) */
 
+    // Pipelined mode: demux/decode -> filter/scale -> encode -> mux
+    /**
+     * @brief Decoded video frame waiting for the filter stage
+     */
+    typedef struct DECODED_FRAME
+    {
+        AVFrame *               m_frame;                    /**< @brief Decoded frame */
+        int64_t                 m_pts;                      /**< @brief PTS to use if frame has none */
+    } DECODED_FRAME;
+
+    bool                        m_pipeline_running;         /**< @brief true if filter, encode and mux stages run in separate threads */
+    std::atomic_int             m_pipeline_error;           /**< @brief First error reported by a pipeline stage, 0 if none */
+    Bounded_Queue<DECODED_FRAME> m_filter_queue;            /**< @brief Decoded video frames for the filter stage */
+    Bounded_Queue<AVFrame*>     m_encode_queue;             /**< @brief Filtered and scaled frames for the encode stage */
+    Bounded_Queue<AVPacket*>    m_mux_queue;                /**< @brief Encoded packets for the mux stage */
+    std::thread                 m_filter_thread;            /**< @brief Filter stage thread */
+    std::thread                 m_encode_thread;            /**< @brief Encode stage thread */
+    std::thread                 m_mux_thread;               /**< @brief Mux stage thread */
+
+    // Range mode: fill in part of a PCM file starting at a seek position
+    bool                        m_range_output;             /**< @brief If true, write audio data directly to m_range_buffer instead of muxing it */
+    Buffer *                    m_range_buffer;             /**< @brief Cache buffer to fill in */
+    size_t                      m_range_start;              /**< @brief Start offset of range */
+    size_t                      m_range_pos;                /**< @brief Current write position */
+    int                         m_range_block_align;        /**< @brief Size of one sample for all channels in bytes */
+    int64_t                     m_range_skip_pts;           /**< @brief Seek target in input stream time base, AV_NOPTS_VALUE once reached */
+    int                         m_range_skip_samples;       /**< @brief Number of output samples to drop before writing */
+
+    bool                        m_resume_output;            /**< @brief If true, an interrupted transcode is being resumed, see #open_output_resume() */
+
+    SEEK_INDEX                  m_seek_index;               /**< @brief Output byte offset to source position map, recorded while muxing */
+
+    // Segmented mode: transcode parts of a long audio file in parallel
+    std::vector<std::shared_ptr<SEGMENT>> m_segments;       /**< @brief Segments transcoded in parallel, first one is done by this object */
+    size_t                      m_segment_idx;              /**< @brief Segment currently being stitched */
+    std::shared_ptr<SEGMENT>    m_segment;                  /**< @brief Segment produced by this object, if transcoding a segment */
+    int64_t                     m_packet_no;                /**< @brief Number of audio packets encoded */
+    int64_t                     m_first_packet;             /**< @brief Drop audio packets before this one */
+    int64_t                     m_end_packet;               /**< @brief Stop after this audio packet */
+    bool                        m_segment_full;             /**< @brief true if m_end_packet has been reached */
+    FFmpeg_Transcoder *         m_direct_segment;           /**< @brief Transcoder of the segment or video chunk being stitched if run in our own thread, see #run_segment_direct() */
+
+    // Chunked video mode: encode parts of the video stream in parallel
+    std::vector<std::shared_ptr<SEGMENT>> m_video_chunks;   /**< @brief Video chunks encoded in parallel, first one is done by this object */
+    size_t                      m_video_chunk_idx;          /**< @brief Video chunk currently being stitched */
+    int64_t                     m_video_chunk_start;        /**< @brief Drop video frames before the first key frame at or after this position, AV_NOPTS_VALUE if not chunked */
+    int64_t                     m_video_chunk_end;          /**< @brief Stop at the first key frame at or after this position, AV_NOPTS_VALUE if not chunked */
+    bool                        m_video_chunk_started;      /**< @brief true once the first key frame of the own chunk has been decoded */
+    bool                        m_video_chunk_full;         /**< @brief true once the end of the own chunk has been reached */
+    bool                        m_video_chunk_flushed;      /**< @brief true once the video encoder has been flushed at the end of the own chunk */
+    bool                        m_video_chunk_input_done;   /**< @brief true once the input file has been read completely while chunks are still to be stitched */
+    int64_t                     m_video_chunk_read_pos;     /**< @brief Input position read after the end of the own chunk, AV_TIME_BASE units */
+    int64_t                     m_video_chunk_mux_pos;      /**< @brief Position of the last stitched video packet, AV_TIME_BASE units */
+
+    // HLS mode: transcode one segment of the source file, see VIRTUALFILE::HLS_SEGMENT
+    bool                        m_hls_audio_done;           /**< @brief true once audio has reached the end of the HLS segment */
+    bool                        m_hls_video_done;           /**< @brief true once video has reached the end of the HLS segment */
+
     static const PRORES_BITRATE m_prores_bitrate[];         /**< @brief ProRes bitrate table. Used for file size prediction. */
 };
 
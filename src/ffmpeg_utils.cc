@@ -195,6 +195,15 @@ bool FFmpegfs_Format::init(const std::string & desttype)
         m_fileext           = "m4a";
         break;
     }
+    case FILETYPE_HLS:
+    {
+        // Source files become directories, segments are MPEG transport streams
+        m_audio_codec_id    = AV_CODEC_ID_AAC;
+        m_video_codec_id    = AV_CODEC_ID_H264;
+        m_format_name       = "mpegts";
+        m_fileext           = "hls";
+        break;
+    }
     case FILETYPE_UNKNOWN:
     {
         found = false;
@@ -686,6 +695,7 @@ FILETYPE get_filetype(const std::string & desttype)
         { "opus",   FILETYPE_OPUS },
         { "prores", FILETYPE_PRORES },
         { "alac",   FILETYPE_ALAC },
+        { "hls",    FILETYPE_HLS },
     };
 
     try
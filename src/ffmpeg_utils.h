@@ -181,6 +181,7 @@ typedef enum FILETYPE
     FILETYPE_OPUS,
     FILETYPE_PRORES,
     FILETYPE_ALAC,
+    FILETYPE_HLS,
 } FILETYPE;
 
 /**
@@ -115,12 +115,27 @@ FFMPEGFS_PARAMS::FFMPEGFS_PARAMS()
     , m_min_diskspace(0)                        // default: no minimum
     , m_cachepath("")                           // default: /var/cache/ffmpegfs
     , m_disable_cache(0)                        // default: enabled
+    , m_stream_window(0)                        // default: use a cache file even if cache is disabled
     , m_cache_maintenance((60*60))              // default: prune every 60 minutes
+    , m_cache_warming(0)                        // default: no cache warming
     , m_prune_cache(0)                          // default: Do not prune cache immediately
     , m_clear_cache(0)                          // default: Do not clear cache on startup
     , m_max_threads(0)                          // default: 16 * CPU cores (this value here is overwritten later)
+    , m_max_background_jobs(0)                  // default: number of CPU cores (this value here is overwritten later)
     , m_decoding_errors(0)                      // default: ignore errors
     , m_min_dvd_chapter_duration(1)             // default: 1 second
+    , m_pipeline(0)                             // default: single threaded transcoding
+    , m_fast_pcm_seek(0)                        // default: wait for transcoder on seek
+    , m_audio_segments(0)                       // default: no parallel segments
+    , m_video_chunks(0)                         // default: no parallel video chunks
+    , m_prefetch(0)                             // default: no prefetch
+    , m_prefetch_trigger(50)                    // default: prefetch when half of the file has been read
+    , m_segment_duration(10)                    // default: 10 second HLS segments
+    , m_segment_prefetch(2)                     // default: transcode the next 2 HLS segments in advance
+    , m_max_virtual_files(100000)               // default: keep up to 100,000 files in memory
+    , m_entry_timeout(1)                        // default: same as FUSE
+    , m_attr_timeout(1)                         // default: same as FUSE, file sizes change while transcoding
+    , m_negative_timeout(0)                     // default: same as FUSE, do not cache missing files
     , m_win_smb_fix(0)                          // default: no fix
 {
 }
@@ -210,6 +225,7 @@ enum
     KEY_MAX_CACHE_SIZE,
     KEY_MIN_DISKSPACE_SIZE,
     KEY_CACHEPATH,
+    KEY_STREAM_WINDOW,
     KEY_CACHE_MAINTENANCE,
     KEY_AUTOCOPY,
     KEY_PROFILE,
@@ -283,19 +299,49 @@ static struct fuse_opt ffmpegfs_opts[] =
     FUSE_OPT_KEY("cachepath=%s",                    KEY_CACHEPATH),
     FFMPEGFS_OPT("--disable_cache",                 m_disable_cache, 1),
     FFMPEGFS_OPT("disable_cache",                   m_disable_cache, 1),
+    FUSE_OPT_KEY("--stream_window=%s",              KEY_STREAM_WINDOW),
+    FUSE_OPT_KEY("stream_window=%s",                KEY_STREAM_WINDOW),
     FUSE_OPT_KEY("--cache_maintenance=%s",          KEY_CACHE_MAINTENANCE),
     FUSE_OPT_KEY("cache_maintenance=%s",            KEY_CACHE_MAINTENANCE),
     FFMPEGFS_OPT("--prune_cache",                   m_prune_cache, 1),
     FFMPEGFS_OPT("--clear_cache",                   m_clear_cache, 1),
     FFMPEGFS_OPT("clear_cache",                     m_clear_cache, 1),
+    FFMPEGFS_OPT("--cache_warming",                 m_cache_warming, 1),
+    FFMPEGFS_OPT("cache_warming",                   m_cache_warming, 1),
 
     // Other
     FFMPEGFS_OPT("--max_threads=%u",                m_max_threads, 0),
     FFMPEGFS_OPT("max_threads=%u",                  m_max_threads, 0),
+    FFMPEGFS_OPT("--max_background_jobs=%u",        m_max_background_jobs, 0),
+    FFMPEGFS_OPT("max_background_jobs=%u",          m_max_background_jobs, 0),
     FFMPEGFS_OPT("--decoding_errors=%u",            m_decoding_errors, 0),
     FFMPEGFS_OPT("decoding_errors=%u",              m_decoding_errors, 0),
     FFMPEGFS_OPT("--min_dvd_chapter_duration=%u",   m_min_dvd_chapter_duration, 0),
     FFMPEGFS_OPT("min_dvd_chapter_duration=%u",     m_min_dvd_chapter_duration, 0),
+    FFMPEGFS_OPT("--pipeline",                      m_pipeline, 1),
+    FFMPEGFS_OPT("pipeline",                        m_pipeline, 1),
+    FFMPEGFS_OPT("--fast_pcm_seek",                 m_fast_pcm_seek, 1),
+    FFMPEGFS_OPT("fast_pcm_seek",                   m_fast_pcm_seek, 1),
+    FFMPEGFS_OPT("--audio_segments=%u",             m_audio_segments, 0),
+    FFMPEGFS_OPT("audio_segments=%u",               m_audio_segments, 0),
+    FFMPEGFS_OPT("--video_chunks=%u",               m_video_chunks, 0),
+    FFMPEGFS_OPT("video_chunks=%u",                 m_video_chunks, 0),
+    FFMPEGFS_OPT("--prefetch=%u",                   m_prefetch, 0),
+    FFMPEGFS_OPT("prefetch=%u",                     m_prefetch, 0),
+    FFMPEGFS_OPT("--prefetch_trigger=%u",           m_prefetch_trigger, 0),
+    FFMPEGFS_OPT("prefetch_trigger=%u",             m_prefetch_trigger, 0),
+    FFMPEGFS_OPT("--segment_duration=%u",           m_segment_duration, 0),
+    FFMPEGFS_OPT("segment_duration=%u",             m_segment_duration, 0),
+    FFMPEGFS_OPT("--segment_prefetch=%u",           m_segment_prefetch, 0),
+    FFMPEGFS_OPT("segment_prefetch=%u",             m_segment_prefetch, 0),
+    FFMPEGFS_OPT("--max_virtual_files=%u",          m_max_virtual_files, 0),
+    FFMPEGFS_OPT("max_virtual_files=%u",            m_max_virtual_files, 0),
+    FFMPEGFS_OPT("--entry_timeout=%u",              m_entry_timeout, 0),
+    FFMPEGFS_OPT("entry_timeout=%u",                m_entry_timeout, 0),
+    FFMPEGFS_OPT("--attr_timeout=%u",               m_attr_timeout, 0),
+    FFMPEGFS_OPT("attr_timeout=%u",                 m_attr_timeout, 0),
+    FFMPEGFS_OPT("--negative_timeout=%u",           m_negative_timeout, 0),
+    FFMPEGFS_OPT("negative_timeout=%u",             m_negative_timeout, 0),
     FFMPEGFS_OPT("--win_smb_fix=%u",                m_win_smb_fix, 0),
     FFMPEGFS_OPT("win_smb_fix=%u",                  m_win_smb_fix, 0),
     // FFmpegfs options
@@ -1109,6 +1155,10 @@ static int ffmpegfs_opt_proc(void* data, const char* arg, int key, struct fuse_a
     {
         return get_size(arg, &params.m_min_diskspace);
     }
+    case KEY_STREAM_WINDOW:
+    {
+        return get_size(arg, &params.m_stream_window);
+    }
     case KEY_CACHEPATH:
     {
         return get_value(arg, &params.m_cachepath);
@@ -1193,14 +1243,29 @@ static void print_params(void)
                                          "Min. Disk Space   : %31\n"
                                          "Cache Path        : %32\n"
                                          "Disable Cache     : %33\n"
-                                         "Maintenance Timer : %34\n"
-                                         "Clear Cache       : %35\n"
+                                         "Stream Window     : %34\n"
+                                         "Maintenance Timer : %35\n"
+                                         "Cache Warming     : %36\n"
+                                         "Clear Cache       : %37\n"
                                          "\nVarious Options\n\n"
-                                         "Max. Threads      : %36\n"
-                                         "Decoding Errors   : %37\n"
-                                         "Min. DVD chapter  : %38\n"
+                                         "Max. Threads      : %38\n"
+                                         "Background Jobs   : %39\n"
+                                         "Decoding Errors   : %40\n"
+                                         "Min. DVD chapter  : %41\n"
+                                         "Pipelined Mode    : %42\n"
+                                         "Fast PCM Seek     : %43\n"
+                                         "Audio Segments    : %44\n"
+                                         "Video Chunks      : %45\n"
+                                         "Prefetch          : %46\n"
+                                         "Prefetch Trigger  : %47\n"
+                                         "HLS Segment Dur.  : %48\n"
+                                         "HLS Prefetch      : %49\n"
+                                         "Max. Virt. Files  : %50\n"
+                                         "Entry Timeout     : %51\n"
+                                         "Attr. Timeout     : %52\n"
+                                         "Neg. Timeout      : %53\n"
                                          "\nExperimental Options\n\n"
-                                         "Windows 10 Fix    : %39\n",
+                                         "Windows 10 Fix    : %54\n",
                    params.m_basepath.c_str(),
                    params.m_mountpath.c_str(),
                    params.smart_transcode() ? "yes" : "no",
@@ -1238,11 +1303,26 @@ static void print_params(void)
             format_size(params.m_min_diskspace).c_str(),
             cachepath.c_str(),
             params.m_disable_cache ? "yes" : "no",
+            params.m_stream_window ? format_size(params.m_stream_window).c_str() : "off",
             params.m_cache_maintenance ? format_time(params.m_cache_maintenance).c_str() : "inactive",
+            params.m_cache_warming ? "yes" : "no",
             params.m_clear_cache ? "yes" : "no",
             format_number(params.m_max_threads).c_str(),
+            format_number(params.m_max_background_jobs).c_str(),
             params.m_decoding_errors ? "break transcode" : "ignore",
             format_duration(params.m_min_dvd_chapter_duration * AV_TIME_BASE).c_str(),
+            params.m_pipeline ? "yes" : "no",
+            params.m_fast_pcm_seek ? "yes" : "no",
+            params.m_audio_segments > 1 ? format_number(params.m_audio_segments).c_str() : "off",
+            params.m_video_chunks > 1 ? format_number(params.m_video_chunks).c_str() : "off",
+            params.m_prefetch ? format_number(params.m_prefetch).c_str() : "off",
+            (format_number(params.m_prefetch_trigger) + "%").c_str(),
+            format_time(params.m_segment_duration).c_str(),
+            params.m_segment_prefetch ? format_number(params.m_segment_prefetch).c_str() : "off",
+            params.m_max_virtual_files ? format_number(params.m_max_virtual_files).c_str() : "unlimited",
+            params.m_entry_timeout ? format_time(params.m_entry_timeout).c_str() : "off",
+            params.m_attr_timeout ? format_time(params.m_attr_timeout).c_str() : "off",
+            params.m_negative_timeout ? format_time(params.m_negative_timeout).c_str() : "off",
             params.m_win_smb_fix ? "inactive" : "SMB Lockup Fix Active");
 }
 
@@ -1288,6 +1368,7 @@ int main(int argc, char *argv[])
 
     // Set default
     params.m_max_threads = static_cast<unsigned int>(get_nprocs() * 16);
+    params.m_max_background_jobs = static_cast<unsigned int>(get_nprocs());
 
     if (fuse_opt_parse(&args, &params, ffmpegfs_opts, ffmpegfs_opt_proc))
     {
@@ -1381,6 +1462,24 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (params.m_prefetch_trigger > 100)
+    {
+        std::fprintf(stderr, "INVALID PARAMETER: prefetch_trigger must be a percentage from 0 to 100.\n\n");
+        return 1;
+    }
+
+    if (!params.m_segment_duration)
+    {
+        std::fprintf(stderr, "INVALID PARAMETER: segment_duration must be at least 1 second.\n\n");
+        return 1;
+    }
+
+    if (params.m_stream_window && !params.m_disable_cache)
+    {
+        std::fprintf(stderr, "INVALID PARAMETER: stream_window can only be used together with disable_cache.\n\n");
+        return 1;
+    }
+
     if (!set_defaults())
     {
         return 1;
@@ -1402,6 +1501,13 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Pass kernel cache timeouts to FUSE
+    std::string timeouts("-oentry_timeout=" + std::to_string(params.m_entry_timeout) +
+                         ",attr_timeout=" + std::to_string(params.m_attr_timeout) +
+                         ",negative_timeout=" + std::to_string(params.m_negative_timeout));
+
+    fuse_opt_add_arg(&args, timeouts.c_str());
+
     // start FUSE
     ret = fuse_main(args.argc, args.argv, &ffmpegfs_ops, nullptr);
 
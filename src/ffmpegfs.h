@@ -165,13 +165,28 @@ extern struct FFMPEGFS_PARAMS
     size_t              m_min_diskspace;            /**< @brief Min. diskspace required for cache */
     std::string         m_cachepath;                /**< @brief Disk cache path, defaults to /var/cache */
     int                 m_disable_cache;            /**< @brief Disable cache */
+    size_t              m_stream_window;            /**< @brief With disable_cache: keep only this many bytes in memory instead of a cache file, 0 to use a cache file */
     time_t              m_cache_maintenance;        /**< @brief Prune timer interval */
+    int                 m_cache_warming;            /**< @brief Transcode all files in background to fill the cache */
     int                 m_prune_cache;              /**< @brief Prune cache immediately */
     int                 m_clear_cache;              /**< @brief Clear cache on start up */
     unsigned int        m_max_threads;              /**< @brief Max. number of recoder threads */
+    unsigned int        m_max_background_jobs;      /**< @brief Max. number of background jobs (prefetch, cache warming etc.) running at the same time */
     // Miscellanous options
     int                 m_decoding_errors;          /**< @brief Break transcoding on decoding error */
     int                 m_min_dvd_chapter_duration; /**< @brief Min. DVD chapter duration. Shorter chapters will be ignored. */
+    int                 m_pipeline;                 /**< @brief Run video filter, encoder and muxer in separate threads */
+    int                 m_fast_pcm_seek;            /**< @brief Start a secondary transcoder on seeks in WAV and AIFF files */
+    unsigned int        m_audio_segments;           /**< @brief Max. number of segments to transcode long audio files in parallel */
+    unsigned int        m_video_chunks;             /**< @brief Max. number of chunks to encode the video stream of long videos in parallel */
+    unsigned int        m_prefetch;                 /**< @brief Number of following files in directory to transcode in advance */
+    unsigned int        m_prefetch_trigger;         /**< @brief Percentage of a file to be read before the following files will be prefetched */
+    unsigned int        m_segment_duration;         /**< @brief Duration of HLS segments in seconds */
+    unsigned int        m_segment_prefetch;         /**< @brief Number of following HLS segments to transcode in advance */
+    unsigned int        m_max_virtual_files;        /**< @brief Max. number of virtual files to keep in memory, 0 for unlimited */
+    unsigned int        m_entry_timeout;            /**< @brief Time in seconds the kernel may cache file names */
+    unsigned int        m_attr_timeout;             /**< @brief Time in seconds the kernel may cache file attributes */
+    unsigned int        m_negative_timeout;         /**< @brief Time in seconds the kernel may cache that a file does not exist */
     // Experimental options
     int                 m_win_smb_fix;              /**< @brief Experimental Windows fix for access to EOF at file open */
 } params;                                           /**< @brief Command line parameters */
@@ -238,6 +253,12 @@ bool            transcoder_cache_maintenance(void);
  * @return Returns true on success; false on error. Check errno for details.
  */
 bool            transcoder_cache_clear(void);
+/**
+ * @brief Check if there is room in the cache for a new file. Unlike cache maintenance, no files will be pruned.
+ * @param[in] predicted_filesize - Size of new file.
+ * @return Returns true if the file fits; false if max_cache_size or min_diskspace would be exceeded.
+ */
+bool            transcoder_cache_room(size_t predicted_filesize);
 /**
  * @brief Add new virtual file to internal list.
  *
@@ -258,6 +279,13 @@ LPVIRTUALFILE   insert_file(VIRTUALTYPE type, const std::string & virtfilepath,
  * @return Returns constant pointer to VIRTUALFILE object of file, nullptr if not found
  */
 LPVIRTUALFILE   insert_file(VIRTUALTYPE type, const std::string &virtfilepath, const std::string & origfile, const struct stat *stbuf);
+/**
+ * @brief Add a physical file to internal list under its transcoded name, as if it had been listed by readdir.
+ * @param[in] origfile - Original file name.
+ * @param[in] stbuf - stat buffer with file size, time etc.
+ * @return Returns constant pointer to VIRTUALFILE object of file, nullptr if the file will not be transcoded as a whole.
+ */
+LPVIRTUALFILE   insert_original(const std::string & origfile, const struct stat *stbuf);
 /**
  * @brief Find file in cache.
  * @param[in] virtfilepath - Virtual filename and path of file to find.
@@ -298,6 +326,12 @@ LPVIRTUALFILE   find_original(std::string *filepath);
  * @return Returns contstant pointer to VIRTUALFILE object of file, nullptr if not found
  */
 LPVIRTUALFILE   find_parent(const std::string & origpath);
+/**
+ * @brief Get the file name of an HLS segment.
+ * @param[in] segment_no - Number of the segment, starting at 1.
+ * @return Returns the file name of the segment, without path.
+ */
+std::string     hls_segment_name(uint32_t segment_no);
 
 #endif // FFMPEGFS_H
 
@@ -61,6 +61,7 @@ FileIO * FileIO::alloc(VIRTUALTYPE type)
     switch (type)
     {
     case VIRTUALTYPE_DISK:
+    case VIRTUALTYPE_HLS:
     {
         return new(std::nothrow) DiskIO;
     }
@@ -97,8 +98,9 @@ void FileIO::set_virtualfile(LPCVIRTUALFILE virtualfile)
 
     if (virtualfile != nullptr)
     {
-        // Store path to original file without file name for fast access
-        m_path = m_virtualfile->m_origfile;
+        // Store original file and its path for fast access
+        m_filename = m_virtualfile->m_origfile.str();
+        m_path = m_filename;
 
         remove_filename(&m_path);
     }
@@ -126,6 +128,6 @@ const std::string & FileIO::filename() const
         return empty;
     }
 
-    return virtualfile()->m_origfile;
+    return m_filename;
 }
 
@@ -41,6 +41,8 @@
 #include "config.h"
 #endif
 
+#include "shared_path.h"
+
 #include <sys/stat.h>
 #include <string>
 #include <vector>
@@ -60,6 +62,7 @@ typedef enum VIRTUALTYPE
 #ifdef USE_LIBBLURAY
     VIRTUALTYPE_BLURAY,                                             /**< @brief Bluray disk file */
 #endif // USE_LIBBLURAY
+    VIRTUALTYPE_HLS,                                                /**< @brief HLS segment of a disk file */
 
     VIRTUALTYPE_BUFFER,                                             /**< @brief Buffer file */
 } VIRTUALTYPE;
@@ -82,7 +85,7 @@ typedef struct VIRTUALFILE
     VIRTUALTYPE         m_type;                                     /**< @brief Type of this virtual file */
 
     int                 m_format_idx;                               /**< @brief Index into params.format[] array */
-    std::string         m_origfile;                                 /**< @brief Sanitised original file name */
+    Shared_Path         m_origfile;                                 /**< @brief Sanitised original file name */
     struct stat         m_st;                                       /**< @brief stat structure with size etc. */
 
     bool                m_full_title;                               /**< @brief If true, ignore m_chapter_no and provide full track */
@@ -142,6 +145,20 @@ typedef struct VIRTUALFILE
         unsigned    m_angle_no;                                     /**< @brief Selected angle number (1...n) */
     }               m_bluray;                                       /**< @brief Bluray title/chapter info */
 #endif // USE_LIBBLURAY
+    /** @brief Extra value structure for HLS segments
+     */
+    struct HLS_SEGMENT
+    {
+        HLS_SEGMENT()
+            : m_segment_no(0)
+            , m_start_pos(0)
+            , m_end_pos(0)
+        {}
+        Shared_Path m_srcfile;                                      /**< @brief Source file the segment is cut from */
+        uint32_t    m_segment_no;                                   /**< @brief Segment number (1...n) */
+        int64_t     m_start_pos;                                    /**< @brief Start position in AV_TIME_BASE fractional seconds */
+        int64_t     m_end_pos;                                      /**< @brief End position in AV_TIME_BASE fractional seconds (not including), AV_NOPTS_VALUE for the last segment */
+    }               m_hls;                                          /**< @brief HLS segment info */
 
 } VIRTUALFILE;
 typedef VIRTUALFILE const *LPCVIRTUALFILE;                          /**< @brief Pointer to const version of VIRTUALFILE */
@@ -263,6 +280,7 @@ protected:
     void                set_virtualfile(LPCVIRTUALFILE virtualfile);
 
 private:
+    std::string         m_filename;                                 /**< @brief Source file name and path */
     std::string         m_path;                                     /**< @brief Source path (directory without file name) */
     LPCVIRTUALFILE      m_virtualfile;                              /**< @brief Virtual file object of current file */
 };
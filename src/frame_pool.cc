@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Frame_Pool class implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "frame_pool.h"
+
+#include <string.h>
+
+// Disable annoying warnings outside our code
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC diagnostic pop
+
+#define FRAME_POOL_ALIGN        32      /**< @brief Alignment of line sizes, same as used for av_frame_get_buffer() before */
+#define FRAME_POOL_PADDING      64      /**< @brief Extra bytes at the end of the buffer, SIMD code may read a bit beyond the image */
+
+Frame_Pool::Frame_Pool()
+{
+}
+
+Frame_Pool::~Frame_Pool()
+{
+    clear();
+}
+
+AVFrame * Frame_Pool::get(AVPixelFormat pix_fmt, int width, int height)
+{
+    AVBufferRef *buf = nullptr;
+    int linesize[4];
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        pool_key_t key(pix_fmt, width, height);
+        std::map<pool_key_t, POOL>::iterator it = m_pools.find(key);
+
+        if (it == m_pools.end())
+        {
+            POOL pool;
+            uint8_t *data[4];
+
+            if (av_image_fill_linesizes(pool.m_linesize, pix_fmt, FFALIGN(width, FRAME_POOL_ALIGN)) < 0)
+            {
+                return nullptr;
+            }
+
+            for (int i = 0; i < 4; i++)
+            {
+                pool.m_linesize[i] = FFALIGN(pool.m_linesize[i], FRAME_POOL_ALIGN);
+            }
+
+            // Get total size of all planes
+            int size = av_image_fill_pointers(data, pix_fmt, height, nullptr, pool.m_linesize);
+            if (size < 0)
+            {
+                return nullptr;
+            }
+
+            pool.m_pool = av_buffer_pool_init(size + FRAME_POOL_PADDING, nullptr);
+            if (pool.m_pool == nullptr)
+            {
+                return nullptr;
+            }
+
+            it = m_pools.insert(std::make_pair(key, pool)).first;
+        }
+
+        buf = av_buffer_pool_get(it->second.m_pool);
+        memcpy(linesize, it->second.m_linesize, sizeof(linesize));
+    }
+
+    if (buf == nullptr)
+    {
+        return nullptr;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    if (frame == nullptr)
+    {
+        av_buffer_unref(&buf);
+        return nullptr;
+    }
+
+    frame->format   = pix_fmt;
+    frame->width    = width;
+    frame->height   = height;
+    frame->buf[0]   = buf;      // Returned to the pool by av_frame_free()
+
+    memcpy(frame->linesize, linesize, sizeof(linesize));
+    av_image_fill_pointers(frame->data, pix_fmt, height, buf->data, frame->linesize);
+
+    return frame;
+}
+
+void Frame_Pool::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (std::pair<const pool_key_t, POOL> & pool : m_pools)
+    {
+        // Actually freed when the last buffer has been returned
+        av_buffer_pool_uninit(&pool.second.m_pool);
+    }
+
+    m_pools.clear();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Frame_Pool class, reusable video frame buffers
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#pragma once
+
+#include "ffmpeg_utils.h"
+
+#include <map>
+#include <mutex>
+#include <tuple>
+
+struct AVBufferPool;
+
+/**
+ * @brief The #Frame_Pool class
+ *
+ * Hands out video frames with aligned image buffers taken from an
+ * AVBufferPool, one pool per pixel format and size. When a frame
+ * is freed its buffer goes back to the pool instead of being
+ * released, so continuous transcoding does not allocate image
+ * memory over and over again.
+ */
+class Frame_Pool
+{
+public:
+    /**
+     * @brief Construct Frame_Pool object.
+     */
+    Frame_Pool();
+    /**
+     * @brief Destruct Frame_Pool object.
+     *
+     * Frames still in use remain valid, their buffers are freed when the frames are.
+     */
+    ~Frame_Pool();
+
+    /**
+     * @brief Get a frame from the pool.
+     * @param[in] pix_fmt - Pixel format of frame.
+     * @param[in] width - Width of frame.
+     * @param[in] height - Height of frame.
+     * @return On success returns a new frame, free with av_frame_free(); on error returns nullptr.
+     */
+    AVFrame *           get(AVPixelFormat pix_fmt, int width, int height);
+    /**
+     * @brief Release all pools.
+     *
+     * Frames still in use remain valid, their buffers are freed when the frames are.
+     */
+    void                clear();
+
+protected:
+    /**
+     * @brief Buffer pool for one pixel format and size
+     */
+    struct POOL
+    {
+        AVBufferPool *  m_pool;                     /**< @brief Image buffers */
+        int             m_linesize[4];              /**< @brief Aligned line sizes of all planes */
+    };
+
+    typedef std::tuple<int, int, int> pool_key_t;   /**< @brief Pool key: pixel format, width and height */
+
+private:
+    std::mutex          m_mutex;                    /**< @brief Access mutex for m_pools */
+    std::map<pool_key_t, POOL> m_pools;             /**< @brief Pools by pixel format and size */
+};
+
+#endif // FRAME_POOL_H
@@ -36,6 +36,8 @@
 #include "transcode.h"
 #include "ffmpeg_utils.h"
 #include "cache_maintenance.h"
+#include "cache_warmer.h"
+#include "prefetch.h"
 #include "logging.h"
 #ifdef USE_LIBVCD
 #include "vcdparser.h"
@@ -47,25 +49,86 @@
 #include "blurayparser.h"
 #endif // USE_LIBBLURAY
 #include "thread_pool.h"
+#include "virtual_file_table.h"
 
 #include <dirent.h>
 #include <unistd.h>
 #include <map>
-#include <regex>
+#include <mutex>
+#include <algorithm>
 #include <list>
 #include <assert.h>
 #include <signal.h>
 
 /**
- * @brief Map source file names to virtual file objects.
+ * @brief Index of the source files in a directory.
  */
-typedef std::map<std::string, VIRTUALFILE> filenamemap;
+typedef struct DIRINDEX
+{
+    struct timespec                     m_mtime;    /**< @brief Modification time of directory when the index was built */
+    time_t                              m_built;    /**< @brief Time the index was built */
+    std::map<std::string, std::string>  m_files;    /**< @brief Map lower case file names without extension to source file names */
+    std::list<std::string>::iterator    m_lru;      /**< @brief Position in dirindex_lru */
+} DIRINDEX;
+
+/**
+ * @brief Map directory names to directory indexes.
+ */
+typedef std::map<std::string, DIRINDEX> dirindexmap;
+
+/**
+ * @brief Path known not to exist.
+ */
+typedef struct NEGENTRY
+{
+    struct timespec                     m_mtime;    /**< @brief Modification time of parent directory when the entry was added */
+    time_t                              m_expires;  /**< @brief Entry is not used after this time */
+} NEGENTRY;
+
+/**
+ * @brief Map paths known not to exist to negative entries.
+ */
+typedef std::map<std::string, NEGENTRY> negentrymap;
+
+#define NEGENTRY_TTL            60                  /**< @brief Keep negative entries for one minute */
+#define NEGENTRY_MAX            4096                /**< @brief Maximum number of negative entries */
+#define DIRINDEX_MAX            256                 /**< @brief Maximum number of directory indexes, least recently used ones are dropped */
+
+#define HLS_PLAYLIST            "index.m3u8"        /**< @brief File name of the playlist in HLS directories */
+
+/**
+ * @brief Open file, stored in fuse_file_info::fh.
+ *
+ * Whether a file is passed through or virtual is decided once when it is opened,
+ * so reads do not need to look up the file again.
+ */
+typedef struct OPENFILE
+{
+    int                                 m_fd;           /**< @brief File handle of a real file, -1 for virtual files */
+    LPCVIRTUALFILE                      m_virtualfile;  /**< @brief Virtual file, nullptr for real files */
+    Cache_Entry*                        m_cache_entry;  /**< @brief Cache entry of a transcoded file, nullptr for real files and scripts */
+} OPENFILE;
+typedef OPENFILE* LPOPENFILE;                           /**< @brief Pointer version of OPENFILE */
 
 static void     init_stat(struct stat *stbuf, size_t size, bool directory);
 static void     prepare_script();
 static void     translate_path(std::string *origpath, const char* path);
 static bool     transcoded_name(std::string *filepath, FFmpegfs_Format **current_format = nullptr);
-static filenamemap::const_iterator find_prefix(const filenamemap & map, const std::string & search_for);
+static std::string index_key(const std::string & filename);
+static bool     build_dirindex(const std::string & dir, DIRINDEX *index);
+static void     drop_dirindex(dirindexmap::iterator it);
+static bool     find_dirindex(const std::string & dir, const std::string & filename, std::string *origfile);
+static bool     parent_mtime(const std::string & origpath, struct timespec *mtime);
+static bool     negentry_find(const std::string & origpath);
+static void     negentry_add(const std::string & origpath);
+static void     negentry_log_stats();
+static bool     is_hls_dir(LPCVIRTUALFILE virtualfile);
+static void     init_hls_dirstat(struct stat *stbuf);
+static int      check_hls(const std::string & path, void *buf = nullptr, fuse_fill_dir_t filler = nullptr);
+static LPVIRTUALFILE insert_script(const std::string & path, struct stat *stbuf);
+static bool     virtualfile_in_use(LPCVIRTUALFILE virtualfile);
+static void     openfile_add(LPCVIRTUALFILE virtualfile);
+static void     openfile_remove(LPCVIRTUALFILE virtualfile);
 
 static int      ffmpegfs_readlink(const char *path, char *buf, size_t size);
 static int      ffmpegfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
@@ -73,14 +136,27 @@ static int      ffmpegfs_getattr(const char *path, struct stat *stbuf);
 static int      ffmpegfs_fgetattr(const char *path, struct stat * stbuf, struct fuse_file_info *fi);
 static int      ffmpegfs_open(const char *path, struct fuse_file_info *fi);
 static int      ffmpegfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+#if FUSE_VERSION >= 29
+static int      ffmpegfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi);
+#endif
 static int      ffmpegfs_statfs(const char *path, struct statvfs *stbuf);
 static int      ffmpegfs_release(const char *path, struct fuse_file_info *fi);
 static void     sighandler(int signum);
 static void *   ffmpegfs_init(struct fuse_conn_info *conn);
 static void     ffmpegfs_destroy(__attribute__((unused)) void * p);
 
-static filenamemap          filenames;          /**< @brief Map files to virtual files */
+static Virtual_File_Table   filenames(virtualfile_in_use);  /**< @brief Map files to virtual files */
+static std::map<LPCVIRTUALFILE, unsigned int> openfiles;    /**< @brief Open virtual files and their open counts */
+static std::mutex           openfiles_mutex;    /**< @brief Protects openfiles */
+static dirindexmap          dirindex;           /**< @brief Source files by directory, used to find files not yet in filenames */
+static std::list<std::string> dirindex_lru;     /**< @brief Directories in dirindex, least recently used first */
+static std::mutex           dirindex_mutex;     /**< @brief Protects dirindex and dirindex_lru */
+static negentrymap          negentries;         /**< @brief Paths known not to exist, saves lookups for files players probe for (subtitles, cover art etc.) */
+static std::mutex           negentries_mutex;   /**< @brief Protects negentries and statistics */
+static unsigned int         negentry_hits;      /**< @brief Number of lookups answered from negentries */
+static unsigned int         negentry_misses;    /**< @brief Number of lookups not found in negentries */
 static std::vector<char>    script_file;        /**< @brief Buffer for the virtual script if enabled */
+static std::mutex           hls_mutex;          /**< @brief Serialises building HLS directories */
 
 static struct sigaction     oldHandler;         /**< @brief Saves old SIGINT handler to restore on shutdown */
 
@@ -234,6 +310,9 @@ void init_fuse_ops(void)
     ffmpegfs_ops.readdir  = ffmpegfs_readdir;
     ffmpegfs_ops.open     = ffmpegfs_open;
     ffmpegfs_ops.read     = ffmpegfs_read;
+#if FUSE_VERSION >= 29
+    ffmpegfs_ops.read_buf = ffmpegfs_read_buf;
+#endif
     ffmpegfs_ops.statfs   = ffmpegfs_statfs;
     ffmpegfs_ops.release  = ffmpegfs_release;
     ffmpegfs_ops.init     = ffmpegfs_init;
@@ -373,26 +452,6 @@ static bool transcoded_name(std::string * filepath, FFmpegfs_Format **current_fo
     return false;
 }
 
-/**
- * @brief Find mapped file by prefix. Normally used to find a path.
- * @param[in] map - File map with virtual files.
- * @param[in] search_for - Prefix (path) to search for.
- * @return If found, returns const_iterator to map entry. Returns map.end() if not found.
- */
-static filenamemap::const_iterator find_prefix(const filenamemap & map, const std::string & search_for)
-{
-    filenamemap::const_iterator it = map.lower_bound(search_for);
-    if (it != map.end())
-    {
-        const std::string & key = it->first;
-        if (key.compare(0, search_for.size(), search_for) == 0) // Really a prefix?
-        {
-            return it;
-        }
-    }
-    return map.end();
-}
-
 LPVIRTUALFILE insert_file(VIRTUALTYPE type, const std::string & virtfilepath, const struct stat *stbuf)
 {
     return insert_file(type, virtfilepath, virtfilepath, stbuf);
@@ -400,94 +459,87 @@ LPVIRTUALFILE insert_file(VIRTUALTYPE type, const std::string & virtfilepath, co
 
 LPVIRTUALFILE insert_file(VIRTUALTYPE type, const std::string & virtfilepath, const std::string & origfile, const struct stat *stbuf)
 {
-    std::string sanitised_filepath = sanitise_filepath(virtfilepath);
+    return filenames.insert(sanitise_filepath(virtfilepath), type, sanitise_filepath(origfile), params.guess_format_idx(origfile), stbuf);
+}
 
-    filenamemap::iterator it    = filenames.find(sanitised_filepath);
+LPVIRTUALFILE insert_original(const std::string & origfile, const struct stat *stbuf)
+{
+    FFmpegfs_Format *current_format = nullptr;
+    std::string filename(origfile);
 
-    if (it != filenames.end())
+    if (!transcoded_name(&filename, &current_format))
     {
-        VIRTUALFILE & virtualfile = it->second;
-
-        memcpy(&virtualfile.m_st, stbuf, sizeof(struct stat));
-
-        virtualfile.m_type          = type;
-        virtualfile.m_format_idx    = params.guess_format_idx(origfile);
-        virtualfile.m_origfile      = sanitise_filepath(origfile);
+        return nullptr;
     }
-    else
-    {
-        VIRTUALFILE virtualfile;
 
-        memcpy(&virtualfile.m_st, stbuf, sizeof(struct stat));
-
-        virtualfile.m_type          = type;
-        virtualfile.m_format_idx    = params.guess_format_idx(origfile);
-        virtualfile.m_origfile      = sanitise_filepath(origfile);
-
-        filenames.insert(make_pair(sanitised_filepath, virtualfile));
-        it    = filenames.find(sanitised_filepath);
+    if (current_format->filetype() == FILETYPE_HLS)
+    {
+        // Segments are transcoded when played
+        return nullptr;
     }
 
-    return &it->second;
+    return insert_file(VIRTUALTYPE_DISK, filename, origfile, stbuf);
 }
 
 LPVIRTUALFILE find_file(const std::string & virtfilepath)
 {
-    filenamemap::iterator it = filenames.find(sanitise_filepath(virtfilepath));
+    // Paths are mostly passed in sanitised already, so try without calling realpath() first
+    LPVIRTUALFILE virtualfile = filenames.find(virtfilepath);
 
-    errno = 0;
-
-    if (it != filenames.end())
+    if (virtualfile == nullptr)
     {
-        return &it->second;
+        std::string sanitised_filepath(sanitise_filepath(virtfilepath));
+
+        if (sanitised_filepath != virtfilepath)
+        {
+            virtualfile = filenames.find(sanitised_filepath);
+        }
     }
-    return nullptr;
+
+    errno = 0;
+
+    return virtualfile;
 }
 
 bool check_path(const std::string & path)
 {
-    filenamemap::const_iterator it = find_prefix(filenames, path);
-
-    return (it != filenames.end());
+    return filenames.has_files(path);
 }
 
 int load_path(const std::string & path, const struct stat *statbuf, void *buf, fuse_fill_dir_t filler)
 {
+    std::vector<LPCVIRTUALFILE> files;
     int title_count = 0;
 
-    filenamemap::const_iterator it = filenames.lower_bound(path);
-    while (it != filenames.end())
+    filenames.list(path, &files);
+
+    for (std::vector<LPCVIRTUALFILE>::const_iterator it = files.begin(); it != files.end(); ++it)
     {
-        const std::string & key = it->first;
-        if (key.compare(0, path.size(), path) == 0) // Really a prefix?
-        {
-            LPCVIRTUALFILE virtualfile = &it->second;
-            struct stat stbuf;
-            std::string destfile;
+        LPCVIRTUALFILE virtualfile = *it;
+        struct stat stbuf;
+        std::string destfile;
 
-            get_destname(&destfile, virtualfile->m_origfile);
-            remove_path(&destfile);
+        get_destname(&destfile, virtualfile->m_origfile.str());
+        remove_path(&destfile);
 
-            title_count++;
+        title_count++;
 
-            memcpy(&stbuf, statbuf, sizeof(struct stat));
+        memcpy(&stbuf, statbuf, sizeof(struct stat));
 
-            stbuf.st_size   = virtualfile->m_st.st_size;
-            stbuf.st_blocks = (stbuf.st_size + 512 - 1) / 512;
+        stbuf.st_size   = virtualfile->m_st.st_size;
+        stbuf.st_blocks = (stbuf.st_size + 512 - 1) / 512;
 
-            if (buf != nullptr && filler(buf, destfile.c_str(), &stbuf, 0))
-            {
-                // break;
-            }
+        if (buf != nullptr && filler(buf, destfile.c_str(), &stbuf, 0))
+        {
+            // break;
         }
-        it++;
     }
 
     return title_count;
 }
 
 /**
- * @brief Filter function used for scandir.
+ * @brief Filter function used for building directory indexes.
  *
  * Selects files that can be processed with FFmpeg API.
  *
@@ -506,6 +558,282 @@ static int selector(const struct dirent * de)
     }
 }
 
+/**
+ * @brief Make index key from a file name: Remove extension and convert to lower case.
+ * @param[in] filename - File name without path.
+ * @return Returns index key.
+ */
+static std::string index_key(const std::string & filename)
+{
+    std::string key(filename);
+
+    remove_ext(&key);
+
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+    return key;
+}
+
+/**
+ * @brief Build index of source files in a directory.
+ * @param[in] dir - Directory to index.
+ * @param[out] index - Directory index.
+ * @return Returns true on success; false on error. Check errno for details.
+ */
+static bool build_dirindex(const std::string & dir, DIRINDEX *index)
+{
+    struct stat stbuf;
+
+    DIR *dp = opendir(dir.c_str());
+    if (dp == nullptr)
+    {
+        return false;
+    }
+
+    if (fstat(dirfd(dp), &stbuf) == -1)
+    {
+        int _errno = errno;
+        closedir(dp);
+        errno = _errno;
+        return false;
+    }
+
+    index->m_mtime      = stbuf.st_mtim;
+    index->m_built      = time(nullptr);
+    index->m_files.clear();
+
+    struct dirent *de;
+    while ((de = readdir(dp)) != nullptr)
+    {
+        if (selector(de))
+        {
+            // If there are several files with the same name, the first one found wins
+            index->m_files.insert(make_pair(index_key(de->d_name), de->d_name));
+        }
+    }
+
+    closedir(dp);
+
+    Logging::trace(dir, "Indexed %1 source files.", index->m_files.size());
+
+    errno = 0;
+
+    return true;
+}
+
+/**
+ * @brief Remove a directory index. dirindex_mutex must be held by the caller.
+ * @param[in] it - Directory index to remove.
+ */
+static void drop_dirindex(dirindexmap::iterator it)
+{
+    dirindex_lru.erase(it->second.m_lru);
+    dirindex.erase(it);
+}
+
+/**
+ * @brief Find source file for a transcoded file name in the directory index.
+ *
+ * The index is created on first access and rebuilt when the directory has been modified.
+ * Only the DIRINDEX_MAX most recently used directories are kept.
+ *
+ * @param[in] dir - Directory of file.
+ * @param[in] filename - Transcoded file name without path.
+ * @param[out] origfile - Source file name without path.
+ * @return Returns true if found; false if not or on error. Check errno for details.
+ */
+static bool find_dirindex(const std::string & dir, const std::string & filename, std::string *origfile)
+{
+    std::lock_guard<std::mutex> lock(dirindex_mutex);
+    struct stat stbuf;
+
+    dirindexmap::iterator it = dirindex.find(dir);
+
+    if (stat(dir.c_str(), &stbuf) == -1)
+    {
+        if (it != dirindex.end())
+        {
+            drop_dirindex(it);
+        }
+        return false;
+    }
+
+    bool fresh = false;
+
+    if (it == dirindex.end())
+    {
+        if (dirindex.size() >= DIRINDEX_MAX)
+        {
+            // Make room, drop the least recently used directory
+            drop_dirindex(dirindex.find(dirindex_lru.front()));
+        }
+
+        it = dirindex.insert(make_pair(dir, DIRINDEX())).first;
+        it->second.m_lru = dirindex_lru.insert(dirindex_lru.end(), dir);
+        fresh = true;
+    }
+    else
+    {
+        dirindex_lru.splice(dirindex_lru.end(), dirindex_lru, it->second.m_lru);
+
+        if (it->second.m_mtime.tv_sec != stbuf.st_mtim.tv_sec || it->second.m_mtime.tv_nsec != stbuf.st_mtim.tv_nsec)
+        {
+            fresh = true;
+        }
+    }
+
+    if (fresh && !build_dirindex(dir, &it->second))
+    {
+        drop_dirindex(it);
+        return false;
+    }
+
+    std::string key(index_key(filename));
+    std::map<std::string, std::string>::const_iterator file = it->second.m_files.find(key);
+
+    if (file == it->second.m_files.end() && !fresh && it->second.m_mtime.tv_sec >= it->second.m_built)
+    {
+        // Directory was changed in the same second the index was built, changes may not show in the modification time
+        if (!build_dirindex(dir, &it->second))
+        {
+            drop_dirindex(it);
+            return false;
+        }
+        file = it->second.m_files.find(key);
+    }
+
+    errno = 0;
+
+    if (file == it->second.m_files.end())
+    {
+        return false;
+    }
+
+    *origfile = file->second;
+
+    return true;
+}
+
+/**
+ * @brief Get modification time of the directory a file resides in.
+ * @param[in] origpath - Source path of file.
+ * @param[out] mtime - Modification time of directory.
+ * @return Returns true on success; false on error.
+ */
+static bool parent_mtime(const std::string & origpath, struct timespec *mtime)
+{
+    std::string dir(origpath);
+    struct stat stbuf;
+
+    remove_filename(&dir);
+
+    if (stat(dir.c_str(), &stbuf) == -1)
+    {
+        return false;
+    }
+
+    *mtime = stbuf.st_mtim;
+
+    return true;
+}
+
+/**
+ * @brief Check if a path is known not to exist.
+ *
+ * Entries expire after NEGENTRY_TTL seconds or when the parent directory has been modified.
+ *
+ * @param[in] origpath - Source path of file.
+ * @return Returns true if the path is known not to exist; false if it may exist.
+ */
+static bool negentry_find(const std::string & origpath)
+{
+    std::lock_guard<std::mutex> lock(negentries_mutex);
+
+    negentrymap::iterator it = negentries.find(origpath);
+
+    if (it != negentries.end())
+    {
+        struct timespec mtime;
+
+        if (it->second.m_expires >= time(nullptr) &&
+                parent_mtime(origpath, &mtime) &&
+                it->second.m_mtime.tv_sec == mtime.tv_sec && it->second.m_mtime.tv_nsec == mtime.tv_nsec)
+        {
+            negentry_hits++;
+            return true;
+        }
+
+        negentries.erase(it);
+    }
+
+    negentry_misses++;
+
+    return false;
+}
+
+/**
+ * @brief Remember that a path does not exist.
+ * @param[in] origpath - Source path of file.
+ */
+static void negentry_add(const std::string & origpath)
+{
+    NEGENTRY negentry;
+
+    if (!parent_mtime(origpath, &negentry.m_mtime))
+    {
+        // Parent gone as well, nothing to check against
+        return;
+    }
+
+    negentry.m_expires = time(nullptr) + NEGENTRY_TTL;
+
+    std::lock_guard<std::mutex> lock(negentries_mutex);
+
+    if (negentries.size() >= NEGENTRY_MAX)
+    {
+        // Make room: Drop expired entries, if that does not help, start over.
+        time_t now = time(nullptr);
+
+        for (negentrymap::iterator it = negentries.begin(); it != negentries.end();)
+        {
+            if (it->second.m_expires < now)
+            {
+                it = negentries.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        if (negentries.size() >= NEGENTRY_MAX)
+        {
+            negentries.clear();
+        }
+    }
+
+    negentries[origpath] = negentry;
+}
+
+/**
+ * @brief Log negative lookup cache statistics.
+ */
+static void negentry_log_stats()
+{
+    std::lock_guard<std::mutex> lock(negentries_mutex);
+
+    if (!negentry_hits && !negentry_misses)
+    {
+        return;
+    }
+
+    Logging::info(nullptr, "Negative lookup cache: %1 hits, %2 misses (%3% hit rate), %4 entries.",
+                  negentry_hits,
+                  negentry_misses,
+                  (negentry_hits * 100) / (negentry_hits + negentry_misses),
+                  negentries.size());
+}
+
 LPVIRTUALFILE find_original(const std::string & origpath)
 {
     std::string buffer(origpath);
@@ -514,63 +842,48 @@ LPVIRTUALFILE find_original(const std::string & origpath)
 
 LPVIRTUALFILE find_original(std::string * filepath)
 {
-    sanitise_filepath(filepath);
-
     LPVIRTUALFILE virtualfile = find_file(*filepath);
 
     errno = 0;
 
     if (virtualfile != nullptr)
     {
-        *filepath = virtualfile->m_origfile;
+        *filepath = virtualfile->m_origfile.str();
         return virtualfile;
     }
     else
     {
+        sanitise_filepath(filepath);
+
         // Fallback to old method (required if file accessed directly)
         std::string ext;
         if (find_ext(&ext, *filepath) && (strcasecmp(ext, params.m_format[0].fileext()) == 0 || (params.smart_transcode() && strcasecmp(ext, params.m_format[1].fileext()) == 0)))
         {
             std::string dir(*filepath);
             std::string filename(*filepath);
-            std::string tmppath;
-            struct dirent **namelist;
+            std::string origfile;
             struct stat stbuf;
-            int count;
-            int found = 0;
 
             remove_filename(&dir);
-            tmppath = dir;
+            remove_path(&filename);
 
-            count = scandir(dir.c_str(), &namelist, selector, nullptr);
-            if (count == -1)
+            if (!find_dirindex(dir, filename, &origfile))
             {
-                if (errno != ENOTDIR)   // If not a directory, simply ignore error
+                if (errno && errno != ENOTDIR && errno != ENOENT)   // If not a directory, simply ignore error
                 {
                     Logging::error(dir, "Error scanning directory: (%1) %2", errno, strerror(errno));
                 }
+                // File does not exist; not an error
+                errno = 0;
                 return nullptr;
             }
 
-            remove_path(&filename);
-            std::regex specialChars { R"([-[\]{}()*+?.,\^$|#\s])" };
-            filename = std::regex_replace(filename, specialChars, R"(\$&)");
-            replace_ext(&filename, "*");
-
-            for (int n = 0; n < count; n++)
-            {
-                if (!found && !compare(namelist[n]->d_name, filename))
-                {
-                    append_filename(&tmppath, namelist[n]->d_name);
-                    found = 1;
-                }
-                free(namelist[n]);
-            }
-            free(namelist);
+            std::string tmppath(dir);
 
+            append_filename(&tmppath, origfile);
             sanitise_filepath(&tmppath);
 
-            if (found && lstat(tmppath.c_str(), &stbuf) == 0)
+            if (lstat(tmppath.c_str(), &stbuf) == 0)
             {
                 // File exists with this extension
                 LPVIRTUALFILE virtualfile = insert_file(VIRTUALTYPE_DISK, *filepath, tmppath, &stbuf);
@@ -598,6 +911,243 @@ LPVIRTUALFILE find_parent(const std::string & origpath)
     return find_original(&filepath);
 }
 
+std::string hls_segment_name(uint32_t segment_no)
+{
+    char name_buf[32];
+
+    snprintf(name_buf, sizeof(name_buf) - 1, "%06u.ts", segment_no);
+
+    return name_buf;
+}
+
+/**
+ * @brief Check if a virtual file is a source file transcoded to HLS.
+ *
+ * These show up as directories containing a playlist and the segments.
+ *
+ * @param[in] virtualfile - Virtual file to check.
+ * @return Returns true if the file is an HLS directory; false if not.
+ */
+static bool is_hls_dir(LPCVIRTUALFILE virtualfile)
+{
+    if (virtualfile->m_type != VIRTUALTYPE_DISK)
+    {
+        return false;
+    }
+
+    FFmpegfs_Format *current_format = params.current_format(virtualfile);
+
+    return (current_format != nullptr && current_format->filetype() == FILETYPE_HLS);
+}
+
+/**
+ * @brief Turn the stat structure of a source file into that of its HLS directory.
+ * @param[inout] stbuf - struct stat of the source file.
+ */
+static void init_hls_dirstat(struct stat *stbuf)
+{
+    stbuf->st_mode = (stbuf->st_mode & ~static_cast<mode_t>(S_IFMT)) | S_IFDIR;
+
+    // Directories can be entered where they can be read
+    if (stbuf->st_mode & S_IRUSR)
+    {
+        stbuf->st_mode |= S_IXUSR;
+    }
+    if (stbuf->st_mode & S_IRGRP)
+    {
+        stbuf->st_mode |= S_IXGRP;
+    }
+    if (stbuf->st_mode & S_IROTH)
+    {
+        stbuf->st_mode |= S_IXOTH;
+    }
+
+    stbuf->st_nlink     = 2;
+    stbuf->st_size      = 0;
+    stbuf->st_blocks    = 0;
+}
+
+/**
+ * @brief Create the playlist and segments of an HLS directory.
+ *
+ * The segments are added as virtual files and transcoded when played.
+ * The source file is only probed once for its duration.
+ *
+ * @param[in] path - Path of the HLS directory.
+ * @param[in] buf - FUSE buffer to fill. May be nullptr.
+ * @param[in] filler - Filler function. May be nullptr.
+ * @return Returns the number of segments, 0 if path is not an HLS directory, or -errno on error.
+ */
+static int check_hls(const std::string & path, void *buf, fuse_fill_dir_t filler)
+{
+    std::string dirpath(path);
+
+    remove_sep(&dirpath);
+
+    LPVIRTUALFILE dirfile = find_original(dirpath);
+    if (dirfile == nullptr || !is_hls_dir(dirfile))
+    {
+        errno = 0;
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(hls_mutex);
+
+    int64_t duration = 0;
+
+    if (!transcoder_get_duration(dirfile, &duration) || duration <= 0)
+    {
+        Logging::error(dirpath, "HLS: Unable to get play time of %1.", dirfile->m_origfile.str().c_str());
+        return -(errno ? errno : EIO);
+    }
+
+    int64_t segment_duration    = static_cast<int64_t>(params.m_segment_duration) * AV_TIME_BASE;
+    uint32_t segments           = static_cast<uint32_t>((duration + segment_duration - 1) / segment_duration);
+    std::string playlist;
+    char line_buf[64];
+
+    append_sep(&dirpath);
+
+    snprintf(line_buf, sizeof(line_buf) - 1, "#EXT-X-TARGETDURATION:%u\n", params.m_segment_duration);
+
+    playlist  = "#EXTM3U\n";
+    playlist += "#EXT-X-VERSION:3\n";
+    playlist += line_buf;
+    playlist += "#EXT-X-MEDIA-SEQUENCE:1\n";
+    playlist += "#EXT-X-PLAYLIST-TYPE:VOD\n";
+
+    for (uint32_t segment_no = 1; segment_no <= segments; segment_no++)
+    {
+        std::string segment_name(hls_segment_name(segment_no));
+        int64_t start_pos   = (segment_no - 1) * segment_duration;
+        int64_t end_pos     = (segment_no < segments) ? start_pos + segment_duration : AV_NOPTS_VALUE;
+        int64_t play_time   = (segment_no < segments) ? segment_duration : duration - start_pos;
+        struct stat stbuf;
+
+        snprintf(line_buf, sizeof(line_buf) - 1, "#EXTINF:%.3f,\n", static_cast<double>(play_time) / AV_TIME_BASE);
+
+        playlist += line_buf;
+        playlist += segment_name + "\n";
+
+        // Size is estimated from the source until the segment has been probed
+        memcpy(&stbuf, &dirfile->m_st, sizeof(struct stat));
+        stbuf.st_mode   = (stbuf.st_mode & ~static_cast<mode_t>(S_IFMT)) | S_IFREG;
+        stbuf.st_nlink  = 1;
+        stbuf.st_size   = static_cast<off_t>(static_cast<double>(dirfile->m_st.st_size) * play_time / duration);
+        stbuf.st_blocks = (stbuf.st_size + 512 - 1) / 512;
+
+        LPVIRTUALFILE virtualfile = insert_file(VIRTUALTYPE_HLS, dirpath + segment_name, &stbuf);
+
+        virtualfile->m_format_idx       = dirfile->m_format_idx;
+        virtualfile->m_duration         = play_time;
+        virtualfile->m_hls.m_segment_no = segment_no;
+        virtualfile->m_hls.m_start_pos  = start_pos;
+        virtualfile->m_hls.m_end_pos    = end_pos;
+        if (virtualfile->m_hls.m_srcfile != dirfile->m_origfile)
+        {
+            virtualfile->m_hls.m_srcfile = dirfile->m_origfile;
+        }
+
+        if (buf != nullptr && filler(buf, segment_name.c_str(), &stbuf, 0))
+        {
+            // break;
+        }
+    }
+
+    playlist += "#EXT-X-ENDLIST\n";
+
+    {
+        struct stat stbuf;
+
+        init_stat(&stbuf, playlist.size(), false);
+        stbuf.st_mtime = dirfile->m_st.st_mtime;
+
+        LPVIRTUALFILE virtualfile = insert_file(VIRTUALTYPE_SCRIPT, dirpath + HLS_PLAYLIST, &stbuf);
+
+        if (virtualfile->m_file_contents.size() != playlist.size() || !std::equal(playlist.begin(), playlist.end(), virtualfile->m_file_contents.begin()))
+        {
+            virtualfile->m_file_contents.assign(playlist.begin(), playlist.end());
+        }
+
+        if (buf != nullptr && filler(buf, HLS_PLAYLIST, &stbuf, 0))
+        {
+            // break;
+        }
+    }
+
+    Logging::trace(dirpath, "HLS: %1 segments of %2 for %3.", segments, format_duration(segment_duration, 0).c_str(), dirfile->m_origfile.str().c_str());
+
+    errno = 0;
+
+    return static_cast<int>(segments);
+}
+
+/**
+ * @brief Add the virtual script to a directory.
+ * @param[in] path - Path of the directory, with trailing slash.
+ * @param[out] stbuf - stat buffer of the script.
+ * @return Returns the virtual file of the script, nullptr if out of memory.
+ */
+static LPVIRTUALFILE insert_script(const std::string & path, struct stat *stbuf)
+{
+    init_stat(stbuf, script_file.size(), false);
+
+    LPVIRTUALFILE virtualfile = insert_file(VIRTUALTYPE_SCRIPT, path + params.m_scriptfile, stbuf);
+
+    if (virtualfile != nullptr)
+    {
+        virtualfile->m_file_contents = script_file;
+    }
+
+    return virtualfile;
+}
+
+/**
+ * @brief Check if a virtual file that has been removed from the table is still in use.
+ * @param[in] virtualfile - Virtual file to check.
+ * @return Returns true if the file is open or referenced by a cache entry; false if not.
+ */
+static bool virtualfile_in_use(LPCVIRTUALFILE virtualfile)
+{
+    {
+        std::lock_guard<std::mutex> lock(openfiles_mutex);
+
+        if (openfiles.find(virtualfile) != openfiles.end())
+        {
+            return true;
+        }
+    }
+
+    return transcoder_in_use(virtualfile);
+}
+
+/**
+ * @brief Register an open virtual file, so it is not freed while it is open.
+ * @param[in] virtualfile - Virtual file that has been opened.
+ */
+static void openfile_add(LPCVIRTUALFILE virtualfile)
+{
+    std::lock_guard<std::mutex> lock(openfiles_mutex);
+
+    openfiles[virtualfile]++;
+}
+
+/**
+ * @brief Unregister an open virtual file.
+ * @param[in] virtualfile - Virtual file that has been closed.
+ */
+static void openfile_remove(LPCVIRTUALFILE virtualfile)
+{
+    std::lock_guard<std::mutex> lock(openfiles_mutex);
+
+    std::map<LPCVIRTUALFILE, unsigned int>::iterator it = openfiles.find(virtualfile);
+
+    if (it != openfiles.end() && !--it->second)
+    {
+        openfiles.erase(it);
+    }
+}
+
 /**
  * @brief Read the target of a symbolic link.
  * @param[in] path
@@ -645,9 +1195,7 @@ static int ffmpegfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     std::string origpath;
     DIR *dp;
     struct dirent *de;
-#if defined(USE_LIBBLURAY) || defined(USE_LIBDVD) || defined(USE_LIBVCD)
     int res;
-#endif
 
     Logging::trace(path, "readdir");
 
@@ -657,19 +1205,14 @@ static int ffmpegfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     // Add a virtual script if enabled
     if (params.m_enablescript)
     {
-        std::string filename(params.m_scriptfile);
         struct stat stbuf;
 
-        init_stat(&stbuf, script_file.size(), false);
+        insert_script(origpath, &stbuf);
 
-        if (filler(buf, filename.c_str(), &stbuf, 0))
+        if (filler(buf, params.m_scriptfile.c_str(), &stbuf, 0))
         {
             // break;
         }
-
-        LPVIRTUALFILE virtualfile = insert_file(VIRTUALTYPE_SCRIPT, origpath + filename, &stbuf);
-
-        virtualfile->m_file_contents = script_file;
     }
 
 #ifdef USE_LIBVCD
@@ -697,6 +1240,13 @@ static int ffmpegfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     }
 #endif // USE_LIBBLURAY
 
+    res = check_hls(origpath, buf, filler);
+    if (res != 0)
+    {
+        // Found HLS directory or error reading source file
+        return (res >= 0 ?  0 : res);
+    }
+
     dp = opendir(origpath.c_str());
     if (dp != nullptr)
     {
@@ -722,6 +1272,12 @@ static int ffmpegfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                     if (transcoded_name(&filename, &current_format))
                     {
                         insert_file(VIRTUALTYPE_DISK, origpath + filename, origfile, &stbuf);
+
+                        if (current_format->filetype() == FILETYPE_HLS)
+                        {
+                            // Playlist and segments are listed in a directory
+                            init_hls_dirstat(&stbuf);
+                        }
                     }
                 }
 
@@ -770,8 +1326,48 @@ static int ffmpegfs_getattr(const char *path, struct stat *stbuf)
         errno = 0;
     }
 
+    if (find_file(origpath) == nullptr)
+    {
+        if (negentry_find(origpath))
+        {
+            // Known not to exist, and not added as virtual file (e.g. DVD title) since
+            return -ENOENT;
+        }
+
+        // Files in HLS directories are added when the directory is accessed first,
+        // files dropped from the table are added again here
+        std::string dirpath(origpath);
+        std::string filename(origpath);
+
+        remove_filename(&dirpath);
+        remove_path(&filename);
+
+        if (params.m_enablescript && filename == params.m_scriptfile)
+        {
+            struct stat scriptstat;
+
+            insert_script(dirpath, &scriptstat);
+        }
+        else
+        {
+            check_hls(dirpath);
+        }
+    }
+
+    std::string lookuppath(origpath);
+
     // This is a virtual file
     LPVIRTUALFILE virtualfile = find_original(&origpath);
+
+    if (virtualfile != nullptr && is_hls_dir(virtualfile))
+    {
+        // Source file transcoded to HLS
+        mempcpy(stbuf, &virtualfile->m_st, sizeof(struct stat));
+        init_hls_dirstat(stbuf);
+        errno = 0;
+        return 0;
+    }
+
     VIRTUALTYPE type = (virtualfile != nullptr) ? virtualfile->m_type : VIRTUALTYPE_DISK;
 
     bool no_check = false;
@@ -794,6 +1390,7 @@ static int ffmpegfs_getattr(const char *path, struct stat *stbuf)
 #ifdef USE_LIBBLURAY
     case VIRTUALTYPE_BLURAY:
 #endif // USE_LIBBLURAY
+    case VIRTUALTYPE_HLS:
     {
         // Use stored status
         mempcpy(stbuf, &virtualfile->m_st, sizeof(struct stat));
@@ -842,6 +1439,10 @@ static int ffmpegfs_getattr(const char *path, struct stat *stbuf)
                     if (res <= 0)
                     {
                         // No Bluray/DVD/VCD found or error reading disk
+                        if (!res && error == -ENOENT)
+                        {
+                            negentry_add(lookuppath);
+                        }
                         return (!res ?  error : res);
                     }
                 }
@@ -851,11 +1452,16 @@ static int ffmpegfs_getattr(const char *path, struct stat *stbuf)
                 if (virtualfile == nullptr)
                 {
                     // Not a DVD/VCD/Bluray file
+                    negentry_add(lookuppath);
                     return -ENOENT;
                 }
 
                 mempcpy(stbuf, &virtualfile->m_st, sizeof(struct stat));
 #else
+                if (error == -ENOENT)
+                {
+                    negentry_add(lookuppath);
+                }
                 return error;
 #endif
             }
@@ -866,7 +1472,7 @@ static int ffmpegfs_getattr(const char *path, struct stat *stbuf)
         {
             if (virtualfile != nullptr)
             {
-                assert(virtualfile->m_origfile == origpath);
+                assert(virtualfile->m_origfile.str() == origpath);
 
                 if (!transcoder_cached_filesize(virtualfile, stbuf))
                 {
@@ -918,10 +1524,22 @@ static int ffmpegfs_fgetattr(const char *path, struct stat * stbuf, struct fuse_
 {
     std::string origpath;
 
+    LPOPENFILE openfile = reinterpret_cast<LPOPENFILE>(fi->fh);
+
     Logging::trace(path, "fgetattr");
 
     errno = 0;
 
+    if (openfile != nullptr && openfile->m_fd != -1)
+    {
+        // pass-through for regular files
+        if (fstat(openfile->m_fd, stbuf) == -1)
+        {
+            return -errno;
+        }
+        return 0;
+    }
+
     translate_path(&origpath, path);
 
     if (lstat(origpath.c_str(), stbuf) == 0)
@@ -937,9 +1555,21 @@ static int ffmpegfs_fgetattr(const char *path, struct stat * stbuf, struct fuse_
     }
 
     // This is a virtual file
-    LPCVIRTUALFILE virtualfile = find_original(&origpath);
+    LPCVIRTUALFILE virtualfile = (openfile != nullptr) ? openfile->m_virtualfile : nullptr;
 
-    assert(virtualfile != nullptr);
+    if (virtualfile != nullptr)
+    {
+        origpath = virtualfile->m_origfile.str();
+    }
+    else
+    {
+        virtualfile = find_original(&origpath);
+
+        if (virtualfile == nullptr)
+        {
+            return -ENOENT;
+        }
+    }
 
     bool no_check = false;
 
@@ -961,6 +1591,7 @@ static int ffmpegfs_fgetattr(const char *path, struct stat * stbuf, struct fuse_
 #ifdef USE_LIBBLURAY
     case VIRTUALTYPE_BLURAY:
 #endif // USE_LIBBLURAY
+    case VIRTUALTYPE_HLS:
     {
         // Use stored status
         mempcpy(stbuf, &virtualfile->m_st, sizeof(struct stat));
@@ -980,7 +1611,7 @@ static int ffmpegfs_fgetattr(const char *path, struct stat * stbuf, struct fuse_
         // Get size for resulting output file from regular file, otherwise it's a symbolic link.
         if (S_ISREG(stbuf->st_mode))
         {
-            Cache_Entry* cache_entry = reinterpret_cast<Cache_Entry*>(fi->fh);
+            Cache_Entry* cache_entry = (openfile != nullptr) ? openfile->m_cache_entry : nullptr;
 
             if (cache_entry == nullptr)
             {
@@ -1038,10 +1669,24 @@ static int ffmpegfs_open(const char *path, struct fuse_file_info *fi)
         errno = 0;
     }
 
+    LPOPENFILE openfile = new(std::nothrow) OPENFILE;
+    if (openfile == nullptr)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -ENOMEM;
+    }
+
+    openfile->m_fd          = fd;
+    openfile->m_virtualfile = nullptr;
+    openfile->m_cache_entry = nullptr;
+
     if (fd != -1)
     {
-        close(fd);
-        // File is real and can be opened.
+        // File is real and can be opened. Keep it open for reads.
+        fi->fh = reinterpret_cast<uintptr_t>(openfile);
         errno = 0;
         return 0;
     }
@@ -1049,7 +1694,25 @@ static int ffmpegfs_open(const char *path, struct fuse_file_info *fi)
     // This is a virtual file
     LPVIRTUALFILE virtualfile = find_original(&origpath);
 
-    assert(virtualfile != nullptr);
+    if (virtualfile == nullptr)
+    {
+        // Removed from the table since it was looked up, getattr adds it again
+        struct stat stbuf;
+
+        if (ffmpegfs_getattr(path, &stbuf) == 0)
+        {
+            translate_path(&origpath, path);
+            virtualfile = find_original(&origpath);
+        }
+
+        if (virtualfile == nullptr)
+        {
+            delete openfile;
+            return -ENOENT;
+        }
+    }
+
+    openfile->m_virtualfile = virtualfile;
 
     switch (virtualfile->m_type)
     {
@@ -1067,19 +1730,35 @@ static int ffmpegfs_open(const char *path, struct fuse_file_info *fi)
 #ifdef USE_LIBBLURAY
     case VIRTUALTYPE_BLURAY:
 #endif // USE_LIBBLURAY
+    case VIRTUALTYPE_HLS:
     case VIRTUALTYPE_DISK:
     {
         cache_entry = transcoder_new(virtualfile, true);
         if (cache_entry == nullptr)
         {
-            return -errno;
+            int _errno = errno;
+            delete openfile;
+            return -_errno;
+        }
+
+        openfile->m_cache_entry = cache_entry;
+
+        if (cache_entry->m_cache_info.m_finished && cache_entry->m_cache_info.m_encoded_filesize)
+        {
+            // Size is exact, let the kernel cache the file. Keep what is already cached
+            // unless the file has been transcoded again since.
+            fi->direct_io   = 0;
+            fi->keep_cache  = (cache_entry->m_kernel_generation == cache_entry->m_generation);
+        }
+        else
+        {
+            // Need this because we do not know the exact size in advance.
+            // Also drops anything cached by the kernel from a previous transcode.
+            fi->direct_io   = 1;
+            fi->keep_cache  = 0;
         }
 
-        // Store transcoder in the fuse_file_info structure.
-        fi->fh = reinterpret_cast<uintptr_t>(cache_entry);
-        // Need this because we do not know the exact size in advance.
-        fi->direct_io = 1;
-        //        fi->keep_cache = 1;
+        cache_entry->m_kernel_generation = cache_entry->m_generation.load();
 
         // Clear errors
         errno = 0;
@@ -1093,6 +1772,11 @@ static int ffmpegfs_open(const char *path, struct fuse_file_info *fi)
     }
     }
 
+    openfile_add(virtualfile);
+
+    // Store open file in the fuse_file_info structure.
+    fi->fh = reinterpret_cast<uintptr_t>(openfile);
+
     return 0;
 }
 
@@ -1107,21 +1791,22 @@ static int ffmpegfs_open(const char *path, struct fuse_file_info *fi)
  */
 static int ffmpegfs_read(const char *path, char *buf, size_t size, off_t _offset, struct fuse_file_info *fi)
 {
-    std::string origpath;
     size_t offset = static_cast<size_t>(_offset);  // Cast OK: offset can never be < 0.
     int bytes_read = 0;
-    Cache_Entry* cache_entry;
+    LPOPENFILE openfile = reinterpret_cast<LPOPENFILE>(fi->fh);
 
     Logging::trace(path, "read: Reading %1 bytes from %2.", size, offset);
 
-    translate_path(&origpath, path);
+    if (openfile == nullptr)
+    {
+        Logging::error(path, "read: Tried to read from unopen file.");
+        return -EBADF;
+    }
 
-    int fd = open(origpath.c_str(), O_RDONLY);
-    if (fd != -1)
+    if (openfile->m_fd != -1)
     {
         // If this is a real file, pass the call through.
-        bytes_read = static_cast<int>(pread(fd, buf, size, _offset));
-        close(fd);
+        bytes_read = static_cast<int>(pread(openfile->m_fd, buf, size, _offset));
         if (bytes_read >= 0)
         {
             return bytes_read;
@@ -1131,19 +1816,9 @@ static int ffmpegfs_read(const char *path, char *buf, size_t size, off_t _offset
             return -errno;
         }
     }
-    else if (errno != ENOENT)
-    {
-        // File does exist, but can't be opened.
-        return -errno;
-    }
-    else
-    {
-        // File does not exist, and this is fine.
-        errno = 0;
-    }
 
-    LPCVIRTUALFILE virtualfile = find_original(&origpath);
     // This is a virtual file
+    LPCVIRTUALFILE virtualfile = openfile->m_virtualfile;
     bool success = true;
 
     assert(virtualfile != nullptr);
@@ -1181,20 +1856,18 @@ static int ffmpegfs_read(const char *path, char *buf, size_t size, off_t _offset
 #ifdef USE_LIBBLURAY
     case VIRTUALTYPE_BLURAY:
 #endif // USE_LIBBLURAY
+    case VIRTUALTYPE_HLS:
     case VIRTUALTYPE_DISK:
     {
-        cache_entry = reinterpret_cast<Cache_Entry*>(fi->fh);
+        Cache_Entry* cache_entry = openfile->m_cache_entry;
 
         if (cache_entry == nullptr)
         {
-            if (errno)
-            {
-                Logging::error(origpath.c_str(), "read: Tried to read from unopen file: (%1) %2", errno, strerror(errno));
-            }
-            return -errno;
+            Logging::error(path, "read: Tried to read from unopen file.");
+            return -EBADF;
         }
 
-        success = transcoder_read(cache_entry, buf, offset, size, &bytes_read);
+        success = transcoder_read(cache_entry, buf, offset, size, &bytes_read, openfile);
 
         break;
     }
@@ -1216,6 +1889,85 @@ static int ffmpegfs_read(const char *path, char *buf, size_t size, off_t _offset
     }
 }
 
+#if FUSE_VERSION >= 29
+/**
+ * @brief Read data from an open file into a FUSE buffer
+ *
+ * Data already in the cache file is returned as a file descriptor based buffer,
+ * so FUSE can splice it to the kernel without copying it in user space. Otherwise
+ * falls back to ffmpegfs_read(), waiting for the transcoder if necessary.
+ *
+ * @param[in] path
+ * @param[out] bufp
+ * @param[in] size
+ * @param[in] _offset
+ * @param[in] fi
+ * @return On success, returns 0. On error, returns -errno.
+ */
+static int ffmpegfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t _offset, struct fuse_file_info *fi)
+{
+    size_t offset = static_cast<size_t>(_offset);  // Cast OK: offset can never be < 0.
+    LPOPENFILE openfile = reinterpret_cast<LPOPENFILE>(fi->fh);
+    Cache_Entry* cache_entry = (openfile != nullptr) ? openfile->m_cache_entry : nullptr;
+
+    struct fuse_bufvec *src = static_cast<struct fuse_bufvec *>(malloc(sizeof(struct fuse_bufvec)));
+    if (src == nullptr)
+    {
+        return -ENOMEM;
+    }
+
+    memset(src, 0, sizeof(struct fuse_bufvec));
+    src->count = 1;
+
+    int fd;
+    size_t bytes_read;
+
+    if (openfile != nullptr && openfile->m_fd != -1)
+    {
+        // Real file, let FUSE read or splice directly from it
+        src->buf[0].flags   = static_cast<enum fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        src->buf[0].fd      = openfile->m_fd;
+        src->buf[0].pos     = _offset;
+        src->buf[0].size    = size;
+    }
+    // Only transcoded files have a cache entry, scripts are read by ffmpegfs_read()
+    else if (cache_entry != nullptr && transcoder_read_fd(cache_entry, offset, size, &fd, &bytes_read))
+    {
+        Logging::trace(path, "read_buf: Reading %1 bytes from %2 from cache file.", bytes_read, offset);
+
+        src->buf[0].flags   = static_cast<enum fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        src->buf[0].fd      = fd;
+        src->buf[0].pos     = _offset;
+        src->buf[0].size    = bytes_read;
+    }
+    else
+    {
+        char *buf = static_cast<char *>(malloc(size));
+        if (buf == nullptr)
+        {
+            free(src);
+            return -ENOMEM;
+        }
+
+        int res = ffmpegfs_read(path, buf, size, _offset, fi);
+        if (res < 0)
+        {
+            free(buf);
+            free(src);
+            return res;
+        }
+
+        // Will be freed by FUSE
+        src->buf[0].mem     = buf;
+        src->buf[0].size    = static_cast<size_t>(res);
+    }
+
+    *bufp = src;
+
+    return 0;
+}
+#endif // FUSE_VERSION >= 29
+
 /**
  * @brief Get file system statistics
  * @param[in] path
@@ -1258,13 +2010,29 @@ static int ffmpegfs_statfs(const char *path, struct statvfs *stbuf)
  */
 static int ffmpegfs_release(const char *path, struct fuse_file_info *fi)
 {
-    Cache_Entry*     cache_entry = reinterpret_cast<Cache_Entry*>(fi->fh);
+    LPOPENFILE openfile = reinterpret_cast<LPOPENFILE>(fi->fh);
 
     Logging::trace(path, "release");
 
-    if (cache_entry != nullptr)
+    if (openfile != nullptr)
     {
-        transcoder_delete(cache_entry);
+        if (openfile->m_fd != -1)
+        {
+            close(openfile->m_fd);
+        }
+
+        if (openfile->m_cache_entry != nullptr)
+        {
+            transcoder_delete(openfile->m_cache_entry, openfile);
+        }
+
+        if (openfile->m_virtualfile != nullptr)
+        {
+            openfile_remove(openfile->m_virtualfile);
+        }
+
+        delete openfile;
+        fi->fh = 0;
     }
 
     return 0;
@@ -1305,6 +2073,8 @@ static void *ffmpegfs_init(struct fuse_conn_info *conn)
     Logging::info(nullptr, "%1 V%2 initialising.", PACKAGE_NAME, PACKAGE_VERSION);
     Logging::info(nullptr, "Mapping '%1' to '%2'.", params.m_basepath.c_str(), params.m_mountpath.c_str());
 
+    filenames.set_limit(params.m_max_virtual_files);
+
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sigemptyset(&sa.sa_mask);
@@ -1317,6 +2087,10 @@ static void *ffmpegfs_init(struct fuse_conn_info *conn)
     //    conn->async_read = 1;
     //	conn->want |= FUSE_CAP_ASYNC_READ;
     //	conn->want |= FUSE_CAP_SPLICE_READ;
+#if FUSE_VERSION >= 29
+    // Splice data from the cache files to the kernel, see ffmpegfs_read_buf()
+    conn->want |= FUSE_CAP_SPLICE_WRITE;
+#endif
 
     if (params.m_cache_maintenance)
     {
@@ -1333,11 +2107,19 @@ static void *ffmpegfs_init(struct fuse_conn_info *conn)
 
     if (tp == nullptr)
     {
-        tp = new(std::nothrow)thread_pool(params.m_max_threads);
+        tp = new(std::nothrow)thread_pool(params.m_max_threads, params.m_max_background_jobs);
     }
 
     tp->init();
 
+    if (params.m_cache_warming)
+    {
+        if (!start_cache_warmer())
+        {
+            exit(1);
+        }
+    }
+
     return nullptr;
 }
 
@@ -1350,8 +2132,12 @@ static void ffmpegfs_destroy(__attribute__((unused)) void * p)
     Logging::info(nullptr, "%1 V%2 terminating", PACKAGE_NAME, PACKAGE_VERSION);
     std::printf("%s V%s terminating\n", PACKAGE_NAME, PACKAGE_VERSION);
 
+    stop_cache_warmer();
     stop_cache_maintenance();
 
+    prefetch_log_stats();
+    negentry_log_stats();
+
     transcoder_exit();
     transcoder_free();
 
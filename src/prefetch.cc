@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Sequential playback prefetch implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "prefetch.h"
+#include "ffmpeg_utils.h"
+#include "transcode.h"
+#include "thread_pool.h"
+#include "logging.h"
+
+#include <dirent.h>
+#include <mutex>
+#include <set>
+
+static std::mutex               prefetch_mutex;     /**< @brief Protects the prefetch statistics */
+static std::set<std::string>    prefetch_pending;   /**< @brief Files prefetched, but not yet opened */
+static unsigned int             prefetch_queued;    /**< @brief Number of files queued for prefetching */
+static unsigned int             prefetch_cached;    /**< @brief Number of files skipped because they were already in cache */
+static unsigned int             prefetch_hits;      /**< @brief Number of prefetched files that have been opened later */
+
+static void prefetch_thread(void *arg);
+static void prefetch_segments_thread(void *arg);
+
+/**
+ * @brief Prefetch thread: Find the next files in directory and queue them for background transcoding.
+ * @param[in] arg - Name of the current input file, as std::string. Will be freed by the thread.
+ */
+static void prefetch_thread(void *arg)
+{
+    std::string *origfile = static_cast<std::string*>(arg);
+    std::string dir(*origfile);
+    std::string filename(*origfile);
+    struct dirent **namelist;
+    unsigned int count = 0;
+    bool found = false;
+
+    remove_filename(&dir);
+    remove_path(&filename);
+
+    int entries = scandir(dir.c_str(), &namelist, nullptr, alphasort);
+    if (entries == -1)
+    {
+        Logging::error(dir, "Prefetch: Error scanning directory: (%1) %2", errno, strerror(errno));
+        delete origfile;
+        return;
+    }
+
+    for (int n = 0; n < entries; n++)
+    {
+        std::string name(namelist[n]->d_name);
+        std::string nextfile(dir);
+        struct stat stbuf;
+
+        free(namelist[n]);
+
+        if (!found)
+        {
+            found = (name == filename);
+            continue;
+        }
+
+        append_filename(&nextfile, name);
+
+        if (count >= params.m_prefetch)
+        {
+            continue;
+        }
+
+        if (lstat(nextfile.c_str(), &stbuf) == -1 || !S_ISREG(stbuf.st_mode))
+        {
+            continue;
+        }
+
+        LPVIRTUALFILE virtualfile = insert_original(nextfile, &stbuf);
+        if (virtualfile == nullptr)
+        {
+            // Not transcoded
+            continue;
+        }
+
+        count++;
+
+        if (transcoder_cached(virtualfile))
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex);
+            prefetch_cached++;
+            continue;
+        }
+
+        if (!transcoder_cache_room(0))
+        {
+            Logging::debug(nextfile, "Prefetch: Not enough room in cache.");
+            count = params.m_prefetch;
+            continue;
+        }
+
+        Cache_Entry* cache_entry = transcoder_new(virtualfile, true, true);
+        if (cache_entry == nullptr)
+        {
+            Logging::warning(nextfile, "Prefetch: Unable to transcode file: (%1) %2", errno, strerror(errno));
+            continue;
+        }
+
+        // The transcoder thread keeps its own reference
+        transcoder_delete(cache_entry);
+
+        Logging::debug(nextfile, "Prefetch: Queued for background transcoding.");
+
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        prefetch_pending.insert(virtualfile->m_origfile.str());
+        prefetch_queued++;
+    }
+
+    free(namelist);
+
+    delete origfile;
+}
+
+/**
+ * @brief Segment prefetch thread: Queue the HLS segments following the current one for transcoding.
+ * @param[in] arg - Virtual file name of the current segment, as std::string. Will be freed by the thread.
+ */
+static void prefetch_segments_thread(void *arg)
+{
+    std::string *segmentfile = static_cast<std::string*>(arg);
+    std::string dir(*segmentfile);
+
+    remove_filename(&dir);
+
+    LPVIRTUALFILE virtualfile = find_file(*segmentfile);
+    if (virtualfile == nullptr)
+    {
+        delete segmentfile;
+        return;
+    }
+
+    for (uint32_t n = 1; n <= params.m_segment_prefetch; n++)
+    {
+        LPVIRTUALFILE nextfile = find_file(dir + hls_segment_name(virtualfile->m_hls.m_segment_no + n));
+        if (nextfile == nullptr || nextfile->m_type != VIRTUALTYPE_HLS)
+        {
+            // Last segment
+            break;
+        }
+
+        if (transcoder_cached(nextfile))
+        {
+            continue;
+        }
+
+        if (!transcoder_cache_room(0))
+        {
+            Logging::debug(nextfile->m_origfile.str(), "Prefetch: Not enough room in cache.");
+            break;
+        }
+
+        Cache_Entry* cache_entry = transcoder_new(nextfile, true, true);
+        if (cache_entry == nullptr)
+        {
+            Logging::warning(nextfile->m_origfile.str(), "Prefetch: Unable to transcode HLS segment: (%1) %2", errno, strerror(errno));
+            continue;
+        }
+
+        // The transcoder thread keeps its own reference
+        transcoder_delete(cache_entry);
+
+        Logging::debug(nextfile->m_origfile.str(), "Prefetch: HLS segment queued for transcoding.");
+    }
+
+    delete segmentfile;
+}
+
+bool prefetch_next(LPVIRTUALFILE virtualfile)
+{
+    if (params.m_disable_cache || virtualfile->m_type != VIRTUALTYPE_DISK)
+    {
+        // Nothing to keep prefetched files in, or no directory to look at
+        return true;
+    }
+
+    std::string *origfile = new(std::nothrow) std::string(virtualfile->m_origfile.str());
+    if (origfile == nullptr)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    Logging::trace(*origfile, "Prefetch: Scheduling next %1 file(s) in directory.", params.m_prefetch);
+
+    // Supports a file in use, so this comes before the background jobs it creates
+    return tp->schedule_thread(&prefetch_thread, origfile, thread_pool::PRIORITY_NORMAL);
+}
+
+bool prefetch_segments(LPVIRTUALFILE virtualfile)
+{
+    std::string *segmentfile = new(std::nothrow) std::string(virtualfile->m_origfile.str());
+    if (segmentfile == nullptr)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    Logging::trace(*segmentfile, "Prefetch: Scheduling next %1 HLS segment(s).", params.m_segment_prefetch);
+
+    return tp->schedule_thread(&prefetch_segments_thread, segmentfile, thread_pool::PRIORITY_NORMAL);
+}
+
+void prefetch_opened(LPVIRTUALFILE virtualfile)
+{
+    std::lock_guard<std::mutex> lock(prefetch_mutex);
+
+    if (prefetch_pending.erase(virtualfile->m_origfile.str()))
+    {
+        prefetch_hits++;
+
+        Logging::debug(virtualfile->m_origfile.str(), "Prefetch: Hit, %1 of %2 prefetched files have been opened.", prefetch_hits, prefetch_queued);
+    }
+}
+
+void prefetch_log_stats()
+{
+    std::lock_guard<std::mutex> lock(prefetch_mutex);
+
+    if (!prefetch_queued && !prefetch_cached)
+    {
+        return;
+    }
+
+    Logging::info(nullptr, "Prefetch: %1 files transcoded in advance, %2 of them opened later (%3%), %4 already in cache.",
+                  prefetch_queued,
+                  prefetch_hits,
+                  prefetch_queued ? (prefetch_hits * 100) / prefetch_queued : 0,
+                  prefetch_cached);
+}
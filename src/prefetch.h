@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Sequential playback prefetch
+ *
+ * Albums and TV seasons are mostly played in order. When a file has been
+ * read up to a configurable point, the next files in the same directory
+ * (sorted by name) are transcoded as background jobs, so they can be
+ * served from the cache when they are opened.
+ *
+ * Prefetched files are remembered until they are opened, so the accuracy
+ * of the prediction can be logged.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#pragma once
+
+#include "ffmpegfs.h"
+
+/**
+ * @brief Prefetch the files following a file in its directory.
+ *
+ * The directory is scanned by a thread pool job, the files are then
+ * queued as background transcodes. Files already in cache are skipped
+ * but count towards the number of files to prefetch.
+ *
+ * @param[in] virtualfile - File currently being read.
+ * @return On success, returns true. On error, returns false. Check errno for details.
+ */
+bool prefetch_next(LPVIRTUALFILE virtualfile);
+/**
+ * @brief Transcode the HLS segments following a segment in advance.
+ *
+ * Players fetch segments one after another, so the next ones are queued
+ * as soon as a segment is opened. Segments already in cache are skipped.
+ *
+ * @param[in] virtualfile - HLS segment currently being read.
+ * @return On success, returns true. On error, returns false. Check errno for details.
+ */
+bool prefetch_segments(LPVIRTUALFILE virtualfile);
+/**
+ * @brief Report that a file has been opened. Counts a hit if it has been prefetched before.
+ * @param[in] virtualfile - File that has been opened.
+ */
+void prefetch_opened(LPVIRTUALFILE virtualfile);
+/**
+ * @brief Log prefetch statistics.
+ */
+void prefetch_log_stats();
+
+#endif // PREFETCH_H
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Seek index of transcoded files
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef SEEK_INDEX_H
+#define SEEK_INDEX_H
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#define SEEK_INDEX_KEYFRAME     0x0001          /**< @brief Seek index entry starts with a keyframe */
+
+/**
+  * @brief Seek index entry
+  *
+  * Maps a byte offset of the transcoded file to a position in the output stream.
+  * The position is taken from the output packet pts, which counts from 0 like all
+  * other positions, i.e. the source start time has already been subtracted.
+  * The seek index is sparse, only about one entry per second and one per video keyframe are recorded.
+  */
+typedef struct SEEK_INDEX_ENTRY
+{
+    uint64_t        m_offset;                   /**< @brief Byte offset in the transcoded file */
+    int64_t         m_pos;                      /**< @brief Output position in AV_TIME_BASE fractional seconds */
+    uint32_t        m_flags;                    /**< @brief SEEK_INDEX_KEYFRAME or 0 */
+    uint32_t        m_reserved;                 /**< @brief Unused, always 0 */
+} SEEK_INDEX_ENTRY;
+typedef std::vector<SEEK_INDEX_ENTRY> SEEK_INDEX;   /**< @brief Seek index of a transcoded file, ordered by offset */
+
+#endif // SEEK_INDEX_H
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Shared_Path class implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "shared_path.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+
+#define INTERN_SWEEP_MIN        1024    /**< @brief Do not look for unused paths before there are this many */
+
+typedef std::unordered_map<std::string, std::weak_ptr<const std::string>> paths_t;  /**< @brief Interned paths, by path */
+
+static std::mutex   paths_mutex;                        /**< @brief Access mutex for paths */
+static paths_t      paths;                              /**< @brief Interned paths */
+static size_t       paths_sweep = INTERN_SWEEP_MIN;     /**< @brief Remove unused paths when there are this many */
+
+Shared_Path::Shared_Path()
+{
+}
+
+Shared_Path::Shared_Path(const std::string & filepath)
+{
+    assign(filepath);
+}
+
+std::shared_ptr<const std::string> Shared_Path::intern(const std::string & path)
+{
+    std::lock_guard<std::mutex> lock(paths_mutex);
+
+    paths_t::iterator it = paths.find(path);
+
+    if (it != paths.end())
+    {
+        std::shared_ptr<const std::string> shared = it->second.lock();
+
+        if (shared != nullptr)
+        {
+            return shared;
+        }
+    }
+
+    if (paths.size() >= paths_sweep)
+    {
+        // Forget paths no file refers to anymore
+        for (paths_t::iterator it2 = paths.begin(); it2 != paths.end();)
+        {
+            if (it2->second.expired())
+            {
+                it2 = paths.erase(it2);
+            }
+            else
+            {
+                ++it2;
+            }
+        }
+
+        paths_sweep = std::max(static_cast<size_t>(INTERN_SWEEP_MIN), paths.size() * 2);
+    }
+
+    std::shared_ptr<const std::string> shared = std::make_shared<const std::string>(path);
+
+    paths[path] = shared;
+
+    return shared;
+}
+
+void Shared_Path::assign(const std::string & filepath)
+{
+    size_t found = filepath.rfind('/');
+
+    if (found == std::string::npos)
+    {
+        m_path.reset();
+        m_filename = filepath;
+        return;
+    }
+
+    if (m_path == nullptr || m_path->size() != found + 1 || filepath.compare(0, found + 1, *m_path) != 0)
+    {
+        m_path = intern(filepath.substr(0, found + 1));
+    }
+
+    m_filename = filepath.substr(found + 1);
+}
+
+std::string Shared_Path::str() const
+{
+    if (m_path == nullptr)
+    {
+        return m_filename;
+    }
+
+    return *m_path + m_filename;
+}
+
+bool Shared_Path::empty() const
+{
+    return (m_path == nullptr && m_filename.empty());
+}
+
+bool Shared_Path::operator==(const Shared_Path & other) const
+{
+    if (m_filename != other.m_filename)
+    {
+        return false;
+    }
+
+    if (m_path == other.m_path)
+    {
+        return true;
+    }
+
+    return (m_path != nullptr && other.m_path != nullptr && *m_path == *other.m_path);
+}
+
+bool Shared_Path::operator!=(const Shared_Path & other) const
+{
+    return !(*this == other);
+}
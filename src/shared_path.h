@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file
+ * @brief Shared_Path class, file names with a shared directory part
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef SHARED_PATH_H
+#define SHARED_PATH_H
+
+#pragma once
+
+#include <string>
+#include <memory>
+
+/**
+ * @brief The #Shared_Path class
+ *
+ * Holds a file name and path. The path is interned: all files in the
+ * same directory refer to one copy of it, only the file name is stored
+ * per file. Saves lots of memory when many files of the same directory
+ * are kept, e.g. the segments of an HLS directory.
+ */
+class Shared_Path
+{
+public:
+    /**
+     * @brief Construct an empty Shared_Path object.
+     */
+    Shared_Path();
+    /**
+     * @brief Construct Shared_Path object.
+     * @param[in] filepath - File name and path.
+     */
+    explicit Shared_Path(const std::string & filepath);
+
+    /**
+     * @brief Set file name and path.
+     * @param[in] filepath - File name and path.
+     */
+    void                assign(const std::string & filepath);
+    /**
+     * @brief Get file name and path.
+     * @return Returns file name and path.
+     */
+    std::string         str() const;
+    /**
+     * @brief Check if file name and path are empty.
+     * @return Returns true if empty; false if not.
+     */
+    bool                empty() const;
+    /**
+     * @brief Compare two Shared_Path objects.
+     * @param[in] other - Shared_Path to compare with.
+     * @return Returns true if file names and paths are equal; false if not.
+     */
+    bool                operator==(const Shared_Path & other) const;
+    /**
+     * @brief Compare two Shared_Path objects.
+     * @param[in] other - Shared_Path to compare with.
+     * @return Returns true if file names or paths differ; false if not.
+     */
+    bool                operator!=(const Shared_Path & other) const;
+
+protected:
+    /**
+     * @brief Get the one copy of a path that all files in it share.
+     * @param[in] path - Directory including trailing slash.
+     * @return Returns shared copy of path.
+     */
+    static std::shared_ptr<const std::string> intern(const std::string & path);
+
+private:
+    std::shared_ptr<const std::string> m_path;      /**< @brief Directory including trailing slash, shared with other files. nullptr if none. */
+    std::string         m_filename;                 /**< @brief File name without path */
+};
+
+#endif // SHARED_PATH_H
@@ -31,14 +31,24 @@
 
 #include "thread_pool.h"
 #include "logging.h"
+#include "ffmpeg_utils.h"
 #include "config.h"
 
-thread_pool::thread_pool(unsigned int num_threads)
+thread_pool::thread_pool(unsigned int num_threads, unsigned int max_background)
     : m_queue_shutdown(false)
     , m_num_threads(num_threads)
+    , m_max_background(max_background)
     , m_cur_threads(0)
-
+    , m_threads_running(0)
 {
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+    {
+        m_stats[priority].m_queued          = 0;
+        m_stats[priority].m_running         = 0;
+        m_stats[priority].m_started         = 0;
+        m_stats[priority].m_wait_time       = 0;
+        m_stats[priority].m_max_wait_time   = 0;
+    }
 }
 
 thread_pool::~thread_pool()
@@ -51,6 +61,33 @@ void thread_pool::loop_function_starter(thread_pool & tp)
     tp.loop_function();
 }
 
+thread_pool::PRIORITY thread_pool::next_priority() const
+{
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+    {
+        if (m_thread_queue[priority].empty())
+        {
+            continue;
+        }
+
+        if (priority == PRIORITY_BACKGROUND && m_max_background && m_stats[priority].m_running >= m_max_background)
+        {
+            // Background jobs are capped
+            continue;
+        }
+
+        if (priority == PRIORITY_BACKGROUND && m_stats[PRIORITY_INTERACTIVE].m_running)
+        {
+            // Give way to files that are actually being accessed. Jobs already running are not held up.
+            continue;
+        }
+
+        return static_cast<PRIORITY>(priority);
+    }
+
+    return PRIORITY_COUNT;
+}
+
 void thread_pool::loop_function()
 {
     unsigned int thread_no = ++m_cur_threads;
@@ -60,9 +97,10 @@ void thread_pool::loop_function()
     while (true)
     {
         THREADINFO info;
+        PRIORITY priority;
         {
             std::unique_lock<std::mutex> lock(m_queue_mutex);
-            m_queue_condition.wait(lock, [this]{ return (!m_thread_queue.empty() || m_queue_shutdown); });
+            m_queue_condition.wait(lock, [this]{ return (next_priority() != PRIORITY_COUNT || m_queue_shutdown); });
 
             if (m_queue_shutdown)
             {
@@ -70,34 +108,67 @@ void thread_pool::loop_function()
                 break;
             }
 
-            Logging::trace(nullptr, "Starting job using pool thread no. %1 with id 0x%<%" FFMPEGFS_FORMAT_PTHREAD_T ">2.", thread_no, pthread_self());
-            info = m_thread_queue.front();
-            m_thread_queue.pop();
+            priority = next_priority();
+
+            info = m_thread_queue[priority].front();
+            m_thread_queue[priority].pop_front();
+
+            int64_t wait_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - info.m_queued).count();
+
+            THREAD_STATS & stats = m_stats[priority];
+            stats.m_queued--;
+            stats.m_running++;
+            stats.m_started++;
+            stats.m_wait_time += wait_time;
+            if (stats.m_max_wait_time < wait_time)
+            {
+                stats.m_max_wait_time = wait_time;
+            }
+            m_threads_running++;
+
+            Logging::trace(nullptr, "Starting %1 job using pool thread no. %2 with id 0x%<%" FFMPEGFS_FORMAT_PTHREAD_T ">3 after waiting %4.", priority_name(priority), thread_no, pthread_self(), format_duration(wait_time).c_str());
         }
 
         info.m_thread_func(info.m_opaque);
+
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+
+            m_stats[priority].m_running--;
+            m_threads_running--;
+        }
+
+        if (priority == PRIORITY_BACKGROUND || priority == PRIORITY_INTERACTIVE)
+        {
+            // A background slot has become free, or background jobs may be allowed to start again
+            m_queue_condition.notify_all();
+        }
     }
 
     Logging::trace(nullptr, "Exiting pool thread no. %1 with id 0x%<%" FFMPEGFS_FORMAT_PTHREAD_T ">2.", thread_no, pthread_self());
 }
 
-bool thread_pool::schedule_thread(void (*thread_func)(void *), void *opaque)
+bool thread_pool::schedule_thread(void (*thread_func)(void *), void *opaque, PRIORITY priority /*= PRIORITY_NORMAL*/)
 {
     if (!m_queue_shutdown)
     {
-        Logging::trace(nullptr, "Queueing new thread. %1 threads already in queue.", m_thread_pool.size());
-
         {
             std::lock_guard<std::mutex> lock(m_queue_mutex);
 
+            Logging::trace(nullptr, "Queueing new %1 job. %2 jobs of this class already in queue.", priority_name(priority), m_thread_queue[priority].size());
+
             THREADINFO info;
 
             info.m_thread_func  = thread_func;
             info.m_opaque       = opaque;
-            m_thread_queue.push(info);
+            info.m_queued       = std::chrono::steady_clock::now();
+            m_thread_queue[priority].push_back(info);
+
+            m_stats[priority].m_queued++;
         }
 
-        m_queue_condition.notify_one();
+        // Wake all threads: with background jobs capped, the one woken up might not be able to take it
+        m_queue_condition.notify_all();
 
         return true;
     }
@@ -107,6 +178,46 @@ bool thread_pool::schedule_thread(void (*thread_func)(void *), void *opaque)
     }
 }
 
+bool thread_pool::promote_thread(const void *opaque, PRIORITY priority)
+{
+    bool promoted = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+
+        for (int from = priority + 1; from < PRIORITY_COUNT && !promoted; from++)
+        {
+            std::deque<THREADINFO> & queue = m_thread_queue[from];
+
+            for (std::deque<THREADINFO>::iterator it = queue.begin(); it != queue.end(); ++it)
+            {
+                if (it->m_opaque != opaque)
+                {
+                    continue;
+                }
+
+                Logging::trace(nullptr, "Promoting queued %1 job to %2.", priority_name(static_cast<PRIORITY>(from)), priority_name(priority));
+
+                m_thread_queue[priority].push_back(*it);
+                queue.erase(it);
+
+                m_stats[from].m_queued--;
+                m_stats[priority].m_queued++;
+
+                promoted = true;
+                break;
+            }
+        }
+    }
+
+    if (promoted)
+    {
+        m_queue_condition.notify_all();
+    }
+
+    return promoted;
+}
+
 unsigned int thread_pool::current_running() const
 {
     return m_threads_running;
@@ -115,8 +226,67 @@ unsigned int thread_pool::current_running() const
 unsigned int thread_pool::current_queued()
 {
     std::lock_guard<std::mutex> lock(m_queue_mutex);
+    size_t queued = 0;
+
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+    {
+        queued += m_thread_queue[priority].size();
+    }
+
+    return static_cast<unsigned int>(queued);
+}
+
+void thread_pool::stats(PRIORITY priority, THREAD_STATS *stats)
+{
+    std::lock_guard<std::mutex> lock(m_queue_mutex);
+
+    *stats = m_stats[priority];
+}
+
+void thread_pool::log_stats()
+{
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+    {
+        THREAD_STATS s;
+
+        stats(static_cast<PRIORITY>(priority), &s);
 
-    return static_cast<unsigned int>(m_thread_queue.size());
+        if (!s.m_started && !s.m_queued)
+        {
+            continue;
+        }
+
+        Logging::debug(nullptr, "Thread pool %1 jobs: %2 queued, %3 running, %4 started. Wait time avg. %5, max. %6.",
+                       priority_name(static_cast<PRIORITY>(priority)),
+                       s.m_queued,
+                       s.m_running,
+                       s.m_started,
+                       format_duration(s.m_started ? static_cast<int64_t>(s.m_wait_time / static_cast<int64_t>(s.m_started)) : 0).c_str(),
+                       format_duration(s.m_max_wait_time).c_str());
+    }
+}
+
+const char * thread_pool::priority_name(PRIORITY priority)
+{
+    switch (priority)
+    {
+    case PRIORITY_INTERACTIVE:
+    {
+        return "interactive";
+    }
+    case PRIORITY_NORMAL:
+    {
+        return "normal";
+    }
+    case PRIORITY_BACKGROUND:
+    {
+        return "background";
+    }
+    default:
+    {
+        return "unknown";
+    }
+    }
 }
 
 unsigned int thread_pool::pool_size() const
@@ -131,7 +301,14 @@ void thread_pool::init(unsigned int num_threads /*= 0*/)
         m_num_threads = num_threads;
     }
 
-    Logging::info(nullptr, "Initialising thread pool with max. %1 threads.", m_num_threads);
+    if (m_max_background)
+    {
+        Logging::info(nullptr, "Initialising thread pool with max. %1 threads, max. %2 background jobs.", m_num_threads, m_max_background);
+    }
+    else
+    {
+        Logging::info(nullptr, "Initialising thread pool with max. %1 threads.", m_num_threads);
+    }
 
     for(unsigned int i = 0; i < m_num_threads; i++)
     {
@@ -143,7 +320,9 @@ void thread_pool::tear_down(bool silent)
 {
     if (!silent)
     {
-        Logging::debug(nullptr, "Tearing down thread pool. %1 threads still in queue.", m_thread_queue.size());
+        log_stats();
+
+        Logging::debug(nullptr, "Tearing down thread pool. %1 threads still in queue.", current_queued());
     }
 
     m_queue_mutex.lock();
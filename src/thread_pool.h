@@ -25,9 +25,10 @@
 #include <iostream>
 #include <thread>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
 #include <unistd.h>
 
 /**
@@ -35,18 +36,45 @@
  */
 class thread_pool
 {
+public:
+    /**
+     * @brief Job priority classes. Jobs of a higher class are always started first.
+     */
+    typedef enum PRIORITY
+    {
+        PRIORITY_INTERACTIVE,                       /**< A user is waiting for the result, e.g. file opened */
+        PRIORITY_NORMAL,                            /**< Supporting jobs for files in use */
+        PRIORITY_BACKGROUND,                        /**< Bulk jobs like prefetch, cache warming or maintenance */
+        PRIORITY_COUNT                              /**< Number of priority classes, must be last */
+    } PRIORITY;
+
+    /**
+     * @brief Statistics of a priority class.
+     */
+    typedef struct THREAD_STATS
+    {
+        unsigned int    m_queued;                   /**< Jobs currently waiting in queue */
+        unsigned int    m_running;                  /**< Jobs currently running */
+        uint64_t        m_started;                  /**< Jobs started so far */
+        int64_t         m_wait_time;                /**< Total time jobs waited in queue, in AV_TIME_BASE fractional seconds */
+        int64_t         m_max_wait_time;            /**< Longest time a job waited in queue, in AV_TIME_BASE fractional seconds */
+    } THREAD_STATS;
+
+private:
     typedef struct THREADINFO                       /**< Thread info structure */
     {
         void (*m_thread_func)(void *);              /**< Job function pointer */
         void *m_opaque;                             /**< Parameter for job function */
+        std::chrono::steady_clock::time_point m_queued; /**< Time the job was queued */
     } THREADINFO;
 
 public:
     /**
      * @brief Construct a thread_pool object.
      * @param[in] num_threads - Optional: number of threads to create in pool. Defaults to Defaults to 4 x number of CPU cores.
+     * @param[in] max_background - Optional: Max. number of background jobs to run at the same time. Defaults to 0 (only limited by pool size).
      */
-    explicit thread_pool(unsigned int num_threads = std::thread::hardware_concurrency() * 4);
+    explicit thread_pool(unsigned int num_threads = std::thread::hardware_concurrency() * 4, unsigned int max_background = 0);
     /**
      * @brief Object destructor. Ends all threads and cleans up resources.
      */
@@ -66,9 +94,19 @@ public:
      * @brief Schedule a new thread from pool.
      * @param[in] thread_func - Thread function to start.
      * @param[in] opaque - Parameter passed to thread function.
+     * @param[in] priority - Optional: Priority class of job. Defaults to PRIORITY_NORMAL.
      * @return Returns true if thread was successfully scheduled, fals if not.
      */
-    bool            schedule_thread(void (*thread_func)(void *), void *opaque);
+    bool            schedule_thread(void (*thread_func)(void *), void *opaque, PRIORITY priority = PRIORITY_NORMAL);
+    /**
+     * @brief Move a job that is still queued to a higher priority class.
+     *
+     * The job keeps its original queue time, it is put at the end of the new class.
+     * @param[in] opaque - Parameter the job has been scheduled with.
+     * @param[in] priority - New priority class.
+     * @return Returns true if the job was found in a lower class and moved, false if it is not queued (e.g. already running).
+     */
+    bool            promote_thread(const void *opaque, PRIORITY priority);
     /**
      * @brief Get number of currently running threads.
      * @return Returns number of currently running threads.
@@ -79,6 +117,22 @@ public:
      * @return Returns number of currently queued threads.
      */
     unsigned int    current_queued();
+    /**
+     * @brief Get statistics of a priority class.
+     * @param[in] priority - Priority class.
+     * @param[out] stats - Statistics.
+     */
+    void            stats(PRIORITY priority, THREAD_STATS *stats);
+    /**
+     * @brief Log statistics of all priority classes.
+     */
+    void            log_stats();
+    /**
+     * @brief Get name of priority class.
+     * @param[in] priority - Priority class.
+     * @return Returns name of priority class.
+     */
+    static const char * priority_name(PRIORITY priority);
     /**
      * @brief Get current pool size.
      * @return Return current pool size.
@@ -95,16 +149,25 @@ private:
      * @brief Start loop function
      */
     void            loop_function();
+    /**
+     * @brief Get highest priority class that has a job ready to start. m_queue_mutex must be held by the caller.
+     *
+     * Background jobs are not started while interactive jobs are running or when max_background jobs already run.
+     * @return Returns the priority class, or PRIORITY_COUNT if there's nothing to start.
+     */
+    PRIORITY        next_priority() const;
 
 protected:
     std::vector<std::thread>    m_thread_pool;      /**< Thread pool */
     std::mutex                  m_queue_mutex;      /**< Mutex for critical section */
     std::condition_variable     m_queue_condition;  /**< Condition for critical section */
-    std::queue<THREADINFO>      m_thread_queue;     /**< Thread queue parameters */
+    std::deque<THREADINFO>      m_thread_queue[PRIORITY_COUNT]; /**< Thread queue parameters, one queue per priority class */
     volatile bool               m_queue_shutdown;   /**< If true all threads have been shut down */
     unsigned int                m_num_threads;      /**< Max. number of threads. Defaults to 4x number of CPU cores. */
+    unsigned int                m_max_background;   /**< Max. number of background jobs running at the same time, 0 for no limit. */
     unsigned int                m_cur_threads;      /**< Current number of threads. */
     volatile unsigned int       m_threads_running;  /**< Currently running threads. */
+    THREAD_STATS                m_stats[PRIORITY_COUNT]; /**< Statistics per priority class, protected by m_queue_mutex */
 };
 
 #endif // THREAD_POOL_H
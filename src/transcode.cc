@@ -41,9 +41,36 @@
 #include "logging.h"
 #include "cache_entry.h"
 #include "thread_pool.h"
+#include "prefetch.h"
 
 #include <unistd.h>
 #include <atomic>
+#include <chrono>
+#include <climits>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#define WATERMARK_WAIT_MS   100                 /**< @brief Maximum time to wait for the buffer watermark before checking for interrupts */
+#define RANGE_SEEK_MIN      (2 * 1024 * 1024)   /**< @brief Minimum distance of a read beyond the watermark to start a secondary transcoder for PCM formats */
+#define BACKGROUND_NICE     19                  /**< @brief Nice value for background transcoding */
+#define CHECKPOINT_INTERVAL 10                  /**< @brief Seconds between checkpoints an interrupted transcode can be resumed from */
+
+#ifdef __linux__
+#define IOPRIO_WHO_PROCESS  1                   /**< @brief ioprio_set(): Set I/O priority of a single thread */
+#define IOPRIO_CLASS_SHIFT  13                  /**< @brief ioprio_set(): Bit position of the I/O scheduling class */
+#define IOPRIO_CLASS_IDLE   3                   /**< @brief ioprio_set(): Idle I/O scheduling class */
+#endif
+
+/**
+  * @brief RANGE_DATA struct to pass data to a secondary transcoder thread
+  */
+typedef struct RANGE_DATA
+{
+    Cache_Entry *           m_cache_entry;      /**< @brief Cache entry to fill in. Holds a reference that will be released by the thread. */
+    size_t                  m_offset;           /**< @brief Byte offset to start at */
+} RANGE_DATA;
 
 /**
   * @brief THREAD_DATA struct to pass data from parent to child thread
@@ -54,6 +81,7 @@ typedef struct THREAD_DATA
     std::condition_variable m_cond;             /**< @brief Condition when thread is running */
     std::atomic_bool        m_lock_guard;       /**< @brief Lock guard to avoid spurious or missed unlocks */
     bool                    m_initialised;      /**< @brief True when this object is completely initialised */
+    bool                    m_detached;         /**< @brief True if the parent does not wait for the thread to start. A cache entry reference has already been taken for the thread. */
     void *                  m_arg;              /**< @brief Opaque argument pointer. Will not be freed by child thread. */
 } THREAD_DATA;
 
@@ -61,8 +89,336 @@ static Cache *cache;                            /**< @brief Global cache manager
 static volatile bool thread_exit;               /**< @brief Used for shutdown: if true, exit all thread */
 
 static void transcoder_thread(void *arg);
+static void range_transcoder_thread(void *arg);
+static void start_range_transcoder(Cache_Entry* cache_entry, size_t offset);
 static bool transcode_until(Cache_Entry* cache_entry, size_t offset, size_t len);
 static int transcode_finish(Cache_Entry* cache_entry, FFmpeg_Transcoder *transcoder);
+static void check_prefetch(Cache_Entry* cache_entry, size_t offset, size_t len);
+static void lower_priority(int *saved_nice, int *saved_ioprio);
+static void restore_priority(int *saved_nice, int *saved_ioprio);
+static bool init_probe_info(LPVIRTUALFILE virtualfile, PROBE_INFO *probe_info);
+static void save_probe_info(LPVIRTUALFILE virtualfile, const FFmpeg_Transcoder *transcoder);
+static bool save_checkpoint(Cache_Entry* cache_entry, const FFmpeg_Transcoder *transcoder, const SEEK_INDEX & seek_index_head);
+static void save_seek_index(Cache_Entry* cache_entry, const FFmpeg_Transcoder *transcoder, const SEEK_INDEX & seek_index_head, bool finished);
+
+/**
+ * @brief Set CPU and I/O priority of the calling thread to idle for background transcoding.
+ *
+ * Pool threads are reused, so the nice value is only changed if it can be set back
+ * later, i.e., when running as root or if RLIMIT_NICE permits. Linux only.
+ *
+ * @param[out] saved_nice - Previous nice value, INT_MIN if unchanged.
+ * @param[out] saved_ioprio - Previous I/O priority, -1 if unchanged.
+ */
+static void lower_priority(int *saved_nice, int *saved_ioprio)
+{
+    *saved_nice     = INT_MIN;
+    *saved_ioprio   = -1;
+
+#ifdef __linux__
+    id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    struct rlimit rlim;
+
+    errno = 0;
+    int nice_value = getpriority(PRIO_PROCESS, tid);
+    if (nice_value != -1 || !errno)
+    {
+        if (!geteuid() || (!getrlimit(RLIMIT_NICE, &rlim) && (rlim.rlim_cur == RLIM_INFINITY || 20 - static_cast<int>(rlim.rlim_cur) <= nice_value)))
+        {
+            if (!setpriority(PRIO_PROCESS, tid, BACKGROUND_NICE))
+            {
+                *saved_nice = nice_value;
+            }
+        }
+    }
+
+    int ioprio = static_cast<int>(syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid));
+    if (ioprio != -1 && !syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT))
+    {
+        *saved_ioprio = ioprio;
+    }
+#endif
+}
+
+/**
+ * @brief Restore CPU and I/O priority changed by lower_priority().
+ * @param[in, out] saved_nice - Previous nice value, INT_MIN if unchanged. Will be reset.
+ * @param[in, out] saved_ioprio - Previous I/O priority, -1 if unchanged. Will be reset.
+ */
+static void restore_priority(int *saved_nice, int *saved_ioprio)
+{
+#ifdef __linux__
+    id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+
+    if (*saved_nice != INT_MIN)
+    {
+        setpriority(PRIO_PROCESS, tid, *saved_nice);
+    }
+
+    if (*saved_ioprio != -1)
+    {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, *saved_ioprio);
+    }
+#endif
+
+    *saved_nice     = INT_MIN;
+    *saved_ioprio   = -1;
+}
+
+/**
+ * @brief Prepare probe info of a source file for lookup in the cache index.
+ *
+ * Only regular disk files and HLS segments of them can be checked for changes,
+ * DVD, Blu-ray and S/VCD titles get their sizes from the disk structures anyway.
+ *
+ * @param[in] virtualfile - virtualfile struct of a file.
+ * @param[out] probe_info - Probe info with file name, time and size set.
+ * @return Returns true if the probe info can be cached; false if not.
+ */
+static bool init_probe_info(LPVIRTUALFILE virtualfile, PROBE_INFO *probe_info)
+{
+    struct stat stbuf;
+
+    std::string origfile;
+
+    switch (virtualfile->m_type)
+    {
+    case VIRTUALTYPE_DISK:
+    {
+        origfile = virtualfile->m_origfile.str();
+        break;
+    }
+    case VIRTUALTYPE_HLS:
+    {
+        // All segments share the probe results of their source file
+        origfile = virtualfile->m_hls.m_srcfile.str();
+        break;
+    }
+    default:
+    {
+        return false;
+    }
+    }
+
+    if (stat(origfile.c_str(), &stbuf) == -1)
+    {
+        return false;
+    }
+
+    probe_info->m_origfile      = origfile;
+    probe_info->m_file_time     = stbuf.st_mtime;
+    probe_info->m_file_size     = static_cast<size_t>(stbuf.st_size);
+
+    return true;
+}
+
+/**
+ * @brief Store the results of probing a source file in the cache index.
+ * @param[in] virtualfile - virtualfile struct of a file.
+ * @param[in] transcoder - Transcoder with open input file.
+ */
+static void save_probe_info(LPVIRTUALFILE virtualfile, const FFmpeg_Transcoder *transcoder)
+{
+    PROBE_INFO probe_info;
+
+    if (init_probe_info(virtualfile, &probe_info) && transcoder->get_probe_info(&probe_info))
+    {
+        cache->write_probe(&probe_info);
+    }
+}
+
+/**
+ * @brief Record a checkpoint an interrupted transcode can be resumed from.
+ *
+ * Only done for formats that can be resumed, and only if there is a cache file to keep.
+ * The seek index recorded so far is stored along with it.
+ * @param[in] cache_entry - Corresponding cache entry.
+ * @param[in] transcoder - Current FFmpeg_Transcoder object.
+ * @param[in] seek_index_head - Seek index of the part kept from an earlier, interrupted transcode.
+ * @return Returns true if a checkpoint exists; false if the transcode cannot be resumed.
+ */
+static bool save_checkpoint(Cache_Entry* cache_entry, const FFmpeg_Transcoder *transcoder, const SEEK_INDEX & seek_index_head)
+{
+    if (params.m_disable_cache || cache_entry->m_buffer->stream_window())
+    {
+        return false;
+    }
+
+    // Only data without gaps counts, the secondary transcoder may have written further ahead
+    size_t available = cache_entry->m_buffer->readable(0, cache_entry->m_buffer->buffer_watermark());
+    int64_t pos = 0;
+    size_t offset = transcoder->resume_point(cache_entry->m_data_offset, available, &pos);
+
+    if (offset <= cache_entry->m_cache_info.m_resume_offset)
+    {
+        return (cache_entry->m_cache_info.m_resume_offset != 0);
+    }
+
+    if (!cache_entry->save_checkpoint(offset, pos))
+    {
+        Logging::warning(cache_entry->destname(), "Unable to save checkpoint at offset %1: (%2) %3", offset, errno, strerror(errno));
+        return (cache_entry->m_cache_info.m_resume_offset != 0);
+    }
+
+    Logging::trace(cache_entry->destname(), "Saved checkpoint at offset %1 (%2).", offset, format_duration(pos).c_str());
+
+    save_seek_index(cache_entry, transcoder, seek_index_head, false);
+
+    return true;
+}
+
+/**
+ * @brief Store the seek index of the transcoded file in the cache index.
+ * @param[in] cache_entry - Corresponding cache entry.
+ * @param[in] transcoder - Current FFmpeg_Transcoder object.
+ * @param[in] seek_index_head - Seek index of the part kept from an earlier, interrupted transcode.
+ * @param[in] finished - If true, the file is complete. Log the bitrate range found in the index.
+ */
+static void save_seek_index(Cache_Entry* cache_entry, const FFmpeg_Transcoder *transcoder, const SEEK_INDEX & seek_index_head, bool finished)
+{
+    if (params.m_disable_cache || cache_entry->m_buffer->stream_window())
+    {
+        return;
+    }
+
+    const SEEK_INDEX & seek_index_tail = transcoder->seek_index();
+    SEEK_INDEX seek_index;
+
+    // If the transcoder had to start over, the head has been transcoded again
+    for (const SEEK_INDEX_ENTRY & entry : seek_index_head)
+    {
+        if (!seek_index_tail.empty() && entry.m_offset >= seek_index_tail.front().m_offset)
+        {
+            break;
+        }
+        seek_index.push_back(entry);
+    }
+
+    seek_index.insert(seek_index.end(), seek_index_tail.begin(), seek_index_tail.end());
+
+    if (!cache->write_seek_index(cache_entry->filename(), cache_entry->m_cache_info.m_desttype, seek_index))
+    {
+        Logging::warning(cache_entry->destname(), "Unable to save seek index.");
+        return;
+    }
+
+    if (finished && seek_index.size() > 1)
+    {
+        BITRATE min_bitrate = 0;
+        BITRATE max_bitrate = 0;
+        size_t keyframes = 0;
+
+        for (size_t n = 1; n < seek_index.size(); n++)
+        {
+            int64_t duration = seek_index[n].m_pos - seek_index[n - 1].m_pos;
+
+            if (seek_index[n].m_flags & SEEK_INDEX_KEYFRAME)
+            {
+                keyframes++;
+            }
+
+            if (duration <= 0 || seek_index[n].m_offset < seek_index[n - 1].m_offset)
+            {
+                continue;
+            }
+
+            BITRATE bitrate = static_cast<BITRATE>(av_rescale(static_cast<int64_t>(seek_index[n].m_offset - seek_index[n - 1].m_offset) * 8, AV_TIME_BASE, duration));
+
+            if (!min_bitrate || bitrate < min_bitrate)
+            {
+                min_bitrate = bitrate;
+            }
+            if (bitrate > max_bitrate)
+            {
+                max_bitrate = bitrate;
+            }
+        }
+
+        Logging::debug(cache_entry->destname(), "Seek index has %1 entries, %2 keyframes. Bitrate between %3 and %4.", seek_index.size(), keyframes, format_bitrate(min_bitrate).c_str(), format_bitrate(max_bitrate).c_str());
+    }
+}
+
+/**
+ * @brief Start a secondary transcoder for a read far beyond the current transcoder position.
+ *
+ * Only possible for PCM formats (WAV and AIFF) where each output byte can be mapped
+ * to an input time position. Only one secondary transcoder can be active per file,
+ * if a read far outside the range it fills in occurs, it will be stopped and can be
+ * restarted at the new position later.
+ *
+ * @param[in] cache_entry - corresponding cache entry
+ * @param[in] offset - byte offset that was requested
+ */
+static void start_range_transcoder(Cache_Entry* cache_entry, size_t offset)
+{
+    switch (params.current_format(cache_entry->virtualfile())->filetype())
+    {
+    case FILETYPE_WAV:
+    case FILETYPE_AIFF:
+    {
+        break;
+    }
+    default:
+    {
+        return;
+    }
+    }
+
+    if (cache_entry->m_buffer->stream_window())
+    {
+        // Would push the data being read out of the window
+        return;
+    }
+
+    if (!cache_entry->m_data_offset || offset < cache_entry->m_buffer->buffer_watermark() + RANGE_SEEK_MIN)
+    {
+        // Header not yet written or close enough, simply wait
+        return;
+    }
+
+    if (cache_entry->m_range_running)
+    {
+        if (offset < cache_entry->m_range_start || offset >= cache_entry->m_range_pos + RANGE_SEEK_MIN)
+        {
+            // Request outside the range currently being filled in, stop it and restart at new position
+            cache_entry->m_range_stop = true;
+        }
+        return;
+    }
+
+    bool expected = false;
+    if (!cache_entry->m_range_running.compare_exchange_strong(expected, true))
+    {
+        return;
+    }
+
+    RANGE_DATA *range_data = new(std::nothrow) RANGE_DATA;
+    if (range_data == nullptr)
+    {
+        cache_entry->m_range_running = false;
+        return;
+    }
+
+    cache_entry->m_range_stop   = false;
+    cache_entry->m_range_start  = offset;
+    cache_entry->m_range_pos    = offset;
+
+    // Hold a reference so the cache entry stays alive while the thread runs
+    cache_entry->open(false);
+
+    range_data->m_cache_entry   = cache_entry;
+    range_data->m_offset        = offset;
+
+    Logging::debug(cache_entry->destname(), "Starting secondary transcoder at offset %1.", offset);
+
+    if (!tp->schedule_thread(&range_transcoder_thread, range_data, thread_pool::PRIORITY_INTERACTIVE))
+    {
+        Logging::error(cache_entry->destname(), "Unable to start secondary transcoder.");
+        cache_entry->m_range_running = false;
+        cache->close(&range_data->m_cache_entry);
+        delete range_data;
+    }
+}
 
 /**
  * @brief Transcode the buffer until the buffer has enough or until an error occurs.
@@ -78,7 +434,7 @@ static bool transcode_until(Cache_Entry* cache_entry, size_t offset, size_t len)
     size_t end = offset + len; // Cast OK: offset will never be < 0.
     bool success = true;
 
-    if (cache_entry->m_cache_info.m_finished || cache_entry->m_buffer->tell() >= end)
+    if (cache_entry->m_cache_info.m_finished || cache_entry->m_buffer->have_data(offset, len))
     {
         return true;
     }
@@ -89,7 +445,8 @@ static bool transcode_until(Cache_Entry* cache_entry, size_t offset, size_t len)
         if (cache_entry->m_is_decoding)
         {
             bool reported = false;
-            while (!cache_entry->m_cache_info.m_finished && !cache_entry->m_cache_info.m_error && cache_entry->m_buffer->tell() < end)
+            std::chrono::steady_clock::time_point wait_start = std::chrono::steady_clock::now();
+            while (!cache_entry->m_cache_info.m_finished && !cache_entry->m_cache_info.m_error && !cache_entry->m_buffer->have_data(offset, len))
             {
                 if (fuse_interrupted())
                 {
@@ -108,12 +465,23 @@ static bool transcode_until(Cache_Entry* cache_entry, size_t offset, size_t len)
                     Logging::trace(cache_entry->destname(), "Cache miss at offset %<%11zu>1 (length %<%6u>2), remaining %3.", offset, len, format_size_ex(cache_entry->m_buffer->size() - end).c_str());
                     reported = true;
                 }
-                sleep(0);
+
+                if (params.m_fast_pcm_seek)
+                {
+                    start_range_transcoder(cache_entry, offset);
+                }
+
+                // Block until the data is available, or we are woken up because of error, finish or timeout
+                cache_entry->m_buffer->wait_for_data(offset, len, WATERMARK_WAIT_MS);
             }
 
             if (reported)
             {
-                Logging::trace(cache_entry->destname(), "Cache hit  at offset %<%11zu>1 (length %<%6u>2), remaining %3.", offset, len, format_size_ex(cache_entry->m_buffer->size() - end).c_str());
+                int64_t wait_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wait_start).count();
+
+                cache_entry->update_wait_time(wait_time);
+
+                Logging::trace(cache_entry->destname(), "Cache hit  at offset %<%11zu>1 (length %<%6u>2), remaining %3, waited %4.", offset, len, format_size_ex(cache_entry->m_buffer->size() - end).c_str(), format_duration(wait_time).c_str());
             }
             success = !cache_entry->m_cache_info.m_error;
         }
@@ -143,10 +511,15 @@ static int transcode_finish(Cache_Entry* cache_entry, FFmpeg_Transcoder *transco
     // Check encoded buffer size.
     cache_entry->m_cache_info.m_encoded_filesize    = cache_entry->m_buffer->buffer_watermark();
     cache_entry->m_cache_info.m_finished 			= true;
+    cache_entry->m_cache_info.m_resume_offset       = 0;
+    cache_entry->m_cache_info.m_resume_pos          = 0;
     cache_entry->m_is_decoding                      = false;
     cache_entry->m_cache_info.m_errno               = 0;
     cache_entry->m_cache_info.m_averror             = 0;
 
+    // Readers waiting beyond the final size must not wait any longer
+    cache_entry->m_buffer->wakeup_waiters();
+
     Logging::debug(transcoder->destname(), "Finishing file.");
 
     if (!cache_entry->m_buffer->reserve(cache_entry->m_cache_info.m_encoded_filesize))
@@ -160,7 +533,9 @@ static int transcode_finish(Cache_Entry* cache_entry, FFmpeg_Transcoder *transco
                    format_result_size_ex(cache_entry->m_cache_info.m_encoded_filesize, cache_entry->m_cache_info.m_predicted_filesize).c_str(),
                    static_cast<double>((cache_entry->m_cache_info.m_encoded_filesize * 1000 / (cache_entry->m_cache_info.m_predicted_filesize + 1)) + 5) / 10);
 
-    cache_entry->flush();
+    // The entry will be marked finished in the database, so the data must be on disk now.
+    // Most of it has already been written back while transcoding.
+    cache_entry->flush(true);
 
     return 0;
 }
@@ -247,6 +622,37 @@ bool transcoder_cached_filesize(LPVIRTUALFILE virtualfile, struct stat *stbuf)
     }
 }
 
+bool transcoder_cached(LPVIRTUALFILE virtualfile)
+{
+    Cache_Entry* cache_entry = cache->open(virtualfile);
+    if (cache_entry == nullptr)
+    {
+        return false;
+    }
+
+    // Fetch info from database if not already in use
+    if (!cache_entry->open(false))
+    {
+        return false;
+    }
+
+    bool cached = cache_entry->m_is_decoding || (cache_entry->m_cache_info.m_finished && !cache_entry->m_cache_info.m_error && !cache_entry->outdated());
+
+    cache->close(&cache_entry);
+
+    return cached;
+}
+
+bool transcoder_in_use(LPCVIRTUALFILE virtualfile)
+{
+    if (cache == nullptr)
+    {
+        return false;
+    }
+
+    return cache->references(virtualfile);
+}
+
 bool transcoder_set_filesize(LPVIRTUALFILE virtualfile, int64_t duration, BITRATE audio_bit_rate, int channels, int sample_rate, BITRATE video_bit_rate, int width, int height, int interleaved, const AVRational &framerate)
 {
     Cache_Entry* cache_entry = cache->open(virtualfile);
@@ -284,6 +690,28 @@ bool transcoder_set_filesize(LPVIRTUALFILE virtualfile, int64_t duration, BITRAT
 
 bool transcoder_predict_filesize(LPVIRTUALFILE virtualfile, Cache_Entry* cache_entry)
 {
+    PROBE_INFO probe_info;
+
+    if (init_probe_info(virtualfile, &probe_info) && cache->read_probe(&probe_info))
+    {
+        FFmpegfs_Format *current_format = params.current_format(virtualfile);
+        if (current_format != nullptr)
+        {
+            if (virtualfile->m_type == VIRTUALTYPE_HLS)
+            {
+                // Only a segment of the source file
+                probe_info.m_duration = virtualfile->m_duration;
+            }
+
+            // Source has been probed before and has not changed, no need to open it again
+            cache_entry->m_cache_info.m_predicted_filesize = FFmpeg_Transcoder::calculate_predicted_filesize(probe_info, current_format, cache_entry->filename().c_str());
+
+            Logging::debug(cache_entry->filename(), "Predicted transcoded size of %1 from probe cache.", format_size_ex(cache_entry->m_cache_info.m_predicted_filesize).c_str());
+
+            return true;
+        }
+    }
+
     FFmpeg_Transcoder *transcoder = new(std::nothrow) FFmpeg_Transcoder;
     bool success = false;
 
@@ -297,6 +725,8 @@ bool transcoder_predict_filesize(LPVIRTUALFILE virtualfile, Cache_Entry* cache_e
     {
         cache_entry->m_cache_info.m_predicted_filesize  = transcoder->predicted_filesize();
 
+        save_probe_info(virtualfile, transcoder);
+
         transcoder->close();
 
         Logging::debug(cache_entry->filename(), "Predicted transcoded size of %1.", format_size_ex(cache_entry->m_cache_info.m_predicted_filesize).c_str());
@@ -309,7 +739,44 @@ bool transcoder_predict_filesize(LPVIRTUALFILE virtualfile, Cache_Entry* cache_e
     return success;
 }
 
-Cache_Entry* transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode)
+bool transcoder_get_duration(LPVIRTUALFILE virtualfile, int64_t *duration)
+{
+    PROBE_INFO probe_info;
+
+    if (init_probe_info(virtualfile, &probe_info) && cache->read_probe(&probe_info))
+    {
+        // Source has been probed before and has not changed, no need to open it again
+        *duration = probe_info.m_duration;
+        return true;
+    }
+
+    FFmpeg_Transcoder *transcoder = new(std::nothrow) FFmpeg_Transcoder;
+    bool success = false;
+
+    if (transcoder == nullptr)
+    {
+        Logging::error(virtualfile->m_origfile.str(), "Out of memory getting play time.");
+        errno = ENOMEM;
+        return false;
+    }
+
+    if (transcoder->open_input_file(virtualfile) >= 0 && transcoder->get_probe_info(&probe_info))
+    {
+        *duration = probe_info.m_duration;
+
+        save_probe_info(virtualfile, transcoder);
+
+        transcoder->close();
+
+        success = true;
+    }
+
+    delete transcoder;
+
+    return success;
+}
+
+Cache_Entry* transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode, bool background /*= false*/)
 {
     // Allocate transcoder structure
     Cache_Entry* cache_entry = cache->open(virtualfile);
@@ -329,6 +796,43 @@ Cache_Entry* transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode)
             throw static_cast<int>(errno);
         }
 
+        if (!background && cache_entry->m_background)
+        {
+            void *job = cache_entry->m_background_job.exchange(nullptr);
+
+            cache_entry->m_background = false;
+
+            if (job != nullptr && tp->promote_thread(job, thread_pool::PRIORITY_INTERACTIVE))
+            {
+                // Not started yet, do not leave it waiting behind other background jobs
+                Logging::debug(cache_entry->filename(), "File has been requested while queued for background transcoding, moved to interactive queue.");
+            }
+            else
+            {
+                Logging::debug(cache_entry->filename(), "File has been requested while transcoding in background, continuing at normal priority.");
+            }
+        }
+
+        if (!background && begin_transcode)
+        {
+            if (cache_entry->ref_count() == 1)
+            {
+                // First open, prefetch again when read far enough
+                cache_entry->m_prefetched = false;
+            }
+
+            if (params.m_prefetch)
+            {
+                prefetch_opened(virtualfile);
+            }
+
+            if (virtualfile->m_type == VIRTUALTYPE_HLS && params.m_segment_prefetch && !params.m_disable_cache)
+            {
+                // Player will soon ask for the next segments
+                prefetch_segments(virtualfile);
+            }
+        }
+
         if (params.m_disable_cache)
         {
             // Disable cache
@@ -355,25 +859,43 @@ Cache_Entry* transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode)
 
                 // Must decode the file, otherwise simply use cache
                 cache_entry->m_is_decoding  = true;
+                cache_entry->m_generation++;
 
                 THREAD_DATA* thread_data    = new(std::nothrow) THREAD_DATA;
 
                 thread_data->m_initialised  = false;
+                thread_data->m_detached     = background;
                 thread_data->m_arg          = cache_entry;
                 thread_data->m_lock_guard   = false;
 
+                if (background)
                 {
-                    std::unique_lock<std::mutex> lock(thread_data->m_mutex);
+                    // Do not wait for the thread, it may not start before other background jobs
+                    // have finished. Take its cache entry reference now so the entry stays valid.
+                    cache_entry->m_background = true;
+                    cache_entry->m_background_job = thread_data;
+                    cache_entry->open();
 
-                    tp->schedule_thread(&transcoder_thread, thread_data);
+                    // HLS segments support a file in use, so they come before other background jobs
+                    tp->schedule_thread(&transcoder_thread, thread_data, virtualfile->m_type == VIRTUALTYPE_HLS ? thread_pool::PRIORITY_NORMAL : thread_pool::PRIORITY_BACKGROUND);
 
-                    while (!thread_data->m_lock_guard)
+                    Logging::debug(cache_entry->filename(), "Decoder thread has been queued for background transcoding.");
+                }
+                else
+                {
                     {
-                        thread_data->m_cond.wait(lock);
+                        std::unique_lock<std::mutex> lock(thread_data->m_mutex);
+
+                        tp->schedule_thread(&transcoder_thread, thread_data, thread_pool::PRIORITY_INTERACTIVE);
+
+                        while (!thread_data->m_lock_guard)
+                        {
+                            thread_data->m_cond.wait(lock);
+                        }
                     }
-                }
 
-                Logging::debug(cache_entry->filename(), "Decoder thread is running.");
+                    Logging::debug(cache_entry->filename(), "Decoder thread is running.");
+                }
 
                 if (cache_entry->m_cache_info.m_error)
                 {
@@ -413,7 +935,7 @@ Cache_Entry* transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode)
     return cache_entry;
 }
 
-bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t len, int * bytes_read)
+bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t len, int * bytes_read, const void *reader /*= nullptr*/)
 {
     bool success = true;
 
@@ -480,6 +1002,19 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
         // Set last access time
         cache_entry->m_cache_info.m_access_time = time(nullptr);
 
+        if (cache_entry->m_buffer->stream_window())
+        {
+            if (offset < cache_entry->m_buffer->window_start())
+            {
+                Logging::error(cache_entry->destname(), "Offset %1 has already been dropped from the stream window.", offset);
+                errno = ESPIPE;
+                throw false;
+            }
+
+            // Let the transcoder know where we are
+            cache_entry->m_buffer->set_reader_pos(reader, offset);
+        }
+
         bool success = transcode_until(cache_entry, offset, len);
 
         if (!success)
@@ -489,13 +1024,14 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
         }
 
         // truncate if we didn't actually get len
-        if (cache_entry->m_buffer->buffer_watermark() < offset)
+        if (cache_entry->m_buffer->buffer_watermark() < offset && !cache_entry->m_buffer->have_data(offset, 1))
         {
             len = 0;
         }
         else if (cache_entry->m_buffer->buffer_watermark() < offset + len)
         {
-            len = cache_entry->m_buffer->buffer_watermark() - offset;
+            // May have been filled in by a secondary transcoder
+            len = cache_entry->m_buffer->readable(offset, len);
         }
 
         if (!cache_entry->m_buffer->copy(reinterpret_cast<uint8_t*>(buff), offset, len))
@@ -505,12 +1041,16 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
             throw false;
         }
 
+        cache_entry->m_buffer->set_reader_pos(reader, offset + len);
+
         if (cache_entry->m_cache_info.m_error)
         {
             errno = cache_entry->m_cache_info.m_errno ? cache_entry->m_cache_info.m_errno : EIO;
             throw false;
         }
 
+        check_prefetch(cache_entry, offset, len);
+
         errno = 0;
     }
     catch (bool _success)
@@ -523,8 +1063,54 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
     return success;
 }
 
-void transcoder_delete(Cache_Entry* cache_entry)
+bool transcoder_read_fd(Cache_Entry* cache_entry, size_t offset, size_t len, int *fd, size_t *bytes_read)
+{
+    if (cache_entry->m_cache_info.m_error)
+    {
+        // Let transcoder_read() report the error
+        return false;
+    }
+
+    size_t readable = cache_entry->m_buffer->readable(offset, len);
+
+    if (readable < len && !cache_entry->m_cache_info.m_finished)
+    {
+        // Need to wait for the transcoder
+        return false;
+    }
+
+    *fd = cache_entry->m_buffer->fd();
+    if (*fd == -1)
+    {
+        return false;
+    }
+
+    Logging::trace(cache_entry->destname(), "Reading %1 bytes from offset %2 from cache file.", readable, offset);
+
+    // Store access time
+    cache_entry->update_access();
+
+    // Update read counter
+    cache_entry->update_read_count();
+
+    // Set last access time
+    cache_entry->m_cache_info.m_access_time = time(nullptr);
+
+    check_prefetch(cache_entry, offset, readable);
+
+    *bytes_read = readable;
+
+    return true;
+}
+
+void transcoder_delete(Cache_Entry* cache_entry, const void *reader /*= nullptr*/)
 {
+    if (reader != nullptr)
+    {
+        // Do not hold back the transcoder any longer
+        cache_entry->m_buffer->remove_reader(reader);
+    }
+
     cache->close(&cache_entry);
 }
 
@@ -560,6 +1146,18 @@ bool transcoder_cache_maintenance(void)
     }
 }
 
+bool transcoder_cache_room(size_t predicted_filesize)
+{
+    if (cache != nullptr)
+    {
+        return cache->room_for(predicted_filesize);
+    }
+    else
+    {
+        return false;
+    }
+}
+
 bool transcoder_cache_clear(void)
 {
     if (cache != nullptr)
@@ -572,6 +1170,24 @@ bool transcoder_cache_clear(void)
     }
 }
 
+/**
+ * @brief Prefetch the next files in directory if the file has been read far enough.
+ * @param[in] cache_entry - corresponding cache entry
+ * @param[in] offset - byte offset of the current read
+ * @param[in] len - length of the current read
+ */
+static void check_prefetch(Cache_Entry* cache_entry, size_t offset, size_t len)
+{
+    if (params.m_prefetch && !cache_entry->m_prefetched && offset + len >= (cache_entry->size() / 100) * params.m_prefetch_trigger)
+    {
+        bool expected = false;
+        if (cache_entry->m_prefetched.compare_exchange_strong(expected, true))
+        {
+            prefetch_next(cache_entry->virtualfile());
+        }
+    }
+}
+
 /**
  * @brief Transcoding thread
  * @param[in] arg - Corresponding Cache_Entry object.
@@ -585,9 +1201,22 @@ static void transcoder_thread(void *arg)
     int syserror = 0;
     bool timeout = false;
     bool success = true;
+    bool resumable = false;
+    bool background = cache_entry->m_background && cache_entry->virtualfile()->m_type != VIRTUALTYPE_HLS;   // HLS segments need not give way
+    SEEK_INDEX seek_index_head;
+    int saved_nice = INT_MIN;
+    int saved_ioprio = -1;
+
+    // Started, there is nothing left to promote
+    cache_entry->m_background_job = nullptr;
 
     std::unique_lock<std::recursive_mutex> lock(cache_entry->m_active_mutex);
 
+    if (background)
+    {
+        lower_priority(&saved_nice, &saved_ioprio);
+    }
+
     try
     {
         if (transcoder == nullptr)
@@ -598,7 +1227,7 @@ static void transcoder_thread(void *arg)
 
         Logging::info(cache_entry->filename(), "Transcoding to %1.", params.current_format(cache_entry->virtualfile())->desttype().c_str());
 
-        if (!cache_entry->open())
+        if (!thread_data->m_detached && !cache_entry->open())
         {
             throw (static_cast<int>(errno));
         }
@@ -614,12 +1243,38 @@ static void transcoder_thread(void *arg)
             cache_entry->m_cache_info.m_predicted_filesize  = transcoder->predicted_filesize();
         }
 
-        if (!cache->maintenance(transcoder->predicted_filesize()))
+        save_probe_info(cache_entry->virtualfile(), transcoder);
+
+        if (cache_entry->m_background)
+        {
+            // Never push requested files out of the cache for a background job
+            if (!cache->room_for(transcoder->predicted_filesize()))
+            {
+                throw (static_cast<int>(errno));
+            }
+        }
+        else if (!cache_entry->m_buffer->stream_window() && !cache->maintenance(transcoder->predicted_filesize()))
         {
             throw (static_cast<int>(errno));
         }
 
-        averror = transcoder->open_output_file(cache_entry->m_buffer);
+        if (cache_entry->m_cache_info.m_resume_offset)
+        {
+            // Keep the seek index of the part that will not be transcoded again
+            cache->read_seek_index(cache_entry->filename(), cache_entry->m_cache_info.m_desttype, &seek_index_head);
+
+            while (!seek_index_head.empty() && seek_index_head.back().m_offset >= cache_entry->m_cache_info.m_resume_offset)
+            {
+                seek_index_head.pop_back();
+            }
+
+            // Continue an interrupted transcode from its last checkpoint
+            averror = transcoder->open_output_resume(cache_entry->m_buffer, cache_entry->m_cache_info.m_resume_offset, &cache_entry->m_data_offset);
+        }
+        else
+        {
+            averror = transcoder->open_output_file(cache_entry->m_buffer);
+        }
         if (averror < 0)
         {
             throw (static_cast<int>(errno));
@@ -627,6 +1282,26 @@ static void transcoder_thread(void *arg)
 
         memcpy(&cache_entry->m_id3v1, transcoder->id3v1tag(), sizeof(ID3v1));
 
+        switch (params.current_format(cache_entry->virtualfile())->filetype())
+        {
+        case FILETYPE_WAV:
+        case FILETYPE_AIFF:
+        {
+            if (!cache_entry->m_cache_info.m_resume_offset)
+            {
+                // Header has been written, audio data starts here
+                cache_entry->m_data_offset = cache_entry->m_buffer->tell();
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+        }
+
+        time_t last_checkpoint = time(nullptr);
+
         thread_data->m_initialised = true;
 
         bool unlocked = false;
@@ -652,6 +1327,38 @@ static void transcoder_thread(void *arg)
                 cache_entry->update_access(false);
             }
 
+            if (background)
+            {
+                if (!cache_entry->m_background)
+                {
+                    // File has been requested
+                    restore_priority(&saved_nice, &saved_ioprio);
+                    background = false;
+                }
+            }
+
+            if (cache_entry->m_buffer->stream_window() && !cache_entry->m_buffer->wait_for_room(0))
+            {
+                if (!unlocked)
+                {
+                    // Window is full, pre-buffering ends here
+                    unlocked = true;
+                    thread_data->m_lock_guard = true;
+                    thread_data->m_cond.notify_all();   // signal that we are running
+                }
+
+                // Streaming: Wait until the slowest reader has moved on
+                while (!cache_entry->m_buffer->wait_for_room(WATERMARK_WAIT_MS) && !(timeout = cache_entry->decode_timeout()) && !thread_exit)
+                {
+                    // Readers wake us up when they move on
+                }
+
+                if (timeout || thread_exit)
+                {
+                    break;
+                }
+            }
+
             averror = transcoder->process_single_fr(status);
             if (status < 0)
             {
@@ -660,11 +1367,22 @@ static void transcoder_thread(void *arg)
                 break;
             }
 
-            if (status == 1 && ((averror = transcode_finish(cache_entry, transcoder)) < 0))
+            if (status == 1)
             {
-                syserror = EIO;
-                success = false;
-                break;
+                if ((averror = transcode_finish(cache_entry, transcoder)) < 0)
+                {
+                    syserror = EIO;
+                    success = false;
+                    break;
+                }
+
+                save_seek_index(cache_entry, transcoder, seek_index_head, true);
+            }
+
+            if (!cache_entry->m_cache_info.m_finished && time(nullptr) - last_checkpoint >= CHECKPOINT_INTERVAL)
+            {
+                save_checkpoint(cache_entry, transcoder, seek_index_head);
+                last_checkpoint = time(nullptr);
             }
 
             if (!unlocked && cache_entry->m_buffer->buffer_watermark() > params.m_prebuffer_size)
@@ -719,19 +1437,34 @@ static void transcoder_thread(void *arg)
 
         thread_data->m_lock_guard = true;
         thread_data->m_cond.notify_all();           // unlock main thread
+
+        cache_entry->m_buffer->wakeup_waiters();    // release readers waiting for data
+    }
+
+    if ((timeout || thread_exit) && success && !cache_entry->m_cache_info.m_finished)
+    {
+        // Keep what has been done so far if the transcode can be picked up again later
+        resumable = save_checkpoint(cache_entry, transcoder, seek_index_head);
     }
 
     transcoder->close();
 
     delete transcoder;
 
+    if (background)
+    {
+        restore_priority(&saved_nice, &saved_ioprio);
+    }
+
+    cache_entry->m_background = false;
+
     if (timeout || thread_exit)
     {
         cache_entry->m_is_decoding              = false;
         cache_entry->m_cache_info.m_finished    = false;
-        cache_entry->m_cache_info.m_error       = true;
-        cache_entry->m_cache_info.m_errno       = EIO;      // Report I/O error
-        cache_entry->m_cache_info.m_averror     = averror;  // Preserve averror
+        cache_entry->m_cache_info.m_error       = !resumable;
+        cache_entry->m_cache_info.m_errno       = resumable ? 0 : EIO;          // Report I/O error
+        cache_entry->m_cache_info.m_averror     = resumable ? 0 : averror;      // Preserve averror
 
         if (timeout)
         {
@@ -741,6 +1474,11 @@ static void transcoder_thread(void *arg)
         {
             Logging::info(cache_entry->destname(), "Thread exit! Transcoding aborted.");
         }
+
+        if (resumable)
+        {
+            Logging::info(cache_entry->destname(), "Transcoding will be resumed at offset %1 when the file is accessed again.", cache_entry->m_cache_info.m_resume_offset);
+        }
     }
     else
     {
@@ -767,13 +1505,127 @@ static void transcoder_thread(void *arg)
         }
     }
 
-    cache->close(&cache_entry, timeout ? CACHE_CLOSE_DELETE : CACHE_CLOSE_NOOPT);
+    // Make sure no reader keeps waiting for data that will never come
+    cache_entry->m_buffer->wakeup_waiters();
+
+    if (cache_entry->wait_count())
+    {
+        Logging::debug(cache_entry->destname(), "Readers were blocked %1 times waiting for the transcoder for a total of %2.", cache_entry->wait_count(), format_duration(cache_entry->wait_time()).c_str());
+    }
+
+    cache->close(&cache_entry, (timeout && !resumable) ? CACHE_CLOSE_DELETE : CACHE_CLOSE_NOOPT);
 
     delete thread_data;
 
     errno = syserror;
 }
 
+/**
+ * @brief Secondary transcoder thread for PCM formats.
+ *
+ * Fills in the buffer from a seek position while the main transcoder thread
+ * is still working on the beginning of the file. Stops when the main transcoder
+ * catches up, when another seek occurs, or when the file is no longer accessed.
+ *
+ * @param[in] arg - Corresponding RANGE_DATA object.
+ */
+static void range_transcoder_thread(void *arg)
+{
+    RANGE_DATA *range_data = static_cast<RANGE_DATA*>(arg);
+    Cache_Entry *cache_entry = range_data->m_cache_entry;
+    FFmpeg_Transcoder *transcoder = new(std::nothrow) FFmpeg_Transcoder;
+    const char *reason = "finished";
+
+    try
+    {
+        if (transcoder == nullptr)
+        {
+            Logging::error(cache_entry->filename(), "Internal error: Trancoder object should not be NULL.");
+            throw false;
+        }
+
+        if (transcoder->open_input_file(cache_entry->virtualfile()) < 0)
+        {
+            throw false;
+        }
+
+        if (transcoder->open_output_range(cache_entry->m_buffer, cache_entry->m_data_offset, range_data->m_offset) < 0)
+        {
+            throw false;
+        }
+
+        cache_entry->m_range_start  = transcoder->range_start();
+        cache_entry->m_range_pos    = transcoder->range_pos();
+
+        while (true)
+        {
+            int status = 0;
+
+            if (cache_entry->m_range_stop || thread_exit)
+            {
+                reason = "stopped";
+                break;
+            }
+
+            if (cache_entry->m_cache_info.m_finished || cache_entry->m_cache_info.m_error || !cache_entry->m_is_decoding)
+            {
+                reason = "main transcoder ended";
+                break;
+            }
+
+            if (cache_entry->m_buffer->buffer_watermark() >= transcoder->range_pos())
+            {
+                reason = "main transcoder caught up";
+                break;
+            }
+
+            if (time(nullptr) - cache_entry->last_access() > params.m_max_inactive_suspend)
+            {
+                reason = "no longer accessed";
+                break;
+            }
+
+            int ret = transcoder->process_single_fr(status);
+
+            cache_entry->m_range_pos = transcoder->range_pos();
+
+            if (status < 0 || ret < 0)
+            {
+                reason = "error";
+                break;
+            }
+
+            if (status == 1)
+            {
+                reason = "end of file";
+                break;
+            }
+        }
+    }
+    catch (bool)
+    {
+        reason = "error";
+    }
+
+    if (transcoder != nullptr)
+    {
+        Logging::debug(cache_entry->destname(), "Secondary transcoder filled in %1 from offset %2: %3.", format_size_ex(transcoder->range_pos() - transcoder->range_start()).c_str(), transcoder->range_start(), reason);
+
+        transcoder->close();
+
+        delete transcoder;
+    }
+
+    cache_entry->m_range_running = false;
+
+    // Readers may be waiting for data in this range, let them re-check and possibly restart
+    cache_entry->m_buffer->wakeup_waiters();
+
+    cache->close(&cache_entry);
+
+    delete range_data;
+}
+
 #ifndef USING_LIBAV
 void ffmpeg_log(void *ptr, int level, const char *fmt, va_list vl)
 {
@@ -47,6 +47,16 @@
  *  @return Returns true if file was found in cache, false if not (stbuf will be unchanged)
  */
 bool            transcoder_cached_filesize(LPVIRTUALFILE virtualfile, struct stat *stbuf);
+/** @brief Check if a file has already been transcoded
+ *  @param[in] virtualfile - virtual file object to check
+ *  @return Returns true if the file is completely transcoded and up to date, or currently being transcoded; false if not
+ */
+bool            transcoder_cached(LPVIRTUALFILE virtualfile);
+/** @brief Check if a virtual file object is referenced by a cache entry
+ *  @param[in] virtualfile - virtual file object to check
+ *  @return Returns true if a cache entry refers to this very object; false if not
+ */
+bool            transcoder_in_use(LPCVIRTUALFILE virtualfile);
 // Set the file size
 /** @brief
  *  @param[in] virtualfile - virtual file object to open.
@@ -68,6 +78,12 @@ bool            transcoder_set_filesize(LPVIRTUALFILE virtualfile, int64_t durat
  *  @return On error, returns false (size could not be predicted) or true on success
  */
 bool            transcoder_predict_filesize(LPVIRTUALFILE virtualfile, Cache_Entry* cache_entry);
+/** @brief Get the play time of a source file
+ *  @param[in] virtualfile - virtual file object of the source file
+ *  @param[out] duration - play time in AV_TIME_BASE fractional seconds
+ *  @return On error, returns false (file could not be probed) or true on success
+ */
+bool            transcoder_get_duration(LPVIRTUALFILE virtualfile, int64_t *duration);
 
 // Functions for doing transcoding, called by main program body
 /** @brief Allocate and initialise the transcoder
@@ -75,11 +91,18 @@ bool            transcoder_predict_filesize(LPVIRTUALFILE virtualfile, Cache_Ent
  * Opens a file and starts the decoding thread if begin_transcode is true.
  * File will be scanned to detect bit rate, duration etc. only if begin_transcode is false.
  *
+ * A background transcode runs at idle priority, does not wait for the decoding thread
+ * to start and will not prune other files from the cache to make room. If the file is
+ * opened normally while it is being transcoded in background it becomes a regular job.
+ * HLS segments are transcoded in advance to support a file in use, so they run at
+ * normal priority instead.
+ *
  *  @param[in] virtualfile - virtual file object to open
  *  @param[in] begin_transcode - if true, transcoding starts, if false file will be scanned only
+ *  @param[in] background - if true, transcode in background (for cache warming)
  *  @return On success, returns cache entry object. On error, returns nullptr and sets errno accordingly.
  */
-Cache_Entry*    transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode);
+Cache_Entry*    transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode, bool background = false);
 /** @brief Read some bytes from the internal buffer and into the given buffer.
  *  @note buff must be large enough to hold len number of bytes.
  *  @note Returns number of bytes read, may be less than len bytes.
@@ -88,9 +111,23 @@ Cache_Entry*    transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode);
  *  @param[in] offset - byte offset to start reading at
  *  @param[in] len - length of data chunk to be read.
  *  @param[out] bytes_read - Bytes read from transcoder.
+ *  @param[in] reader - Opaque identification of the reader (e.g. the open file handle), used to pace the transcoder in streaming mode.
  *  @return On success, returns true. On error, returns false and sets errno accordingly.
  */
-bool            transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t len, int *bytes_read);
+bool            transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t len, int *bytes_read, const void *reader = nullptr);
+/** @brief Get the cache file descriptor to read data from, if the data is already available.
+ *
+ * Used to serve reads without copying the data in user space. If the requested range has not
+ * been transcoded yet, nothing is done and transcoder_read() must be used instead.
+ *
+ *  @param[in] cache_entry - corresponding cache entry
+ *  @param[in] offset - byte offset to start reading at
+ *  @param[in] len - length of data chunk to be read.
+ *  @param[out] fd - file descriptor of the cache file, data starts at offset.
+ *  @param[out] bytes_read - bytes that can be read from fd, may be less than len at the end of the file.
+ *  @return Returns true if the data can be read from fd; false if transcoder_read() must be used.
+ */
+bool            transcoder_read_fd(Cache_Entry* cache_entry, size_t offset, size_t len, int *fd, size_t *bytes_read);
 /** @brief Free the cache entry structure.
  *
  * Call this to free the cache entry structure. @n
@@ -98,8 +135,9 @@ bool            transcoder_read(Cache_Entry* cache_entry, char* buff, size_t off
  * use by another thread, the cache entry may no longer be valid.
  *
  *  @param[in] cache_entry - corresponding cache entry
+ *  @param[in] reader - Reader identification passed to transcoder_read(), if any.
  */
-void            transcoder_delete(Cache_Entry* cache_entry);
+void            transcoder_delete(Cache_Entry* cache_entry, const void *reader = nullptr);
 /** @brief Return size of output file, as computed by encoder.
  *
  * Returns the file size, either the predicted size (which may be inaccurate) or
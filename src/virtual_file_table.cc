@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+
+/**
+ * @file
+ * @brief Virtual_File_Table class implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "virtual_file_table.h"
+#include "ffmpeg_utils.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include <string.h>
+
+#define REMOVED_GRACE_TIME      60                  /**< @brief Free removed entries one minute after removal at the earliest */
+
+Virtual_File_Table::Virtual_File_Table(const in_use_t & in_use)
+    : m_size(0)
+    , m_max_files(0)
+    , m_in_use(in_use)
+{
+}
+
+Virtual_File_Table::~Virtual_File_Table()
+{
+    for (size_t n = 0; n < m_shard_count; n++)
+    {
+        std::lock_guard<std::mutex> lock(m_shards[n].m_mutex);
+
+        for (directories_t::iterator dir = m_shards[n].m_directories.begin(); dir != m_shards[n].m_directories.end(); ++dir)
+        {
+            for (files_t::iterator file = dir->second.m_files.begin(); file != dir->second.m_files.end(); ++file)
+            {
+                delete file->second;
+            }
+        }
+        m_shards[n].m_directories.clear();
+    }
+
+    free_removed(true);
+}
+
+void Virtual_File_Table::set_limit(size_t max_files)
+{
+    m_max_files = max_files;
+}
+
+void Virtual_File_Table::split_path(const std::string & filepath, std::string *path, std::string *filename)
+{
+    size_t found = filepath.rfind('/');
+
+    if (found == std::string::npos)
+    {
+        path->clear();
+        *filename = filepath;
+    }
+    else
+    {
+        *path = filepath.substr(0, found + 1);
+        *filename = filepath.substr(found + 1);
+    }
+}
+
+Virtual_File_Table::SHARD & Virtual_File_Table::shard(const std::string & path)
+{
+    return m_shards[std::hash<std::string>()(path) % m_shard_count];
+}
+
+LPVIRTUALFILE Virtual_File_Table::insert(const std::string & virtfilepath, VIRTUALTYPE type, const std::string & origfile, int format_idx, const struct stat *stbuf)
+{
+    std::string path;
+    std::string filename;
+    ENTRY *entry;
+
+    split_path(virtfilepath, &path, &filename);
+
+    {
+        SHARD & _shard = shard(path);
+        std::lock_guard<std::mutex> lock(_shard.m_mutex);
+
+        directories_t::iterator dir = _shard.m_directories.find(path);
+        if (dir == _shard.m_directories.end())
+        {
+            dir = _shard.m_directories.insert(make_pair(path, DIRECTORY())).first;
+        }
+
+        files_t & files = dir->second.m_files;
+        files_t::iterator it = files.find(filename);
+
+        if (it != files.end())
+        {
+            entry = it->second;
+        }
+        else
+        {
+            entry = new(std::nothrow) ENTRY;
+            if (entry == nullptr)
+            {
+                if (files.empty())
+                {
+                    _shard.m_directories.erase(dir);
+                }
+                errno = ENOMEM;
+                return nullptr;
+            }
+
+            entry->m_dir    = &*dir;
+            entry->m_file   = files.insert(make_pair(filename, entry)).first;
+            entry->m_lru    = _shard.m_lru.end();
+            m_size++;
+        }
+
+        VIRTUALFILE & virtualfile = entry->m_virtualfile;
+
+        memcpy(&virtualfile.m_st, stbuf, sizeof(struct stat));
+
+        virtualfile.m_type          = type;
+        virtualfile.m_format_idx    = format_idx;
+        virtualfile.m_origfile.assign(origfile);
+
+        touch(_shard, entry);
+    }
+
+    if (m_max_files && m_size > m_max_files)
+    {
+        evict();
+    }
+
+    return &entry->m_virtualfile;
+}
+
+LPVIRTUALFILE Virtual_File_Table::find(const std::string & virtfilepath)
+{
+    std::string path;
+    std::string filename;
+
+    split_path(virtfilepath, &path, &filename);
+
+    SHARD & _shard = shard(path);
+    std::lock_guard<std::mutex> lock(_shard.m_mutex);
+
+    directories_t::iterator dir = _shard.m_directories.find(path);
+    if (dir == _shard.m_directories.end())
+    {
+        return nullptr;
+    }
+
+    files_t::iterator file = dir->second.m_files.find(filename);
+    if (file == dir->second.m_files.end())
+    {
+        return nullptr;
+    }
+
+    touch(_shard, file->second);
+
+    return &file->second->m_virtualfile;
+}
+
+void Virtual_File_Table::touch(SHARD & _shard, ENTRY *entry)
+{
+    if (entry->m_lru == _shard.m_lru.end())
+    {
+        entry->m_lru = _shard.m_lru.insert(_shard.m_lru.end(), entry);
+    }
+    else
+    {
+        _shard.m_lru.splice(_shard.m_lru.end(), _shard.m_lru, entry->m_lru);
+    }
+}
+
+bool Virtual_File_Table::has_files(const std::string & _path)
+{
+    std::string path(_path);
+
+    append_sep(&path);
+
+    SHARD & _shard = shard(path);
+    std::lock_guard<std::mutex> lock(_shard.m_mutex);
+
+    directories_t::const_iterator dir = _shard.m_directories.find(path);
+
+    return (dir != _shard.m_directories.end() && !dir->second.m_files.empty());
+}
+
+size_t Virtual_File_Table::list(const std::string & _path, std::vector<LPCVIRTUALFILE> *files)
+{
+    std::string path(_path);
+
+    append_sep(&path);
+
+    files->clear();
+
+    SHARD & _shard = shard(path);
+    std::lock_guard<std::mutex> lock(_shard.m_mutex);
+
+    directories_t::const_iterator dir = _shard.m_directories.find(path);
+    if (dir != _shard.m_directories.end())
+    {
+        files->reserve(dir->second.m_files.size());
+
+        for (files_t::const_iterator file = dir->second.m_files.begin(); file != dir->second.m_files.end(); ++file)
+        {
+            files->push_back(&file->second->m_virtualfile);
+        }
+    }
+
+    return files->size();
+}
+
+size_t Virtual_File_Table::size() const
+{
+    return m_size;
+}
+
+void Virtual_File_Table::evict()
+{
+    std::unique_lock<std::mutex> evict_lock(m_evict_mutex, std::try_to_lock);
+
+    if (!evict_lock.owns_lock())
+    {
+        // Already running in another thread
+        return;
+    }
+
+    // Make some headroom so this does not run on every insert
+    size_t target = m_max_files - m_max_files / 10;
+
+    if (m_size <= target)
+    {
+        return;
+    }
+
+    size_t count = m_size - target;
+    // Take the same share from each shard, repeat if some of them run out of files
+    size_t quota = (count + m_shard_count - 1) / m_shard_count;
+    std::list<REMOVED> removed;
+    time_t now = time(nullptr);
+    bool found = true;
+
+    while (removed.size() < count && found)
+    {
+        found = false;
+
+        for (size_t n = 0; n < m_shard_count && removed.size() < count; n++)
+        {
+            SHARD & _shard = m_shards[n];
+            std::lock_guard<std::mutex> lock(_shard.m_mutex);
+
+            for (size_t i = 0; i < quota && !_shard.m_lru.empty() && removed.size() < count; i++)
+            {
+                ENTRY *entry = _shard.m_lru.front();
+                directories_t::value_type *dir = entry->m_dir;
+
+                _shard.m_lru.pop_front();
+                entry->m_lru = _shard.m_lru.end();
+
+                dir->second.m_files.erase(entry->m_file);
+                if (dir->second.m_files.empty())
+                {
+                    _shard.m_directories.erase(std::string(dir->first));
+                }
+
+                REMOVED removed_entry = { entry, now };
+
+                removed.push_back(removed_entry);
+                m_size--;
+                found = true;
+            }
+        }
+    }
+
+    if (removed.empty())
+    {
+        // Nothing that can be removed
+        return;
+    }
+
+    Logging::debug(nullptr, "Removed %1 least recently used files from virtual file table, %2 files left.", removed.size(), m_size.load());
+
+    {
+        std::lock_guard<std::mutex> lock(m_removed_mutex);
+        m_removed.splice(m_removed.end(), removed);
+    }
+
+    free_removed(false);
+}
+
+void Virtual_File_Table::free_removed(bool force)
+{
+    std::list<REMOVED> expired;
+    time_t now = time(nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(m_removed_mutex);
+
+        for (std::list<REMOVED>::iterator it = m_removed.begin(); it != m_removed.end();)
+        {
+            std::list<REMOVED>::iterator next = std::next(it);
+
+            if (force || now - it->m_removed >= REMOVED_GRACE_TIME)
+            {
+                expired.splice(expired.end(), m_removed, it);
+            }
+
+            it = next;
+        }
+    }
+
+    // The callback takes the cache lock, a thread holding that may be waiting for ours
+    for (std::list<REMOVED>::iterator it = expired.begin(); it != expired.end();)
+    {
+        if (force || !(m_in_use && m_in_use(&it->m_entry->m_virtualfile)))
+        {
+            delete it->m_entry;
+            it = expired.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (!expired.empty())
+    {
+        // Still in use, try again later
+        std::lock_guard<std::mutex> lock(m_removed_mutex);
+        m_removed.splice(m_removed.end(), expired);
+    }
+}
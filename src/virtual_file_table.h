@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+
+/**
+ * @file
+ * @brief Virtual_File_Table class, the list of all virtual files
+ *
+ * Files are grouped by directory: The directory path is stored only once,
+ * files are kept in a sorted list per directory. Directories are spread
+ * over several shards by a hash of their path, each shard has its own
+ * lock, so FUSE threads accessing different directories do not block
+ * each other.
+ * The original file names kept in the virtual files share their path
+ * with the other files of the directory, see #Shared_Path.
+ *
+ * If a maximum number of files is set, the least recently used files
+ * are removed from the table when it grows beyond that limit. Each shard
+ * keeps its files in order of use, files are removed from all shards in
+ * turn, so the table does not have to be scanned. They will be added
+ * again when accessed: regular files are looked up in their directory,
+ * HLS segments, DVD, Blu-ray and VCD titles and virtual scripts are
+ * created again from their source.
+ *
+ * Pointers to removed files may still be in use, so these are not freed
+ * right away but after a grace period, and only if no open file or cache entry
+ * refers to them.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2020 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef VIRTUAL_FILE_TABLE_H
+#define VIRTUAL_FILE_TABLE_H
+
+#pragma once
+
+#include "fileio.h"
+
+#include <map>
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+/**
+ * @brief The #Virtual_File_Table class
+ */
+class Virtual_File_Table
+{
+    struct ENTRY;
+
+    typedef std::map<std::string, ENTRY *> files_t;     /**< @brief Files in a directory, by file name */
+    typedef std::list<ENTRY *> lru_t;                   /**< @brief Files in order of use, least recently used first */
+
+    /**
+     * @brief Directory, holds all files with the same path.
+     */
+    typedef struct DIRECTORY
+    {
+        files_t                     m_files;            /**< @brief Files in directory, sorted by name */
+    } DIRECTORY;
+
+    typedef std::unordered_map<std::string, DIRECTORY> directories_t;   /**< @brief Directories, by path including trailing slash */
+
+    /**
+     * @brief Table entry, a virtual file plus housekeeping data.
+     */
+    typedef struct ENTRY
+    {
+        VIRTUALFILE                 m_virtualfile;      /**< @brief The virtual file */
+        directories_t::value_type * m_dir;              /**< @brief Directory the file is in */
+        files_t::iterator           m_file;             /**< @brief Position in directory */
+        lru_t::iterator             m_lru;              /**< @brief Position in the LRU list of the shard */
+    } ENTRY;
+
+    /**
+     * @brief Shard, a part of the table with its own lock.
+     */
+    typedef struct SHARD
+    {
+        std::mutex                  m_mutex;            /**< @brief Access mutex */
+        directories_t               m_directories;      /**< @brief Directories in this shard */
+        lru_t                       m_lru;              /**< @brief Files in this shard, least recently used first */
+    } SHARD;
+
+    /**
+     * @brief Removed entry, waiting to be freed.
+     */
+    typedef struct REMOVED
+    {
+        ENTRY *                     m_entry;            /**< @brief Removed entry */
+        time_t                      m_removed;          /**< @brief Time the entry was removed */
+    } REMOVED;
+
+public:
+    /**
+     * @brief Callback to check if a virtual file is still referenced outside the table.
+     */
+    typedef std::function<bool(LPCVIRTUALFILE virtualfile)> in_use_t;
+
+    /**
+     * @brief Construct #Virtual_File_Table object.
+     * @param[in] in_use - Function to check if a removed virtual file is still referenced. May be empty.
+     */
+    explicit Virtual_File_Table(const in_use_t & in_use = in_use_t());
+    /**
+     * @brief Destruct #Virtual_File_Table object. Frees all virtual files.
+     */
+    virtual ~Virtual_File_Table();
+
+    /**
+     * @brief Set maximum number of files to keep.
+     * @param[in] max_files - Maximum number of files, 0 for no limit.
+     */
+    void                    set_limit(size_t max_files);
+    /**
+     * @brief Add a virtual file. If it already exists, it will be updated.
+     * @param[in] virtfilepath - Sanitised name and path of virtual file.
+     * @param[in] type - Type of virtual file.
+     * @param[in] origfile - Sanitised name and path of original file.
+     * @param[in] format_idx - Index into params.format[] array.
+     * @param[in] stbuf - stat buffer with file size, time etc.
+     * @return Returns pointer to VIRTUALFILE object of file, nullptr if out of memory.
+     */
+    LPVIRTUALFILE           insert(const std::string & virtfilepath, VIRTUALTYPE type, const std::string & origfile, int format_idx, const struct stat *stbuf);
+    /**
+     * @brief Find a virtual file.
+     * @param[in] virtfilepath - Sanitised name and path of virtual file.
+     * @return If found, returns VIRTUALFILE object, if not found returns nullptr.
+     */
+    LPVIRTUALFILE           find(const std::string & virtfilepath);
+    /**
+     * @brief Check if a directory contains any virtual files.
+     * @param[in] path - Directory path, with or without trailing slash.
+     * @return Returns true if files were found; false if not.
+     */
+    bool                    has_files(const std::string & path);
+    /**
+     * @brief Get all virtual files of a directory.
+     *
+     * The list is a copy, the directory may be changed while the files are processed.
+     *
+     * @param[in] path - Directory path, with or without trailing slash.
+     * @param[out] files - Virtual files, sorted by name.
+     * @return Returns number of files found.
+     */
+    size_t                  list(const std::string & path, std::vector<LPCVIRTUALFILE> *files);
+    /**
+     * @brief Get number of virtual files in table.
+     * @return Returns number of virtual files in table.
+     */
+    size_t                  size() const;
+
+protected:
+    /**
+     * @brief Split a file path into directory and file name.
+     * @param[in] filepath - Name and path of file.
+     * @param[out] path - Directory including trailing slash.
+     * @param[out] filename - File name.
+     */
+    static void             split_path(const std::string & filepath, std::string *path, std::string *filename);
+    /**
+     * @brief Get shard for a directory.
+     * @param[in] path - Directory including trailing slash.
+     * @return Returns shard the directory belongs to.
+     */
+    SHARD &                 shard(const std::string & path);
+    /**
+     * @brief Mark file as most recently used. The shard must be locked by the caller.
+     * @param[in] _shard - Shard the file belongs to.
+     * @param[in] entry - Table entry of file.
+     */
+    static void             touch(SHARD & _shard, ENTRY *entry);
+    /**
+     * @brief Remove least recently used files until the table is below its limit again.
+     */
+    void                    evict();
+    /**
+     * @brief Free removed entries after their grace period if no longer in use.
+     *
+     * The in use callback is called without holding any lock of the table.
+     * @param[in] force - If true, free all removed entries regardless of time or use.
+     */
+    void                    free_removed(bool force);
+
+private:
+    static const size_t     m_shard_count = 64;             /**< @brief Number of shards */
+
+    SHARD                   m_shards[m_shard_count];        /**< @brief Table shards */
+    std::atomic_size_t      m_size;                         /**< @brief Number of files in table */
+    std::atomic_size_t      m_max_files;                    /**< @brief Maximum number of files, 0 for no limit */
+    std::mutex              m_evict_mutex;                  /**< @brief Only one thread evicts files at a time */
+    std::mutex              m_removed_mutex;                /**< @brief Protects m_removed */
+    std::list<REMOVED>      m_removed;                      /**< @brief Removed entries waiting to be freed */
+    in_use_t                m_in_use;                       /**< @brief Check if a removed entry is still referenced */
+};
+
+#endif // VIRTUAL_FILE_TABLE_H
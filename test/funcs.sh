@@ -25,6 +25,14 @@ set -e
 trap cleanup EXIT
 trap ffmpegfserr USR1
 DESTTYPE=$1
+# Further parameters are passed to ffmpegfs, and are added to the log file name
+OPTIONS=("${@:2}")
+LOGFILE="$0_${DESTTYPE}"
+for OPTION in "${OPTIONS[@]}"
+do
+    OPTION="${OPTION#--}"
+    LOGFILE="${LOGFILE}_${OPTION//=/}"
+done
 # Map filenames
 if [ "${DESTTYPE}" == "prores" ];
 then
@@ -42,7 +50,7 @@ DIRNAME="$(mktemp -d)"
 CACHEPATH="$(mktemp -d)"
 
 #--disable_cache
-( ffmpegfs -f "$SRCDIR" "$DIRNAME" --logfile=$0_${DESTTYPE}.builtin.log --log_maxlevel=TRACE --cachepath="$CACHEPATH" --desttype=${DESTTYPE} > /dev/null || kill -USR1 $$ ) &
+( ffmpegfs -f "$SRCDIR" "$DIRNAME" --logfile="${LOGFILE}.builtin.log" --log_maxlevel=TRACE --cachepath="$CACHEPATH" --desttype=${DESTTYPE} "${OPTIONS[@]}" > /dev/null || kill -USR1 $$ ) &
 while ! mount | grep -q "$DIRNAME" ; do
     sleep 0.1
 done